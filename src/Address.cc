@@ -0,0 +1,154 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "Address.h"
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the index of the given nibble among the nibbles that can be part of a
+ * master address (0x0, 0x1, 0x3, 0x7 and 0xf), or -1 if it cannot be part of
+ * a master address.
+ */
+constexpr int masterNibbleIndex(unsigned nibble)
+{
+    for(int index = 0; index<=4; ++index) {
+        if (nibble==(1u<<index) - 1) return index;
+    }
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+constexpr Address::table_t Address::generateTable()
+{
+    constexpr char digits[] = "0123456789abcdef";
+
+    table_t table{};
+
+    for(unsigned address = 0; address<256; ++address) {
+        Info& info = table[address];
+
+        int priorityClass = masterNibbleIndex(address&0x0f);
+        if (address==broadcast) {
+            info.addressClass = CLASS_BROADCAST;
+        } else if (address==0xa9 || address==0xaa) {
+            info.addressClass = CLASS_INVALID;
+        } else if (priorityClass>=0 &&
+                   masterNibbleIndex((address>>4)&0x0f)>=0)
+        {
+            info.addressClass = CLASS_MASTER;
+        } else {
+            info.addressClass = CLASS_SLAVE;
+        }
+
+        if (info.addressClass==CLASS_MASTER) {
+            info.priorityClass = static_cast<symbol_t>(priorityClass);
+            info.slaveAddress =
+                static_cast<symbol_t>((address + slaveOffset)&0xff);
+        } else {
+            info.priorityClass = noPriorityClass;
+            info.slaveAddress = static_cast<symbol_t>(address);
+        }
+
+        info.name[0] = digits[address>>4];
+        info.name[1] = digits[address&0x0f];
+        info.name[2] = 0;
+    }
+
+    return table;
+}
+
+//------------------------------------------------------------------------------
+
+constexpr Address::table_t Address::table = Address::generateTable();
+
+//------------------------------------------------------------------------------
+// Compile-time checks
+//------------------------------------------------------------------------------
+
+/**
+ * Determine if the given symbol can be a master address the way it had been
+ * determined before the table was introduced.
+ */
+constexpr bool isMasterReference(unsigned address)
+{
+    unsigned prioClass = (address&0x0f) + 1;
+    unsigned subAddress = ((address&0xf0)>>4) + 1;
+    return (prioClass&(prioClass-1))==0 && (subAddress&(subAddress-1))==0;
+}
+
+/**
+ * Determine if the classes of the addresses match the reference and the
+ * slave addresses of the masters are slave addresses.
+ */
+constexpr bool classesMatchReference()
+{
+    unsigned numMasters = 0;
+    for(unsigned address = 0; address<256; ++address) {
+        const Address::Info& info = Address::table[address];
+        if (isMasterReference(address)) {
+            ++numMasters;
+            if (info.addressClass!=Address::CLASS_MASTER) return false;
+            if (Address::table[info.slaveAddress].addressClass!=
+                Address::CLASS_SLAVE)
+            {
+                return false;
+            }
+        } else if (info.addressClass==Address::CLASS_MASTER) {
+            return false;
+        }
+    }
+    return numMasters==25;
+}
+
+static_assert(classesMatchReference(),
+              "the master addresses differ from the reference");
+
+static_assert(Address::table[0x10].priorityClass==0 &&
+              Address::table[0x31].priorityClass==1 &&
+              Address::table[0x03].priorityClass==2 &&
+              Address::table[0xf7].priorityClass==3 &&
+              Address::table[0x7f].priorityClass==4 &&
+              Address::table[0x15].priorityClass==Address::noPriorityClass,
+              "the priority classes are wrong");
+
+static_assert(Address::table[0x10].slaveAddress==0x15 &&
+              Address::table[0xff].slaveAddress==0x04,
+              "the slave addresses are wrong");
+
+static_assert(Address::table[0xfe].addressClass==Address::CLASS_BROADCAST &&
+              Address::table[0xaa].addressClass==Address::CLASS_INVALID &&
+              Address::table[0xa9].addressClass==Address::CLASS_INVALID &&
+              Address::table[0x08].addressClass==Address::CLASS_SLAVE,
+              "the address classes are wrong");
+
+static_assert(Address::table[0x0b].name[0]=='0' &&
+              Address::table[0x0b].name[1]=='b' &&
+              Address::table[0x0b].name[2]==0,
+              "the names of the addresses are wrong");
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
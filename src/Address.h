@@ -0,0 +1,216 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef ADDRESS_H
+#define ADDRESS_H
+//------------------------------------------------------------------------------
+
+#include <array>
+
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Classification of the eBUS addresses. The properties of each of the 256
+ * possible addresses are looked up in a table generated at compile time, so
+ * that the parser, the sender and the formatters need not compute them for
+ * every telegram.
+ */
+class Address
+{
+public:
+    /**
+     * Type for symbols.
+     */
+    typedef uint8_t symbol_t;
+
+    /**
+     * The classes of the addresses.
+     */
+    typedef enum {
+        // The address of a master, i.e. both of its nibbles are one of 0x0,
+        // 0x1, 0x3, 0x7 or 0xf
+        CLASS_MASTER,
+
+        // The address of a slave
+        CLASS_SLAVE,
+
+        // The broadcast address
+        CLASS_BROADCAST,
+
+        // The SYN or the escape symbol, which cannot be used as an address
+        CLASS_INVALID
+    } class_t;
+
+    /**
+     * The broadcast address.
+     */
+    static constexpr symbol_t broadcast = 0xfe;
+
+    /**
+     * The priority class of the addresses that are not master addresses.
+     */
+    static constexpr symbol_t noPriorityClass = 0xff;
+
+    /**
+     * The difference between the address of a master and the address of the
+     * slave belonging to the same device.
+     */
+    static constexpr symbol_t slaveOffset = 5;
+
+    /**
+     * The properties of an address.
+     */
+    struct Info
+    {
+        /**
+         * The class of the address.
+         */
+        class_t addressClass;
+
+        /**
+         * The priority class of a master address from 0 (highest) to 4
+         * (lowest), determined by its low nibble. It is noPriorityClass for
+         * other addresses.
+         */
+        symbol_t priorityClass;
+
+        /**
+         * The address of the slave belonging to a master address. It is the
+         * address itself for other addresses.
+         */
+        symbol_t slaveAddress;
+
+        /**
+         * The address formatted as two hexadecimal digits.
+         */
+        char name[3];
+    };
+
+    /**
+     * Type for the table of the addresses.
+     */
+    typedef std::array<Info, 256> table_t;
+
+    /**
+     * The table of the addresses.
+     */
+    static const table_t table;
+
+    /**
+     * Get the properties of the given address.
+     */
+    static const Info& get(symbol_t address);
+
+    /**
+     * Determine if the given symbol can be a master address.
+     */
+    static bool isMaster(symbol_t address);
+
+    /**
+     * Determine if the given symbol can be a slave address.
+     */
+    static bool isSlave(symbol_t address);
+
+    /**
+     * Determine if the given symbol is the broadcast address.
+     */
+    static bool isBroadcast(symbol_t address);
+
+    /**
+     * Get the priority class of the given address.
+     */
+    static symbol_t getPriorityClass(symbol_t address);
+
+    /**
+     * Get the address of the slave belonging to the given master address.
+     */
+    static symbol_t getSlaveAddress(symbol_t address);
+
+    /**
+     * Get the given address formatted as two hexadecimal digits.
+     */
+    static const char* toString(symbol_t address);
+
+private:
+    /**
+     * Generate the table of the addresses.
+     */
+    static constexpr table_t generateTable();
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline const Address::Info& Address::get(symbol_t address)
+{
+    return table[address];
+}
+
+//------------------------------------------------------------------------------
+
+inline bool Address::isMaster(symbol_t address)
+{
+    return table[address].addressClass==CLASS_MASTER;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool Address::isSlave(symbol_t address)
+{
+    return table[address].addressClass==CLASS_SLAVE;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool Address::isBroadcast(symbol_t address)
+{
+    return address==broadcast;
+}
+
+//------------------------------------------------------------------------------
+
+inline Address::symbol_t Address::getPriorityClass(symbol_t address)
+{
+    return table[address].priorityClass;
+}
+
+//------------------------------------------------------------------------------
+
+inline Address::symbol_t Address::getSlaveAddress(symbol_t address)
+{
+    return table[address].slaveAddress;
+}
+
+//------------------------------------------------------------------------------
+
+inline const char* Address::toString(symbol_t address)
+{
+    return table[address].name;
+}
+
+//------------------------------------------------------------------------------
+#endif // ADDRESS_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
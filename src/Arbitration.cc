@@ -0,0 +1,118 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "Arbitration.h"
+
+#include "Address.h"
+#include "util.h"
+
+//------------------------------------------------------------------------------
+
+Arbitration::Statistics::Statistics() :
+    numAttempts(0),
+    numWon(0),
+    numGivenUp(0),
+    totalTimeToWin(0),
+    maxTimeToWin(0)
+{
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+void Arbitration::setLockCount(unsigned lockCount)
+{
+    this->lockCount = (lockCount<maxLockCount) ? lockCount : maxLockCount;
+}
+
+//------------------------------------------------------------------------------
+
+unsigned Arbitration::getLockCount() const
+{
+    if (lockCount>0) return lockCount;
+
+    unsigned numMasters = mastersSeen.count();
+    if (numMasters==0) return 1;
+    return (numMasters<maxLockCount) ? numMasters : maxLockCount;
+}
+
+//------------------------------------------------------------------------------
+
+void Arbitration::masterSeen(symbol_t address)
+{
+    if (Address::isMaster(address)) mastersSeen.set(address);
+}
+
+//------------------------------------------------------------------------------
+
+Arbitration::result_t Arbitration::arbitrated(symbol_t source,
+                                              symbol_t symbol,
+                                              unsigned long long time)
+{
+    // Only the telegrams from a master address may be sent, so the
+    // source has a priority class
+    auto priorityClass = Address::getPriorityClass(source);
+    if (priorityClass>=numPriorityClasses) {
+        lockCounter = 1;
+        cancelled();
+        return RESULT_GIVEN_UP;
+    }
+
+    auto& stats = statistics[priorityClass];
+
+    addToCounter(stats.numAttempts);
+    if (firstAttemptTime==0) firstAttemptTime = time;
+
+    if (symbol==source) {
+        auto timeToWin = time - firstAttemptTime;
+        addToCounter(stats.numWon);
+        addToCounter(stats.totalTimeToWin, timeToWin);
+        raiseCounter(stats.maxTimeToWin, timeToWin);
+
+        // The SYN symbol ending our telegram is the first one counted
+        lockCounter = getLockCount();
+        cancelled();
+        return RESULT_WON;
+    }
+
+    ++numLosses;
+    if (maxLosses>0 && numLosses>=maxLosses) {
+        addToCounter(stats.numGivenUp);
+        lockCounter = 1;
+        cancelled();
+        return RESULT_GIVEN_UP;
+    }
+
+    if (Address::getPriorityClass(symbol)==Address::getPriorityClass(source)) {
+        lockCounter = 1;
+        return RESULT_LOST_SAME_CLASS;
+    } else {
+        lockCounter = 2;
+        return RESULT_LOST;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
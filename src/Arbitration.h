@@ -0,0 +1,324 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef ARBITRATION_H
+#define ARBITRATION_H
+//------------------------------------------------------------------------------
+
+#include <atomic>
+#include <bitset>
+
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * The arbitration engine deciding when our telegrams may compete for the
+ * bus, following the rules of the eBUS specification:
+ *
+ * - The arbitration may be started only right after a SYN symbol.
+ * - If it is lost against a master of the same priority class, it may be
+ *   retried after the next SYN symbol. If it is lost against a master of
+ *   another priority class, the telegram of that master is let through
+ *   first, i.e. the next SYN symbol is skipped.
+ * - If it is won, the lock counter is loaded with the number of masters on
+ *   the bus, and it is decremented by every SYN symbol. The arbitration may
+ *   be started again only when it has reached 0, so that every other
+ *   master can send a telegram in the meantime.
+ *
+ * To avoid occupying the bus forever, a telegram is given up after losing
+ * the arbitration a certain number of times in a row.
+ *
+ * The statistics are updated by the thread running the message handler,
+ * but they may be read by other threads.
+ */
+class Arbitration
+{
+public:
+    /**
+     * Type for symbols.
+     */
+    typedef uint8_t symbol_t;
+
+    /**
+     * The number of priority classes.
+     */
+    static const unsigned numPriorityClasses = 5;
+
+    /**
+     * The maximal value of the lock counter, i.e. the maximal number of
+     * masters on a bus.
+     */
+    static const unsigned maxLockCount = 25;
+
+    /**
+     * The default number of times a telegram may lose the arbitration in a
+     * row before it is given up.
+     */
+    static const unsigned defaultMaxLosses = 25;
+
+    /**
+     * The results of an arbitration.
+     */
+    typedef enum {
+        // The arbitration has been won
+        RESULT_WON,
+
+        // The arbitration has been lost against a master of the same
+        // priority class
+        RESULT_LOST_SAME_CLASS,
+
+        // The arbitration has been lost against a master of another
+        // priority class, or the symbol received is not a master address
+        RESULT_LOST,
+
+        // The arbitration has been lost, and the telegram should be given
+        // up, as it has lost too many times, or its source is not a master
+        // address
+        RESULT_GIVEN_UP
+    } result_t;
+
+    /**
+     * Statistics about the arbitrations in a priority class.
+     */
+    struct Statistics
+    {
+        /**
+         * The number of arbitrations started.
+         */
+        std::atomic<unsigned long> numAttempts;
+
+        /**
+         * The number of arbitrations won.
+         */
+        std::atomic<unsigned long> numWon;
+
+        /**
+         * The number of telegrams given up.
+         */
+        std::atomic<unsigned long> numGivenUp;
+
+        /**
+         * The total time in nanoseconds from the first attempt for a
+         * telegram until winning the arbitration for it.
+         */
+        std::atomic<unsigned long long> totalTimeToWin;
+
+        /**
+         * The maximal time in nanoseconds from the first attempt for a
+         * telegram until winning the arbitration for it.
+         */
+        std::atomic<unsigned long long> maxTimeToWin;
+
+        /**
+         * Construct the statistics with all counters being 0.
+         */
+        Statistics();
+    };
+
+private:
+    /**
+     * The value the lock counter is loaded with after winning the
+     * arbitration. If it is 0, the number of masters seen on the bus is
+     * used.
+     */
+    unsigned lockCount;
+
+    /**
+     * The number of SYN symbols still to be received before the
+     * arbitration may be started.
+     */
+    unsigned lockCounter;
+
+    /**
+     * The number of times a telegram may lose the arbitration in a row
+     * before it is given up.
+     */
+    unsigned maxLosses;
+
+    /**
+     * The master addresses seen on the bus.
+     */
+    std::bitset<256> mastersSeen;
+
+    /**
+     * The number of times the arbitration has been lost for the current
+     * telegram.
+     */
+    unsigned numLosses;
+
+    /**
+     * The time of the first attempt for the current telegram, or 0 if
+     * there has been no attempt yet.
+     */
+    unsigned long long firstAttemptTime;
+
+    /**
+     * The statistics for each priority class.
+     */
+    Statistics statistics[numPriorityClasses];
+
+public:
+    /**
+     * Construct the arbitration engine.
+     */
+    Arbitration();
+
+    /**
+     * Set the value the lock counter is loaded with after winning the
+     * arbitration. If it is 0, the number of masters seen on the bus is
+     * used. It is limited to maxLockCount.
+     */
+    void setLockCount(unsigned lockCount);
+
+    /**
+     * Get the value the lock counter is loaded with after winning the
+     * arbitration.
+     */
+    unsigned getLockCount() const;
+
+    /**
+     * Set the number of times a telegram may lose the arbitration in a row
+     * before it is given up.
+     */
+    void setMaxLosses(unsigned maxLosses);
+
+    /**
+     * Reset the state, e.g. when the signal has been lost. The lock counter
+     * is cleared, but the masters seen are kept.
+     */
+    void reset();
+
+    /**
+     * Indicate that a telegram from the given address has been seen on
+     * the bus.
+     */
+    void masterSeen(symbol_t address);
+
+    /**
+     * Indicate that the given number of SYN symbols have been received.
+     */
+    void synReceived(unsigned numSYNs);
+
+    /**
+     * Determine if the arbitration may be started at the next SYN symbol.
+     */
+    bool canStart() const;
+
+    /**
+     * Evaluate the arbitration for a telegram from the given source
+     * address, when the given symbol has been received in response to
+     * the source address written at the given time.
+     */
+    result_t arbitrated(symbol_t source, symbol_t symbol,
+                        unsigned long long time);
+
+    /**
+     * Indicate that the telegram for which the arbitration has been
+     * attempted has been removed from the send queue otherwise than by
+     * winning the arbitration, or the next attempt is for another
+     * telegram.
+     */
+    void cancelled();
+
+    /**
+     * Indicate that the telegram has been aborted right after winning the
+     * arbitration, e.g. due to an echo mismatch. The lock counter is not
+     * kept, the arbitration may be retried as if it had been lost against
+     * a master of the same priority class.
+     */
+    void aborted();
+
+    /**
+     * Get the statistics of the given priority class.
+     */
+    const Statistics& getStatistics(unsigned priorityClass) const;
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline Arbitration::Arbitration() :
+    lockCount(0),
+    lockCounter(0),
+    maxLosses(defaultMaxLosses),
+    numLosses(0),
+    firstAttemptTime(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline void Arbitration::setMaxLosses(unsigned maxLosses)
+{
+    this->maxLosses = maxLosses;
+}
+
+//------------------------------------------------------------------------------
+
+inline void Arbitration::reset()
+{
+    lockCounter = 0;
+}
+
+//------------------------------------------------------------------------------
+
+inline void Arbitration::synReceived(unsigned numSYNs)
+{
+    lockCounter -= (numSYNs<lockCounter) ? numSYNs : lockCounter;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool Arbitration::canStart() const
+{
+    return lockCounter==0;
+}
+
+//------------------------------------------------------------------------------
+
+inline void Arbitration::cancelled()
+{
+    numLosses = 0;
+    firstAttemptTime = 0;
+}
+
+//------------------------------------------------------------------------------
+
+inline void Arbitration::aborted()
+{
+    lockCounter = 1;
+}
+
+//------------------------------------------------------------------------------
+
+inline const Arbitration::Statistics&
+Arbitration::getStatistics(unsigned priorityClass) const
+{
+    return statistics[priorityClass];
+}
+
+//------------------------------------------------------------------------------
+#endif // ARBITRATION_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -23,132 +23,289 @@
 #include "EBUS.h"
 #include "util.h"
 
+#include <algorithm>
+
 //------------------------------------------------------------------------------
 
-const unsigned char BusHandler::crcLookupTable[256] =
+void BusHandler::setReadBatching(bool batching)
 {
-    0x00, 0x9b, 0xad, 0x36, 0xc1, 0x5a, 0x6c, 0xf7, 0x19, 0x82, 0xb4, 0x2f, 0xd8, 0x43, 0x75, 0xee,
-    0x32, 0xa9, 0x9f, 0x04, 0xf3, 0x68, 0x5e, 0xc5, 0x2b, 0xb0, 0x86, 0x1d, 0xea, 0x71, 0x47, 0xdc,
-    0x64, 0xff, 0xc9, 0x52, 0xa5, 0x3e, 0x08, 0x93, 0x7d, 0xe6, 0xd0, 0x4b, 0xbc, 0x27, 0x11, 0x8a,
-    0x56, 0xcd, 0xfb, 0x60, 0x97, 0x0c, 0x3a, 0xa1, 0x4f, 0xd4, 0xe2, 0x79, 0x8e, 0x15, 0x23, 0xb8,
-    0xc8, 0x53, 0x65, 0xfe, 0x09, 0x92, 0xa4, 0x3f, 0xd1, 0x4a, 0x7c, 0xe7, 0x10, 0x8b, 0xbd, 0x26,
-    0xfa, 0x61, 0x57, 0xcc, 0x3b, 0xa0, 0x96, 0x0d, 0xe3, 0x78, 0x4e, 0xd5, 0x22, 0xb9, 0x8f, 0x14,
-    0xac, 0x37, 0x01, 0x9a, 0x6d, 0xf6, 0xc0, 0x5b, 0xb5, 0x2e, 0x18, 0x83, 0x74, 0xef, 0xd9, 0x42,
-    0x9e, 0x05, 0x33, 0xa8, 0x5f, 0xc4, 0xf2, 0x69, 0x87, 0x1c, 0x2a, 0xb1, 0x46, 0xdd, 0xeb, 0x70,
-    0x0b, 0x90, 0xa6, 0x3d, 0xca, 0x51, 0x67, 0xfc, 0x12, 0x89, 0xbf, 0x24, 0xd3, 0x48, 0x7e, 0xe5,
-    0x39, 0xa2, 0x94, 0x0f, 0xf8, 0x63, 0x55, 0xce, 0x20, 0xbb, 0x8d, 0x16, 0xe1, 0x7a, 0x4c, 0xd7,
-    0x6f, 0xf4, 0xc2, 0x59, 0xae, 0x35, 0x03, 0x98, 0x76, 0xed, 0xdb, 0x40, 0xb7, 0x2c, 0x1a, 0x81,
-    0x5d, 0xc6, 0xf0, 0x6b, 0x9c, 0x07, 0x31, 0xaa, 0x44, 0xdf, 0xe9, 0x72, 0x85, 0x1e, 0x28, 0xb3,
-    0xc3, 0x58, 0x6e, 0xf5, 0x02, 0x99, 0xaf, 0x34, 0xda, 0x41, 0x77, 0xec, 0x1b, 0x80, 0xb6, 0x2d,
-    0xf1, 0x6a, 0x5c, 0xc7, 0x30, 0xab, 0x9d, 0x06, 0xe8, 0x73, 0x45, 0xde, 0x29, 0xb2, 0x84, 0x1f,
-    0xa7, 0x3c, 0x0a, 0x91, 0x66, 0xfd, 0xcb, 0x50, 0xbe, 0x25, 0x13, 0x88, 0x7f, 0xe4, 0xd2, 0x49,
-    0x95, 0x0e, 0x38, 0xa3, 0x54, 0xcf, 0xf9, 0x62, 0x8c, 0x17, 0x21, 0xba, 0x4d, 0xd6, 0xe0, 0x7b,
-};
+    ebus.setReadBatching(batching);
+}
 
 //------------------------------------------------------------------------------
 
-bool BusHandler::waitSignal(unsigned timeout) throw (OSError, TimeoutException)
+void BusHandler::measureRoundTrip(unsigned numAttempts)
 {
+    roundTripWaitDeadline = deadlineIn(maxRoundTripWait*1000ULL);
+    numRoundTripAttempts = numAttempts + 1;
+    nextRoundTripAttempt();
+}
 
-    if (timeout==0) {
-        while(true) {
-            auto symbol = ebus.read();
-            if (symbol==SYMBOL_SYN) return true;
-        }
-    } else {
-        unsigned long long now = currentTimeMillis();
-        unsigned long long timeoutEnd = now + timeout;
-        while(now<timeoutEnd) {
-            symbol_t symbol;
-            if (ebus.readMaybe(symbol, now - timeoutEnd)) {
-                if (symbol==SYMBOL_SYN) return true;
-            }
-            now = currentTimeMillis();
+//------------------------------------------------------------------------------
+
+unsigned long long BusHandler::getLastReceiveTime() const
+{
+    return ebus.getLastReceiveTime();
+}
+
+//------------------------------------------------------------------------------
+
+bool BusHandler::nextRawSymbol(symbol_t& symbol)
+{
+    if (!ebus.nextReceived(symbol)) return false;
+
+    lastSymbolTime = ebus.getLastReceiveTime();
+    updateCRC(crc, symbol);
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool BusHandler::findSignal()
+{
+    symbol_t symbol;
+    while(ebus.nextReceived(symbol)) {
+        if (symbol==SYMBOL_SYN) {
+            lastSymbolTime = ebus.getLastReceiveTime();
+            return true;
         }
     }
-
     return false;
 }
 
 //------------------------------------------------------------------------------
 
-bool BusHandler::nextRawSymbolMaybe(symbol_t& symbol) throw (OSError)
+size_t BusHandler::peekRawSymbols(const symbol_t*& symbols,
+                                  const unsigned long long*& times) const
 {
-    if (synPending) {
-        symbol = SYMBOL_SYN;
-        synPending = false;
-        return true;
-    }
+    return ebus.peekReceived(symbols, times);
+}
 
-    bool result = ebus.readMaybe(symbol, TIMEOUT_AUTO_SYN);
-    if (result) {
-        updateCRC(crc, symbol);
-    }
-    return result;
+//------------------------------------------------------------------------------
+
+void BusHandler::skipRawSymbols(size_t length)
+{
+    if (length==0) return;
+
+    ebus.skipReceived(length);
+    lastSymbolTime = ebus.getLastReceiveTime();
 }
 
 //------------------------------------------------------------------------------
 
-size_t BusHandler::getHistory(symbol_t* symbols)
+Error BusHandler::writeSymbol(symbol_t symbol) noexcept
 {
-    size_t count = 0;
+    writeTime = currentTimeNanos();
+    auto error = ebus.write(symbol);
+    if (!error.isOK()) return error;
 
-    while(historyFirstOffset!=historyNextOffset) {
-        *symbols = history[historyFirstOffset++];
-        ++symbols;
-        ++count;
+    operation = OP_SYMBOL;
+    ebus.setDeadline(writeTime + EBUS::SYMBOL_DURATION + echoTimeout);
 
-        if (historyFirstOffset>=historyLength) {
-            historyFirstOffset = 0;
-        }
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+Error BusHandler::writeSymbols(const symbol_t* symbols, size_t length)
+    noexcept
+{
+    if (length>maxNumWrittenSymbols) {
+        ebus.close();
+        return Error::os("BusHandler::writeSymbols: too many symbols",
+                         EMSGSIZE);
     }
 
-    return count;
+    writeTime = currentTimeNanos();
+    auto error = ebus.write(symbols, length);
+    if (!error.isOK()) return error;
+
+    std::copy(symbols, symbols + length, writtenSymbols);
+    numWrittenSymbols = length;
+    numEchoes = 0;
+
+    operation = OP_SYMBOLS;
+    ebus.setDeadline(writeTime + EBUS::SYMBOL_DURATION + echoTimeout);
+
+    return Error();
 }
 
 //------------------------------------------------------------------------------
 
-bool BusHandler::nextSymbolMaybe(symbol_t& symbol) throw (OSError, SYNException)
+void BusHandler::opened() noexcept
 {
-    if (!nextRawSymbolMaybe(symbol)) return false;
+    operation = OP_NONE;
+    listener->busOpened();
+}
 
-    if (symbol==SYMBOL_ESC) {
-        if (!nextRawSymbolMaybe(symbol)) return false;
-        if (symbol==SYMBOL_SYN) {
-            synPending = true;
-            throw SYNException();
+//------------------------------------------------------------------------------
+
+void BusHandler::received() noexcept
+{
+    while(!ebus.isReceiveBufferEmpty()) {
+        symbol_t symbol;
+        switch(operation) {
+          case OP_NONE:
+            // The listener may start an operation, which gets the symbols
+            // left
+            listener->symbolsReceived();
+            if (operation==OP_NONE) return;
+            break;
+          case OP_SYMBOL:
+            nextRawSymbol(symbol);
+            lastRoundTrip =
+                (lastSymbolTime>writeTime) ? (lastSymbolTime - writeTime) : 0;
+            completeSymbol(symbol);
+            break;
+          case OP_SYMBOLS:
+            nextRawSymbol(symbol);
+            if (symbol!=writtenSymbols[numEchoes]) {
+                auto error = ebus.flushOutput();
+                if (error.isOK()) {
+                    completeSymbols(false);
+                } else {
+                    completeSymbols(error);
+                }
+            } else if (++numEchoes==numWrittenSymbols) {
+                completeSymbols(true);
+            } else {
+                ebus.setDeadline(writeTime +
+                                 (numEchoes+1) * EBUS::SYMBOL_DURATION +
+                                 echoTimeout);
+            }
+            break;
+          case OP_SILENCE: {
+            // The symbols received are discarded, and the silence is
+            // waited for from the last one
+            const symbol_t* symbols;
+            const unsigned long long* times;
+            ebus.skipReceived(ebus.peekReceived(symbols, times));
+
+            auto deadline =
+                ebus.getLastReceiveTime() + TIMEOUT_AUTO_SYN*1000ULL;
+            if (deadline>roundTripWaitDeadline) {
+                completeRoundTrip(0);
+            } else {
+                ebus.setDeadline(deadline);
+            }
+            break;
+          }
+          case OP_ROUND_TRIP: {
+            ebus.nextReceived(symbol);
+            auto echoTime = ebus.getLastReceiveTime();
+            if (symbol==SYMBOL_SYN && echoTime>writeTime) {
+                completeRoundTrip(echoTime - writeTime);
+            } else {
+                nextRoundTripAttempt();
+            }
+            break;
+          }
         }
-        symbol += SYMBOL_ESC;
-    } else if (symbol==SYMBOL_SYN) {
-        synPending = true;
-        throw SYNException();
     }
+}
 
-    history[historyNextOffset++] = symbol;
-    if (historyNextOffset>=historyLength) {
-        historyNextOffset = 0;
-    }
-    if (historyNextOffset==historyFirstOffset) {
-        ++historyFirstOffset;
-        if (historyFirstOffset>=historyLength) {
-            historyFirstOffset = 0;
+//------------------------------------------------------------------------------
+
+void BusHandler::deadlinePassed() noexcept
+{
+    switch(operation) {
+      case OP_NONE:
+        listener->timedOut();
+        break;
+      case OP_SYMBOL:
+        completeSymbol(Error::timeout());
+        break;
+      case OP_SYMBOLS: {
+        auto error = ebus.flushOutput();
+        completeSymbols(error.isOK() ? Error::timeout() : error);
+        break;
+      }
+      case OP_SILENCE: {
+        // The bus has been silent long enough
+        writeTime = currentTimeNanos();
+        auto error = ebus.write(SYMBOL_SYN);
+        if (!error.isOK()) {
+            completeRoundTrip(error);
+        } else {
+            operation = OP_ROUND_TRIP;
+            ebus.setDeadline(writeTime + TIMEOUT_AUTO_SYN*1000ULL);
         }
+        break;
+      }
+      case OP_ROUND_TRIP:
+        completeRoundTrip(0);
+        break;
     }
+}
 
+//------------------------------------------------------------------------------
 
-    return true;
+void BusHandler::failed(const Error& error) noexcept
+{
+    switch(operation) {
+      case OP_SYMBOL:
+        completeSymbol(error);
+        break;
+      case OP_SYMBOLS:
+        completeSymbols(error);
+        break;
+      case OP_SILENCE:
+      case OP_ROUND_TRIP:
+        completeRoundTrip(error);
+        break;
+      default:
+        listener->busFailed(error);
+        break;
+    }
 }
 
 //------------------------------------------------------------------------------
 
-symbol_t BusHandler::writeSymbol(symbol_t symbol) throw (OSError)
+void BusHandler::completeSymbol(const Result<symbol_t>& result) noexcept
 {
-    ebus.write(symbol);
+    operation = OP_NONE;
+    ebus.setDeadline(0);
+    listener->symbolWritten(result);
+}
 
-    symbol = ebus.read();
-    updateCRC(crc, symbol);
+//------------------------------------------------------------------------------
+
+void BusHandler::completeSymbols(const Result<bool>& result) noexcept
+{
+    operation = OP_NONE;
+    ebus.setDeadline(0);
+    listener->symbolsWritten(result);
+}
+
+//------------------------------------------------------------------------------
+
+void BusHandler::completeRoundTrip(const Result<unsigned long long>& result)
+    noexcept
+{
+    operation = OP_NONE;
+    ebus.setDeadline(0);
+    listener->roundTripMeasured(result);
+}
+
+//------------------------------------------------------------------------------
+
+void BusHandler::nextRoundTripAttempt() noexcept
+{
+    if (--numRoundTripAttempts==0) {
+        completeRoundTrip(0);
+        return;
+    }
+
+    // Wait for the bus to be silent for the auto-SYN timeout. If it is not
+    // silent until the end of the wait, there is a SYN generator.
+    auto deadline = deadlineIn(TIMEOUT_AUTO_SYN);
+    if (deadline>roundTripWaitDeadline) {
+        completeRoundTrip(0);
+        return;
+    }
 
-    return symbol;
+    operation = OP_SILENCE;
+    ebus.setDeadline(deadline);
 }
 
 //------------------------------------------------------------------------------
@@ -20,29 +20,25 @@
 #define BUSHANDLER_H
 //------------------------------------------------------------------------------
 
-#include "OSError.h"
-#include "TimeoutException.h"
+#include "EBUS.h"
+#include "Result.h"
+#include "CRC.h"
+#include "util.h"
 
 #include <inttypes.h>
 
 //------------------------------------------------------------------------------
 
-class EBUS;
-
-//------------------------------------------------------------------------------
-
-// FIXME: perhaps move it to some common header
-class SYNException
-{
-};
-
-//------------------------------------------------------------------------------
-
 /**
  * A wrapper over eBUS with some helper functions to be able to manage the
  * bus.
+ *
+ * It does not block: the symbols written are verified as their echoes are
+ * received, and the results are reported to the listener, which is also
+ * notified when symbols are received or the deadline passes while nothing
+ * is being written.
  */
-class BusHandler
+class BusHandler : private EBUS::Listener
 {
 public:
     /**
@@ -51,9 +47,98 @@ public:
     typedef uint8_t symbol_t;
 
     /**
-     * Timeout for the auto-SYN symbol.
+     * The interface of the listeners of the bus handler. The functions are
+     * called by the reactor driving the bus.
      */
-    static const unsigned TIMEOUT_AUTO_SYN = 51;
+    class Listener
+    {
+    public:
+        /**
+         * Called when the bus has been opened.
+         */
+        virtual void busOpened() noexcept = 0;
+
+        /**
+         * Called when symbols have been received while nothing is being
+         * written. They can be consumed by nextRawSymbol(), findSignal()
+         * or skipRawSymbols(). Those not consumed are passed to the
+         * operation started, if any.
+         */
+        virtual void symbolsReceived() noexcept = 0;
+
+        /**
+         * Called when the deadline set by setDeadline() has passed without
+         * any symbol received.
+         */
+        virtual void timedOut() noexcept = 0;
+
+        /**
+         * Called with the result of writeSymbol(): the echo of the symbol
+         * or the error, which is a timeout error, if the echo has not
+         * arrived in time.
+         */
+        virtual void symbolWritten(const Result<symbol_t>& result)
+            noexcept = 0;
+
+        /**
+         * Called with the result of writeSymbols(): whether all echoes
+         * matched the symbols written, or the error.
+         */
+        virtual void symbolsWritten(const Result<bool>& result)
+            noexcept = 0;
+
+        /**
+         * Called with the result of measureRoundTrip(): the round trip time
+         * in nanoseconds, or 0 if it could not be measured, e.g. because
+         * the bus is not silent.
+         */
+        virtual void roundTripMeasured(const Result<unsigned long long>& result)
+            noexcept = 0;
+
+        /**
+         * Called when the bus has failed, and thus it has been closed, or
+         * the end of a replayed capture has been reached.
+         */
+        virtual void busFailed(const Error& error) noexcept = 0;
+
+    protected:
+        /**
+         * Destroy the listener.
+         */
+        ~Listener();
+    };
+
+    /**
+     * Timeout for the auto-SYN symbol in microseconds.
+     */
+    static const unsigned TIMEOUT_AUTO_SYN = 51000;
+
+    /**
+     * The time in microseconds the bus should be idle after the last symbol
+     * before a SYN symbol is generated, if we are the SYN generator. It is
+     * well below the timeout, so that the other devices do not lose the
+     * signal.
+     */
+    static const unsigned INTERVAL_AUTO_SYN = 40000;
+
+    /**
+     * The default time in microseconds the echo of a symbol written may
+     * arrive later than its transmission would end. It covers the latency
+     * of the adapter, e.g. the latency timer of a USB serial converter.
+     */
+    static const unsigned TIMEOUT_ECHO = 20000;
+
+    /**
+     * The maximal time in milliseconds to wait for the bus to be silent when
+     * measuring the round trip time.
+     */
+    static const unsigned maxRoundTripWait = 1000;
+
+    /**
+     * The maximal number of symbols that can be written by writeSymbols()
+     * at once.
+     */
+    static const size_t maxNumWrittenSymbols = 1024;
 
     /**
      * Symbol: ACK
@@ -81,77 +166,172 @@ public:
     static const symbol_t SYMBOL_NACK = 0xff;
 
     /**
-     * The CRC lookup table.
+     * Update the given CRC value with the given symbol.
      */
-    static const unsigned char crcLookupTable[256];
+    static symbol_t updateCRC(symbol_t& crc, symbol_t symbol);
 
     /**
-     * The length of the symbol history.
+     * Put the given symbol into the given buffer as it should be
+     * transmitted, i.e. escaping it if it is the escape or the SYN symbol.
+     * The CRC of the buffer can be computed with CRC::update().
+     *
+     * @return the number of symbols put into the buffer (1 or 2).
      */
-    static const size_t historyLength = 64;
+    static size_t escapeSymbol(symbol_t* buffer, symbol_t symbol);
 
+private:
     /**
-     * Update the given CRC value with the given symbol.
+     * The operations waiting for the symbols received.
      */
-    static symbol_t updateCRC(symbol_t& crc, symbol_t symbol);
+    typedef enum {
+        // Nothing is being written, the symbols are passed to the listener
+        OP_NONE,
+
+        // The echo of the symbol written by writeSymbol() is waited for
+        OP_SYMBOL,
+
+        // The echoes of the symbols written by writeSymbols() are waited
+        // for
+        OP_SYMBOLS,
+
+        // The bus should be silent before the round trip is measured
+        OP_SILENCE,
+
+        // The echo of the SYN symbol written to measure the round trip is
+        // waited for
+        OP_ROUND_TRIP
+    } operation_t;
 
     /**
-     * Determine if the given symbol can be a master address.
+     * The eBUS interface.
      */
-    static bool isMasterAddress(symbol_t symbol);
+    EBUS& ebus;
 
     /**
-     * Determine if the given symbol is the broadcast address.
+     * The listener.
      */
-    static bool isBroadcastAddress(symbol_t symbol);
+    Listener* listener;
 
     /**
-     * Determine if the given symbol can be a slave address.
+     * The current CRC value.
      */
-    static bool isSlaveAddress(symbol_t symbol);
+    symbol_t crc;
 
-private:
     /**
-     * The eBUS interface.
+     * The monotonic time in nanoseconds when the last symbol has been
+     * received.
      */
-    EBUS& ebus;
+    unsigned long long lastSymbolTime;
 
     /**
-     * The current CRC value.
+     * The time in nanoseconds the echo of a symbol written may arrive later
+     * than its transmission would end.
      */
-    symbol_t crc;
+    unsigned long long echoTimeout;
+
+    /**
+     * The time in nanoseconds between writing the last symbol written by
+     * writeSymbol() and receiving its echo.
+     */
+    unsigned long long lastRoundTrip;
 
     /**
-     * Indicate if a SYN symbol has been left pending.
+     * The current operation.
      */
-    bool synPending;
+    operation_t operation;
 
     /**
-     * History of normal (non-raw) symbols.
+     * The symbols written by writeSymbols() last.
      */
-    symbol_t history[historyLength];
+    symbol_t writtenSymbols[maxNumWrittenSymbols];
 
     /**
-     * The offset of the first symbol in the history.
+     * The number of the symbols written by writeSymbols() last.
      */
-    size_t historyFirstOffset;
+    size_t numWrittenSymbols;
 
     /**
-     * The offset of the next symbol in the history. If equal to
-     * historyFirstOffset, the history is empty.
+     * The number of the echoes of the symbols written by writeSymbols()
+     * received so far.
      */
-    size_t historyNextOffset;
+    size_t numEchoes;
+
+    /**
+     * The monotonic time in nanoseconds when the symbols of the current
+     * operation have been written.
+     */
+    unsigned long long writeTime;
+
+    /**
+     * The deadline in nanoseconds of the monotonic clock until which the
+     * bus may become silent for the measurement of the round trip.
+     */
+    unsigned long long roundTripWaitDeadline;
+
+    /**
+     * The number of the attempts left to measure the round trip.
+     */
+    unsigned numRoundTripAttempts;
 
 public:
     /**
-     * Construct the bus handler.
+     * Construct the bus handler. It becomes the listener of the given eBUS
+     * interface.
      */
     BusHandler(EBUS& ebus);
 
     /**
-     * Wait for the signal to appear, i.e. the reception of a SYN message.
+     * Get the deadline in nanoseconds of the monotonic clock that is the
+     * given number of microseconds from now.
+     */
+    static unsigned long long deadlineIn(unsigned long long timeout);
+
+    /**
+     * Set the listener.
+     */
+    void setListener(Listener* listener);
+
+    /**
+     * Open the bus. The listener is notified when it is open.
+     */
+    Error open() noexcept;
+
+    /**
+     * Determine if the bus is a replayed capture.
      */
-    bool waitSignal(unsigned timeout = 0) throw (OSError, TimeoutException);
+    bool isReplaying() const;
+
+    /**
+     * Set the deadline in nanoseconds of the monotonic clock, when the
+     * listener should be notified, if no symbol is received until then.
+     * If it is 0, there is no deadline. It should be called only while
+     * nothing is being written.
+     */
+    void setDeadline(unsigned long long deadline);
+
+    /**
+     * Set the time in nanoseconds the echo of a symbol written may arrive
+     * later than its transmission would end.
+     */
+    void setEchoTimeout(unsigned long long timeout);
+
+    /**
+     * Set whether the reads should be batched in the low-power mode.
+     */
+    void setReadBatching(bool batching);
+
+    /**
+     * Start measuring the time between writing a symbol and receiving its
+     * echo by writing a SYN symbol. It is written only if the bus has been
+     * silent for the auto-SYN timeout, i.e. there is no SYN generator,
+     * which would write a SYN symbol then, too. After a SYN symbol of a
+     * generator it would fall into the arbitration slot, and collide with
+     * the source address of a master starting a telegram. The measurement
+     * is tried at most the given number of times, e.g. if some master
+     * starts sending at the same time. The symbols received meanwhile are
+     * discarded. The result is reported to the listener.
+     */
+    void measureRoundTrip(unsigned numAttempts = 5);
 
     /**
      * Reset the CRC value to 0.
@@ -169,57 +349,131 @@ public:
     symbol_t getCRC() const;
 
     /**
-     * Read the next raw symbol with the SYN timeout. The symbol is raw,
-     * because this function does not handle the conversion of the sequences
-     * of 0xa9 and 0x00 and 0x01. The CRC is updated, however. The SYN timeout
-     * is used.
+     * Get the monotonic time in nanoseconds when the symbol returned last
+     * (including the echo of a written symbol) has been received.
+     */
+    unsigned long long getLastSymbolTime() const;
+
+    /**
+     * Get the monotonic time in nanoseconds when the last symbol has been
+     * received, even if it has not been returned yet.
+     */
+    unsigned long long getLastReceiveTime() const;
+
+    /**
+     * Get the next raw symbol already received. The symbol is raw, because
+     * this function does not handle the conversion of the sequences of
+     * 0xa9 and 0x00 and 0x01. The CRC is updated, however.
      *
-     * @return if the symbol could be read within the timeout.
+     * @return whether there was a symbol.
      */
-    bool nextRawSymbolMaybe(symbol_t& symbol) throw (OSError);
+    bool nextRawSymbol(symbol_t& symbol);
 
     /**
-     * Read the next raw symbol with the SYN timeout.
+     * Consume the symbols already received up to and including the first
+     * SYN symbol among them, i.e. look for the signal.
+     *
+     * @return whether a SYN symbol has been found.
      */
-    symbol_t nextRawSymbol() throw (OSError, TimeoutException);
+    bool findSignal();
 
     /**
-     * Reset the symbol history.
+     * Get the raw symbols already received, but not returned yet, and their
+     * receive times without waiting for more. They can be consumed by
+     * skipRawSymbols().
+     *
+     * @return the number of the symbols.
      */
-    void resetHistory();
+    size_t peekRawSymbols(const symbol_t*& symbols,
+                          const unsigned long long*& times) const;
 
     /**
-     * Reset the symbol history and put the given symbol into it.
+     * Consume the given number of symbols returned by peekRawSymbols(). The
+     * CRC is not updated.
      */
-    void resetHistory(symbol_t symbol);
+    void skipRawSymbols(size_t length);
 
     /**
-     * Get the symbol history. It also flushes the history.
+     * Write a symbol to the bus. Its echo is read back with the echo
+     * timeout, and it is reported to the listener. The CRC will be updated
+     * with the echo.
      *
-     * @return the number of symbols returned.
+     * @return the error, if the symbol could not be written, in which case
+     * the listener is not notified.
+     */
+    Error writeSymbol(symbol_t symbol) noexcept;
+
+    /**
+     * Get the time in nanoseconds between writing the last symbol written
+     * by writeSymbol() and receiving its echo.
      */
-    size_t getHistory(symbol_t* symbols);
+    unsigned long long getLastRoundTrip() const;
 
     /**
-     * Read the next symbol with the SYN timeout. It converts sequences of 0xa9
-     * and 0x00 or 0x01 into the appropriate symbols. If a SYN symbol arrives,
-     * a SYNException is thrown. It is flagged, and next time a raw symbol is
-     * requested, the SYN symbol is returned.
+     * Write the given raw symbols to the bus at once. Their echoes are read
+     * back and verified afterwards, and the result is reported to the
+     * listener. The CRC will be updated with the echoes. Each echo should
+     * arrive within the echo timeout after the transmission of its symbol
+     * would end.
      *
-     * @return if the symbol could be read within the timeout.
+     * If an echo does not match, the rest of the symbols are discarded
+     * from the output, so that the bus is freed as soon as possible, and
+     * the remaining echoes are not read. If an echo does not arrive in time,
+     * the output is discarded as well, and a timeout error is reported.
+     *
+     * @return the error, if the symbols could not be written, in which
+     * case the listener is not notified.
+     */
+    Error writeSymbols(const symbol_t* symbols, size_t length) noexcept;
+
+    /**
+     * Get the symbols written by writeSymbols() last.
+     */
+    const symbol_t* getWrittenSymbols(size_t& length) const;
+
+private:
+    /**
+     * Called when the bus has been opened.
+     */
+    virtual void opened() noexcept;
+
+    /**
+     * Called when bytes have been received. They are passed to the current
+     * operation or to the listener.
+     */
+    virtual void received() noexcept;
+
+    /**
+     * Called when the deadline has passed without any byte received.
      */
-    bool nextSymbolMaybe(symbol_t& symbol) throw (OSError, SYNException);
+    virtual void deadlinePassed() noexcept;
 
     /**
-     * Read the next symbol (with the SYN timeout). If a SYN symbol arrives,
-     * a SYNException is thrown.
+     * Called when the bus has failed.
      */
-    symbol_t nextSymbol() throw (OSError, TimeoutException, SYNException);
+    virtual void failed(const Error& error) noexcept;
 
     /**
-     * Write a symbol to the bus and read it back. CRC will be updated.
+     * Finish the writing of a symbol with the given result.
      */
-    symbol_t writeSymbol(symbol_t symbol) throw (OSError);
+    void completeSymbol(const Result<symbol_t>& result) noexcept;
+
+    /**
+     * Finish the writing of several symbols with the given result.
+     */
+    void completeSymbols(const Result<bool>& result) noexcept;
+
+    /**
+     * Finish the measurement of the round trip with the given result.
+     */
+    void completeRoundTrip(const Result<unsigned long long>& result)
+        noexcept;
+
+    /**
+     * Start the next attempt to measure the round trip, if any is left,
+     * otherwise report that it could not be measured.
+     */
+    void nextRoundTripAttempt() noexcept;
 };
 
 //------------------------------------------------------------------------------
@@ -229,45 +483,89 @@ public:
 inline BusHandler::symbol_t
 BusHandler::updateCRC(symbol_t& crc, symbol_t symbol)
 {
-    crc = crcLookupTable[crc] ^ symbol;
+    crc = CRC::update(crc, symbol);
     return crc;
 }
 
 //------------------------------------------------------------------------------
 
-inline bool BusHandler::isMasterAddress(symbol_t symbol)
+inline size_t BusHandler::escapeSymbol(symbol_t* buffer, symbol_t symbol)
 {
-    unsigned char prioClass = symbol&0x0f;
-    unsigned char subAddress = (symbol&0xf0)>>4;
-
-    return __builtin_popcount(prioClass+1)==1 &&
-        __builtin_popcount(subAddress+1)==1;
+    if (symbol==SYMBOL_ESC || symbol==SYMBOL_SYN) {
+        buffer[0] = SYMBOL_ESC;
+        buffer[1] = symbol - SYMBOL_ESC;
+        return 2;
+    } else {
+        buffer[0] = symbol;
+        return 1;
+    }
 }
 
 //------------------------------------------------------------------------------
 
-inline bool BusHandler::isBroadcastAddress(symbol_t symbol)
+inline unsigned long long BusHandler::deadlineIn(unsigned long long timeout)
 {
-    return symbol==SYMBOL_BCAST;
+    return currentTimeNanos() + timeout*1000ULL;
 }
 
 //------------------------------------------------------------------------------
 
-inline bool BusHandler::isSlaveAddress(symbol_t symbol)
+inline BusHandler::Listener::~Listener()
 {
-    return !isBroadcastAddress(symbol) && !isMasterAddress(symbol);
 }
 
-
 //------------------------------------------------------------------------------
 
 inline BusHandler::BusHandler(EBUS& ebus) :
     ebus(ebus),
+    listener(0),
     crc(0),
-    synPending(false),
-    historyFirstOffset(0),
-    historyNextOffset(0)
+    lastSymbolTime(0),
+    echoTimeout(TIMEOUT_ECHO*1000ULL),
+    lastRoundTrip(0),
+    operation(OP_NONE),
+    numWrittenSymbols(0),
+    numEchoes(0),
+    writeTime(0),
+    roundTripWaitDeadline(0),
+    numRoundTripAttempts(0)
+{
+    ebus.setListener(this);
+}
+
+//------------------------------------------------------------------------------
+
+inline void BusHandler::setListener(Listener* listener)
+{
+    this->listener = listener;
+}
+
+//------------------------------------------------------------------------------
+
+inline Error BusHandler::open() noexcept
+{
+    return ebus.open();
+}
+
+//------------------------------------------------------------------------------
+
+inline bool BusHandler::isReplaying() const
+{
+    return ebus.isReplaying();
+}
+
+//------------------------------------------------------------------------------
+
+inline void BusHandler::setDeadline(unsigned long long deadline)
 {
+    ebus.setDeadline(deadline);
+}
+
+//------------------------------------------------------------------------------
+
+inline void BusHandler::setEchoTimeout(unsigned long long timeout)
+{
+    echoTimeout = timeout;
 }
 
 //------------------------------------------------------------------------------
@@ -294,41 +592,28 @@ inline BusHandler::symbol_t BusHandler::getCRC() const
 
 //------------------------------------------------------------------------------
 
-inline BusHandler::symbol_t BusHandler::nextRawSymbol()
-    throw (OSError, TimeoutException)
+inline unsigned long long BusHandler::getLastSymbolTime() const
 {
-    symbol_t symbol;
-    if (!nextRawSymbolMaybe(symbol)) throw TimeoutException();
-    return symbol;
+    return lastSymbolTime;
 }
 
 //------------------------------------------------------------------------------
 
-inline void BusHandler::resetHistory()
+inline unsigned long long BusHandler::getLastRoundTrip() const
 {
-    historyNextOffset = historyFirstOffset = 0;
+    return lastRoundTrip;
 }
 
 //------------------------------------------------------------------------------
 
-inline void BusHandler::resetHistory(symbol_t symbol)
+inline const symbol_t* BusHandler::getWrittenSymbols(size_t& length) const
 {
-    history[0] = symbol;
-    historyFirstOffset = 0;
-    historyNextOffset = 1;
+    length = numWrittenSymbols;
+    return writtenSymbols;
 }
 
 //------------------------------------------------------------------------------
 
-inline BusHandler::symbol_t BusHandler::nextSymbol()
-    throw (OSError, TimeoutException, SYNException)
-{
-    symbol_t symbol;
-    if (!nextSymbolMaybe(symbol)) throw TimeoutException();
-    return symbol;
-}
-
-//------------------------------------------------------------------------------
 #endif // BUSHANDLER_H
 
 // Local Variables:
@@ -0,0 +1,210 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "CRC.h"
+
+//------------------------------------------------------------------------------
+
+constexpr CRC::tables_t CRC::generateTables()
+{
+    tables_t tables{};
+
+    for(unsigned i = 0; i<256; ++i) {
+        unsigned crc = i;
+        for(unsigned bit = 0; bit<8; ++bit) {
+            crc = (crc&0x80) ? ((crc<<1) ^ polynomial) : (crc<<1);
+        }
+        tables[0][i] = static_cast<symbol_t>(crc);
+    }
+
+    // The CRC is linear, so a CRC value followed by k+1 symbols
+    // contributes the k+1-times applied table to the result.
+    for(size_t k = 1; k<numSlices; ++k) {
+        for(unsigned i = 0; i<256; ++i) {
+            tables[k][i] = tables[0][tables[k-1][i]];
+        }
+    }
+
+    return tables;
+}
+
+//------------------------------------------------------------------------------
+
+constexpr CRC::symbol_t CRC::updateSliced(const tables_t& tables,
+                                          symbol_t crc,
+                                          const symbol_t* symbols,
+                                          size_t length)
+{
+    while(length>=numSlices) {
+        crc = tables[7][crc] ^
+            tables[6][symbols[0]] ^ tables[5][symbols[1]] ^
+            tables[4][symbols[2]] ^ tables[3][symbols[3]] ^
+            tables[2][symbols[4]] ^ tables[1][symbols[5]] ^
+            tables[0][symbols[6]] ^ symbols[7];
+        symbols += numSlices;
+        length -= numSlices;
+    }
+
+    if (length>=4) {
+        crc = tables[3][crc] ^
+            tables[2][symbols[0]] ^ tables[1][symbols[1]] ^
+            tables[0][symbols[2]] ^ symbols[3];
+        symbols += 4;
+        length -= 4;
+    }
+
+    for(size_t i = 0; i<length; ++i) {
+        crc = tables[0][crc] ^ symbols[i];
+    }
+
+    return crc;
+}
+
+//------------------------------------------------------------------------------
+
+constexpr CRC::tables_t CRC::tables = CRC::generateTables();
+
+//------------------------------------------------------------------------------
+
+CRC::symbol_t CRC::update(symbol_t crc, const symbol_t* symbols,
+                          size_t length)
+{
+    return updateSliced(tables, crc, symbols, length);
+}
+
+//------------------------------------------------------------------------------
+// Compile-time checks
+//------------------------------------------------------------------------------
+
+/**
+ * The table that had been used before the tables were generated.
+ */
+constexpr CRC::symbol_t referenceTable[256] =
+{
+    0x00, 0x9b, 0xad, 0x36, 0xc1, 0x5a, 0x6c, 0xf7, 0x19, 0x82, 0xb4, 0x2f, 0xd8, 0x43, 0x75, 0xee,
+    0x32, 0xa9, 0x9f, 0x04, 0xf3, 0x68, 0x5e, 0xc5, 0x2b, 0xb0, 0x86, 0x1d, 0xea, 0x71, 0x47, 0xdc,
+    0x64, 0xff, 0xc9, 0x52, 0xa5, 0x3e, 0x08, 0x93, 0x7d, 0xe6, 0xd0, 0x4b, 0xbc, 0x27, 0x11, 0x8a,
+    0x56, 0xcd, 0xfb, 0x60, 0x97, 0x0c, 0x3a, 0xa1, 0x4f, 0xd4, 0xe2, 0x79, 0x8e, 0x15, 0x23, 0xb8,
+    0xc8, 0x53, 0x65, 0xfe, 0x09, 0x92, 0xa4, 0x3f, 0xd1, 0x4a, 0x7c, 0xe7, 0x10, 0x8b, 0xbd, 0x26,
+    0xfa, 0x61, 0x57, 0xcc, 0x3b, 0xa0, 0x96, 0x0d, 0xe3, 0x78, 0x4e, 0xd5, 0x22, 0xb9, 0x8f, 0x14,
+    0xac, 0x37, 0x01, 0x9a, 0x6d, 0xf6, 0xc0, 0x5b, 0xb5, 0x2e, 0x18, 0x83, 0x74, 0xef, 0xd9, 0x42,
+    0x9e, 0x05, 0x33, 0xa8, 0x5f, 0xc4, 0xf2, 0x69, 0x87, 0x1c, 0x2a, 0xb1, 0x46, 0xdd, 0xeb, 0x70,
+    0x0b, 0x90, 0xa6, 0x3d, 0xca, 0x51, 0x67, 0xfc, 0x12, 0x89, 0xbf, 0x24, 0xd3, 0x48, 0x7e, 0xe5,
+    0x39, 0xa2, 0x94, 0x0f, 0xf8, 0x63, 0x55, 0xce, 0x20, 0xbb, 0x8d, 0x16, 0xe1, 0x7a, 0x4c, 0xd7,
+    0x6f, 0xf4, 0xc2, 0x59, 0xae, 0x35, 0x03, 0x98, 0x76, 0xed, 0xdb, 0x40, 0xb7, 0x2c, 0x1a, 0x81,
+    0x5d, 0xc6, 0xf0, 0x6b, 0x9c, 0x07, 0x31, 0xaa, 0x44, 0xdf, 0xe9, 0x72, 0x85, 0x1e, 0x28, 0xb3,
+    0xc3, 0x58, 0x6e, 0xf5, 0x02, 0x99, 0xaf, 0x34, 0xda, 0x41, 0x77, 0xec, 0x1b, 0x80, 0xb6, 0x2d,
+    0xf1, 0x6a, 0x5c, 0xc7, 0x30, 0xab, 0x9d, 0x06, 0xe8, 0x73, 0x45, 0xde, 0x29, 0xb2, 0x84, 0x1f,
+    0xa7, 0x3c, 0x0a, 0x91, 0x66, 0xfd, 0xcb, 0x50, 0xbe, 0x25, 0x13, 0x88, 0x7f, 0xe4, 0xd2, 0x49,
+    0x95, 0x0e, 0x38, 0xa3, 0x54, 0xcf, 0xf9, 0x62, 0x8c, 0x17, 0x21, 0xba, 0x4d, 0xd6, 0xe0, 0x7b,
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * Determine if the generated single-symbol table matches the reference
+ * table.
+ */
+constexpr bool matchesReferenceTable()
+{
+    for(unsigned i = 0; i<256; ++i) {
+        if (CRC::tables[0][i]!=referenceTable[i]) return false;
+    }
+    return true;
+}
+
+static_assert(matchesReferenceTable(),
+              "the generated CRC table differs from the reference table");
+
+//------------------------------------------------------------------------------
+
+/**
+ * A telegram with escaped symbols as transmitted, followed by its CRC. It
+ * is long enough for two slices of 8 symbols and a slice of 4 symbols in a
+ * row.
+ */
+constexpr CRC::symbol_t testFrame[] = {
+    0x10, 0x08, 0xb5, 0x10, 0x10, 0x00, 0x00, 0xa9, 0x01, 0x3a, 0xff, 0x0a,
+    0x80, 0xa9, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x30
+};
+
+/**
+ * The number of symbols in the test frame.
+ */
+constexpr size_t testFrameLength = sizeof(testFrame);
+
+/**
+ * The initial CRC values the parts of the test frame are checked with, so
+ * that the incoming CRC term of the slices is exercised as well.
+ */
+constexpr CRC::symbol_t testInitialCRCs[] = { 0x00, 0x01, 0x80, 0x9b, 0xff };
+
+/**
+ * Compute the CRC of a part of the test frame symbol by symbol using the
+ * reference table, starting with the given CRC value.
+ */
+constexpr CRC::symbol_t referenceCRC(CRC::symbol_t crc,
+                                     size_t offset, size_t length)
+{
+    for(size_t i = 0; i<length; ++i) {
+        crc = referenceTable[crc] ^ testFrame[offset + i];
+    }
+    return crc;
+}
+
+/**
+ * Determine if the bulk update gives the same result as the reference
+ * table for all parts of the test frame and all the initial CRC values.
+ * The parts are processed as at most two slices of 8 symbols in a row,
+ * followed by at most a slice of 4 symbols and the remaining symbols, and
+ * every such combination occurs among them.
+ */
+constexpr bool slicesMatchReference()
+{
+    for(auto initialCRC: testInitialCRCs) {
+        for(size_t offset = 0; offset<testFrameLength; ++offset) {
+            for(size_t length = 0; offset + length<=testFrameLength;
+                ++length)
+            {
+                auto crc = CRC::updateSliced(CRC::tables, initialCRC,
+                                             testFrame + offset, length);
+                if (crc!=referenceCRC(initialCRC, offset, length)) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static_assert(slicesMatchReference(),
+              "the bulk CRC update differs from the reference table");
+
+static_assert(referenceCRC(0, 0, testFrameLength - 1)==
+              testFrame[testFrameLength - 1],
+              "the CRC of the test frame is wrong");
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,139 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef CRC_H
+#define CRC_H
+//------------------------------------------------------------------------------
+
+#include <array>
+
+#include <cstddef>
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * The CRC of the eBUS. Besides updating the CRC symbol by symbol, it can
+ * process whole buffers, e.g. captured or outgoing telegrams, several
+ * symbols at a time using slice-by-8 lookup tables. The tables are
+ * generated at compile time from the polynomial.
+ */
+class CRC
+{
+public:
+    /**
+     * Type for symbols.
+     */
+    typedef uint8_t symbol_t;
+
+    /**
+     * The generator polynomial without the x^8 term, i.e.
+     * x^8 + x^7 + x^4 + x^3 + x + 1.
+     */
+    static constexpr symbol_t polynomial = 0x9b;
+
+    /**
+     * The number of symbols processed at once by the bulk update.
+     */
+    static constexpr size_t numSlices = 8;
+
+    /**
+     * Type for the lookup tables. The table at index k maps a CRC value to
+     * its contribution after k+1 further symbols.
+     */
+    typedef std::array<std::array<symbol_t, 256>, numSlices> tables_t;
+
+    /**
+     * The lookup tables.
+     */
+    static const tables_t tables;
+
+    /**
+     * Update the given CRC value with the given symbol.
+     *
+     * @return the new CRC value.
+     */
+    static symbol_t update(symbol_t crc, symbol_t symbol);
+
+    /**
+     * Update the given CRC value with the given symbols.
+     *
+     * @return the new CRC value.
+     */
+    static symbol_t update(symbol_t crc, const symbol_t* symbols,
+                           size_t length);
+
+    /**
+     * Compute the CRC of the given symbols.
+     */
+    static symbol_t compute(const symbol_t* symbols, size_t length);
+
+    /**
+     * Check the CRC of the given (raw) frame, whose last symbol is the CRC
+     * of the others.
+     */
+    static bool check(const symbol_t* symbols, size_t length);
+
+    /**
+     * Update the given CRC value with the given symbols using the given
+     * tables. It is the implementation of the bulk update, which can also
+     * be evaluated at compile time, where the tables are available.
+     */
+    static constexpr symbol_t updateSliced(const tables_t& tables,
+                                           symbol_t crc,
+                                           const symbol_t* symbols,
+                                           size_t length);
+
+private:
+    /**
+     * Generate the lookup tables.
+     */
+    static constexpr tables_t generateTables();
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline CRC::symbol_t CRC::update(symbol_t crc, symbol_t symbol)
+{
+    return tables[0][crc] ^ symbol;
+}
+
+//------------------------------------------------------------------------------
+
+inline CRC::symbol_t CRC::compute(const symbol_t* symbols, size_t length)
+{
+    return update(0, symbols, length);
+}
+
+//------------------------------------------------------------------------------
+
+inline bool CRC::check(const symbol_t* symbols, size_t length)
+{
+    return length>0 && compute(symbols, length - 1)==symbols[length - 1];
+}
+
+//------------------------------------------------------------------------------
+#endif // CRC_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -75,24 +75,24 @@ public:
      * Get an 8-bit value. If an overrun occurs, and it is OK, return the given
      * default value.
      */
-    uint8_t get8(uint8_t defaultValue) throw(OverrunException);
+    uint8_t get8(uint8_t defaultValue);
 
     /**
      * Get a 16-bit value. If an overrun occurs, and it is OK, return the given
      * default value. If only one byte could be read, that will be used to
      * replace the lower byte of the default value.
      */
-    uint16_t get16(uint16_t defaultValue) throw(OverrunException);
+    uint16_t get16(uint16_t defaultValue);
 
     /**
      * Read a single 8-bit value.
      */
-    operator uint8_t() throw(OverrunException);
+    operator uint8_t();
 
     /**
      * Read a 16-bit value. The result is in host byte order.
      */
-    operator uint16_t() throw(OverrunException);
+    operator uint16_t();
 };
 
 //------------------------------------------------------------------------------
@@ -113,7 +113,6 @@ DataSymbolReader(const Telegram& telegram, bool useReply, bool overrunOK) :
 //------------------------------------------------------------------------------
 
 inline uint8_t DataSymbolReader::get8(uint8_t defaultValue)
-    throw(OverrunException)
 {
     if (nextOffset>=numDataSymbols) {
         if (overrunOK) return defaultValue;
@@ -125,7 +124,6 @@ inline uint8_t DataSymbolReader::get8(uint8_t defaultValue)
 //------------------------------------------------------------------------------
 
 inline uint16_t DataSymbolReader::get16(uint16_t defaultValue)
-    throw(OverrunException)
 {
     uint16_t lowByte = get8(static_cast<uint8_t>(defaultValue&0xff));
     uint16_t highByte = get8(static_cast<uint8_t>((defaultValue>>8)&0xff));
@@ -135,14 +133,14 @@ inline uint16_t DataSymbolReader::get16(uint16_t defaultValue)
 
 //------------------------------------------------------------------------------
 
-inline DataSymbolReader::operator uint8_t() throw(OverrunException)
+inline DataSymbolReader::operator uint8_t()
 {
     return get8(0);
 }
 
 //------------------------------------------------------------------------------
 
-inline DataSymbolReader::operator uint16_t() throw(OverrunException)
+inline DataSymbolReader::operator uint16_t()
 {
     return get16(0);
 }
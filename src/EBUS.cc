@@ -19,9 +19,12 @@
 //------------------------------------------------------------------------------
 
 #include "EBUS.h"
+#include "IOURing.h"
 #include "Log.h"
 #include "util.h"
 
+#include <algorithm>
+
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
@@ -29,7 +32,25 @@
 #include <termios.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <netdb.h>
 #include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <linux/serial.h>
+
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#if !HAVE_DECL_IORING_OP_READ_MULTISHOT
+// The multishot read has been added in Linux 6.7, its support is checked at
+// run time
+#define IORING_OP_READ_MULTISHOT 49
+#endif
+#endif
 
 //------------------------------------------------------------------------------
 
@@ -46,17 +67,71 @@ inline void EBUS::addByteRead(uint8_t /*b*/)
 
 //------------------------------------------------------------------------------
 
-EBUS::EBUS(const string& devicePath) throw (OSError) :
-    epollFD(-1),
+inline uint8_t EBUS::nextReceivedByte()
+{
+    uint8_t symbol = receiveBuffer[receiveOffset++];
+    addByteRead(symbol);
+    return symbol;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the earlier one of the given times in nanoseconds, ignoring the ones
+ * that are 0.
+ */
+static inline unsigned long long earliest(unsigned long long a,
+                                          unsigned long long b)
+{
+    return (a==0 || (b>0 && b<a)) ? b : a;
+}
+
+//------------------------------------------------------------------------------
+
+EBUS::EBUS(Reactor& reactor, const string& devicePath) :
+    reactor(reactor),
+    listener(0),
+    state(STATE_CLOSED),
+    timerFD(-1),
+    timerDeadline(0),
+    handlingEvents(false),
+    lastNumWaits(0),
+    deadline(0),
+    stateDeadline(0),
     devicePath(devicePath),
-    portFD(-1)
+    portFD(-1),
+    portEvents(0),
+    inotifyFD(-1),
+    retryDelay(1),
+    tcpAddresses(0),
+    tcpNextAddress(0),
+    connectError(0),
+    deviceType(DEVICE_SERIAL),
+    lowLatency(false),
+    readBatchWindow(0),
+    readBatching(false),
+    batchEnd(0),
+    replaySpeed(1.0),
+    replayStartTime(0),
+    replayOffset(0),
+    replayTime(0),
+    receiveOffset(0),
+    receiveLength(0),
+    useIOURing(false),
+    ioURing(0),
+    ringMultishotRead(false),
+    ringReadPending(false),
+    writeQueueLength(0),
+    ringWriteOffset(0),
+    ringWriteLength(0),
+    ringWritePending(false)
 #if LOG_BYTES_RECEIVED
     ,
     numUnloggedBytes(0),
     lastReadTime(0)
 #endif
 {
-    setupEPoll();
+    setupTimer();
 }
 
 //------------------------------------------------------------------------------
@@ -64,104 +139,500 @@ EBUS::EBUS(const string& devicePath) throw (OSError) :
 EBUS::~EBUS()
 {
     close();
-    ::close(epollFD);
+    ::close(timerFD);
 }
 
 //------------------------------------------------------------------------------
 
-void EBUS::open() throw(OSError)
+Error EBUS::open() noexcept
 {
-    while(portFD<0) {
-        try {
-            setupPort(devicePath);
-        } catch(const OSError& e) {
-            Log::info("EBUS::open: failed to open port, waiting: %s",
-                      e.what());
-            sleep(1);
-        }
-    }
+    if (state!=STATE_CLOSED) return Error();
+
+    auto error = reactor.add(timerFD, EPOLLIN, this);
+    if (!error.isOK()) return error;
+
+    // The first attempt is made right away from the reactor, so that the
+    // listener is always notified from there
+    state = STATE_OPENING;
+    stateDeadline = currentTimeNanos();
+    retryDelay = 1;
+    lastError.clear();
+    updateTimer();
+
+    return Error();
 }
 
 //------------------------------------------------------------------------------
 
-uint8_t EBUS::read() throw(OSError)
+bool EBUS::nextReceived(uint8_t& byte)
 {
-    uint8_t symbol;
-    if (::read(portFD, &symbol, 1)<0) {
-        closeOnError("EBUS::read: read");
+    if (receiveOffset>=receiveLength) return false;
+
+    byte = nextReceivedByte();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::skipReceived(size_t length)
+{
+    for(size_t i = 0; i<length; ++i) {
+        nextReceivedByte();
     }
-    addByteRead(symbol);
-    return symbol;
 }
 
 //------------------------------------------------------------------------------
 
-bool EBUS::readMaybe(uint8_t& symbol, unsigned timeout) throw(OSError)
+Error EBUS::write(const uint8_t* buffer, size_t length) noexcept
 {
-    struct epoll_event event;
-    while (true) {
-        int numDesriptors = epoll_wait(epollFD, &event, 1, timeout);
-        if (numDesriptors<0) {
-            if (errno!=EINTR) {
-                throw OSError("EBUS::readMaybe: epoll_wait");
-            }
-        } else if (numDesriptors==0) {
-            return false;
-        } else {
-            if ((event.events&(EPOLLHUP|EPOLLERR))!=0) {
-                closeOnError("EBUS::readMaybe: EPOLLHUP or EPOLLERR occured");
-            } else if ((event.events&EPOLLIN)!=0) {
-                if (::read(portFD, &symbol, 1)<0) {
-                    closeOnError("EBUS::read: read");
-                }
-                addByteRead(symbol);
-                return true;
-            } else {
-                closeOnError("EBUS::readMaybe: no EPOLLIN event");
+    // Nothing can be sent to a replayed capture
+    if (deviceType==DEVICE_REPLAY) return Error();
+
+    // The bytes are written right away, unless earlier ones are still
+    // queued
+    if (ioURing==0 && writeQueueLength==0) {
+        while(length>0) {
+            addToCounter(statistics.numWriteCalls);
+            auto written = ::write(portFD, buffer, length);
+            if (written<0) {
+                if (errno==EINTR) continue;
+                if (errno==EAGAIN) break;
+                return closeOnError("EBUS::write: write");
             }
+            buffer += written;
+            length -= written;
+            addToCounter(statistics.numBytesWritten, written);
         }
+        if (length==0) return Error();
+    }
+
+    if (writeQueueLength + length > sizeof(writeQueue)) {
+        return closeOnError("EBUS::write: too many bytes queued", ENOBUFS);
+    }
+    memcpy(writeQueue + writeQueueLength, buffer, length);
+    writeQueueLength += length;
+
+    if (ioURing!=0) {
+        addToCounter(statistics.numBytesWritten, length);
+        return submitRingRequests();
+    } else {
+        return updatePortEvents();
     }
-    return false;
 }
 
 //------------------------------------------------------------------------------
 
-void EBUS::write(uint8_t symbol) throw(OSError)
+Error EBUS::flushOutput() noexcept
 {
-    if (::write(portFD, &symbol, sizeof(symbol))<0) {
-        closeOnError("EBUS::writeMaybe: write");
+    if (deviceType==DEVICE_REPLAY) return Error();
+
+    // The bytes not yet passed to the kernel are dropped as well. A write
+    // request already submitted to io_uring may still complete partially.
+    writeQueueLength = 0;
+    ringWriteOffset = ringWriteLength;
+    if (ioURing==0) {
+        auto error = updatePortEvents();
+        if (!error.isOK()) return error;
     }
+
+    if (deviceType==DEVICE_SERIAL && tcflush(portFD, TCOFLUSH)<0) {
+        return closeOnError("EBUS::flushOutput: tcflush");
+    }
+
+    return Error();
 }
 
 //------------------------------------------------------------------------------
 
 void EBUS::close()
 {
+    stopWaitingDevice();
+
+    if (ioURing!=0) reactor.remove(ioURing->getFD());
+    delete ioURing; ioURing = 0;
+    ringMultishotRead = ringReadPending = ringWritePending = false;
+    writeQueueLength = ringWriteOffset = ringWriteLength = 0;
+
+    if (tcpAddresses!=0) freeaddrinfo(tcpAddresses);
+    tcpAddresses = tcpNextAddress = 0;
+
+    reactor.remove(portFD);
     ::close(portFD); portFD = -1;
+    portEvents = 0;
+    receiveOffset = receiveLength = 0;
+
+    if (state!=STATE_CLOSED) {
+        reactor.remove(timerFD);
+        state = STATE_CLOSED;
+    }
+    deadline = stateDeadline = batchEnd = replayTime = 0;
+    if (!setTimer(0).isOK()) {
+        Log::error("EBUS::close: timerfd_settime failed: %s",
+                   OSError::toString(errno).c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::handleEvents(int fd, uint32_t events) noexcept
+{
+    if (!logPrefix.empty()) Log::setThreadPrefix(logPrefix);
+
+    // Several descriptors of the bus may be ready after a single wait
+    auto numWaits = reactor.getNumWaits();
+    if (numWaits!=lastNumWaits) {
+        lastNumWaits = numWaits;
+        addToCounter(statistics.numWaitCalls);
+    }
+
+    handlingEvents = true;
+    if (fd==timerFD) {
+        handleTimer();
+    } else if (fd==inotifyFD) {
+        tryOpen();
+    } else if (state==STATE_CONNECTING) {
+        int errorNumber = 0;
+        socklen_t length = sizeof(errorNumber);
+        if (getsockopt(portFD, SOL_SOCKET, SO_ERROR,
+                       &errorNumber, &length)<0)
+        {
+            errorNumber = errno;
+        }
+        connectFinished(errorNumber);
+    } else if (state==STATE_OPEN) {
+        handlePortEvents(events);
+    }
+    handlingEvents = false;
+
+    // The listener may have changed the deadline or the state
+    updateTimer();
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::handleTimer() noexcept
+{
+    uint64_t numExpirations;
+    addToCounter(statistics.numTimerCalls);
+    if (::read(timerFD, &numExpirations, sizeof(numExpirations))<0 &&
+        errno!=EAGAIN)
+    {
+        auto error = closeOnError("EBUS::handleTimer: read timer");
+        listener->failed(error);
+        return;
+    }
+    timerDeadline = 0;
+
+    // The timer may have been set for any of the deadlines, or it may have
+    // expired before the deadline has been changed
+    auto now = currentTimeNanos();
+    switch(state) {
+      case STATE_OPENING:
+        if (stateDeadline>0 && now>=stateDeadline) tryOpen();
+        return;
+      case STATE_CONNECTING:
+        if (stateDeadline>0 && now>=stateDeadline) {
+            connectFinished(ETIMEDOUT);
+        }
+        return;
+      case STATE_OPEN:
+        break;
+      default:
+        return;
+    }
+
+    bool due = (batchEnd>0 && now>=batchEnd) ||
+        (replayTime>0 && now>=replayTime);
+    bool expired = deadline>0 && now>=deadline;
+    if (!due && !expired) return;
+
+    if (batchEnd>0 && now>=batchEnd) {
+        batchEnd = 0;
+        auto error = updatePortEvents();
+        if (!error.isOK()) {
+            listener->failed(error);
+            return;
+        }
+    }
+
+    // If the deadline has passed, but there are bytes received, the bytes
+    // win
+    if (notifyReceived(receive())) return;
+
+    if (expired) {
+        deadline = 0;
+        listener->deadlinePassed();
+    }
 }
 
 //------------------------------------------------------------------------------
 
-void EBUS::setupEPoll() throw(OSError)
+void EBUS::handlePortEvents(uint32_t events) noexcept
 {
-    epollFD = epoll_create1(0);
-    if (epollFD<0) {
-        throw OSError("EBUS::setupEPoll: epoll_create1");
+    if (ioURing!=0) {
+        notifyReceived(fillRingReceiveBuffer());
+        return;
+    }
+
+    if ((events&(EPOLLHUP|EPOLLERR))!=0) {
+        auto error =
+            closeOnError("EBUS::handlePortEvents: EPOLLHUP or EPOLLERR occured");
+        listener->failed(error);
+        return;
+    }
+
+    if ((events&EPOLLOUT)!=0) {
+        auto error = flushWriteQueue();
+        if (!error.isOK()) {
+            listener->failed(error);
+            return;
+        }
+    }
+
+    if ((events&EPOLLIN)!=0) {
+        // The port is not read until the end of the batch, but not after
+        // the deadline
+        if (readBatching && readBatchWindow>0) {
+            batchEnd = currentTimeNanos() + readBatchWindow;
+            if (deadline>0 && batchEnd>deadline) batchEnd = deadline;
+            auto error = updatePortEvents();
+            if (!error.isOK()) listener->failed(error);
+            return;
+        }
+
+        notifyReceived(fillReceiveBuffer());
     }
 }
 
 //------------------------------------------------------------------------------
 
-bool EBUS::setupPort(const std::string& devicePath) throw(OSError)
+void EBUS::tryOpen() noexcept
 {
-    portFD = ::open(devicePath.c_str(), O_RDWR | O_NOCTTY);
+    stopWaitingDevice();
+
+    try {
+        setupPort(devicePath);
+        if (state==STATE_OPENING) finishOpen();
+    } catch(const OSError& e) {
+        retryOpen(e);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::retryOpen(const OSError& error) noexcept
+{
+    ::close(portFD); portFD = -1;
+
+    // Log only changes, so that a missing device is not reported again and
+    // again.
+    if (lastError!=error.what()) {
+        lastError = error.what();
+        Log::info("EBUS::open: failed to open port, waiting: %s",
+                  error.what());
+    }
+
+    state = STATE_OPENING;
+    if (devicePath[0]=='/') {
+        waitDevice(retryDelay);
+    } else {
+        stateDeadline = currentTimeNanos() + retryDelay*1000000000ULL;
+    }
+
+    // In the low-power mode the retries are backed off
+    if (readBatchWindow>0) {
+        retryDelay = std::min(2*retryDelay, TIMEOUT_DEVICE_WAIT/1000U);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::finishOpen()
+{
+    if (deviceType==DEVICE_REPLAY) {
+        // The capture is read when it is due according to the timer
+        replayTime = currentTimeNanos();
+    } else {
+        if (useIOURing) setupIOURing();
+
+        int fd = (ioURing==0) ? portFD : ioURing->getFD();
+        auto error = reactor.add(fd, EPOLLIN, this);
+        if (!error.isOK()) {
+            delete ioURing; ioURing = 0;
+            error.raise();
+        }
+        portEvents = EPOLLIN;
+
+        if (ioURing!=0) submitRingRequests().raise();
+    }
+
+    state = STATE_OPEN;
+    listener->opened();
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::waitDevice(unsigned retryDelay)
+{
+    auto now = currentTimeNanos();
+    stateDeadline = now + retryDelay*1000000000ULL;
+
+    inotifyFD = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if (inotifyFD<0) {
+        Log::error("EBUS::waitDevice: inotify_init1 failed: %s",
+                   OSError::toString(errno).c_str());
+        stateDeadline = now + 1000000000ULL;
+        return;
+    }
+
+    string directory = devicePath;
+    int watchFD = -1;
+    while(watchFD<0) {
+        auto slash = directory.rfind('/');
+        if (slash==string::npos) break;
+        directory.erase((slash==0) ? 1 : slash);
+
+        watchFD = inotify_add_watch(inotifyFD, directory.c_str(),
+                                    IN_CREATE | IN_ATTRIB | IN_MOVED_TO);
+        if (directory=="/") break;
+    }
+
+    if (watchFD<0) {
+        stopWaitingDevice();
+        return;
+    }
+
+    auto error = reactor.add(inotifyFD, EPOLLIN, this);
+    if (!error.isOK()) {
+        Log::error("EBUS::waitDevice: %s", error.toString().c_str());
+        ::close(inotifyFD); inotifyFD = -1;
+        stateDeadline = now + 1000000000ULL;
+        return;
+    }
+
+    // The device might have appeared before the watch has been added. If
+    // it is there, but could not be set up (e.g. it is busy), only a change
+    // of it or the retry delay ends the wait.
+    if (access(devicePath.c_str(), R_OK|W_OK)<0) {
+        stateDeadline = (readBatchWindow>0) ? 0 :
+            (now + TIMEOUT_DEVICE_WAIT*1000000ULL);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::stopWaitingDevice()
+{
+    if (inotifyFD<0) return;
+
+    reactor.remove(inotifyFD);
+    ::close(inotifyFD); inotifyFD = -1;
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::setupTimer()
+{
+    timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if (timerFD<0) {
+        throw OSError("EBUS::setupTimer: timerfd_create");
+    }
+}
+
+//------------------------------------------------------------------------------
+
+Error EBUS::setTimer(unsigned long long deadline) noexcept
+{
+    if (deadline==timerDeadline) return Error();
+
+    // Setting the timer also resets any expiration not read yet. A deadline
+    // that has already passed makes the timer expire immediately.
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadline / 1000000000ULL;
+    spec.it_value.tv_nsec = deadline % 1000000000ULL;
+
+    addToCounter(statistics.numTimerCalls);
+    if (timerfd_settime(timerFD, TFD_TIMER_ABSTIME, &spec, 0)<0) {
+        return Error::os("EBUS::setTimer: timerfd_settime");
+    }
+    timerDeadline = deadline;
+
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::updateTimer() noexcept
+{
+    unsigned long long nextDeadline = 0;
+    if (state==STATE_OPEN) {
+        nextDeadline = earliest(earliest(deadline, batchEnd), replayTime);
+    } else if (state!=STATE_CLOSED) {
+        nextDeadline = stateDeadline;
+    }
+
+    // The deadline is usually pushed later with each symbol received, so a
+    // timer armed for an earlier time is left alone while further symbols
+    // are likely to arrive before it expires. It is then re-armed only once
+    // in a while instead of once per symbol.
+    if (timerDeadline>0 && (nextDeadline==0 || nextDeadline>timerDeadline) &&
+        timerDeadline>currentTimeNanos() + timerRearmMargin)
+    {
+        return;
+    }
+
+    auto error = setTimer(nextDeadline);
+    if (!error.isOK()) {
+        Log::error("EBUS::updateTimer: %s", error.toString().c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+Error EBUS::updatePortEvents() noexcept
+{
+    uint32_t events = 0;
+    if (batchEnd==0) events |= EPOLLIN;
+    if (writeQueueLength>0) events |= EPOLLOUT;
+    if (events==portEvents) return Error();
+
+    auto error = reactor.modify(portFD, events);
+    if (!error.isOK()) {
+        close();
+        return error;
+    }
+    portEvents = events;
+
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+bool EBUS::setupPort(const std::string& devicePath)
+{
+    static const string tcpPrefix("tcp://");
+    if (devicePath.compare(0, tcpPrefix.length(), tcpPrefix)==0) {
+        setupTCP(devicePath.substr(tcpPrefix.length()));
+        return true;
+    }
+
+    struct stat st;
+    if (stat(devicePath.c_str(), &st)==0 && S_ISREG(st.st_mode)) {
+        setupReplay(devicePath);
+        return true;
+    }
+
+    deviceType = DEVICE_SERIAL;
+
+    portFD = ::open(devicePath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (portFD<0) {
         throw OSError("EBUS::setupPort: open");
     }
 
     // empty device buffer
     if (tcflush(portFD, TCIFLUSH)<0) {
-        closeOnError("EBUS::setupPort: tcflush");
+        closeOnError("EBUS::setupPort: tcflush").raise();
     }
 
     struct termios settings;
@@ -172,20 +643,17 @@ bool EBUS::setupPort(const std::string& devicePath) throw(OSError)
     settings.c_iflag |= IGNPAR;
     settings.c_oflag &= ~OPOST;
 
-    // non-canonical mode: read() blocks until at least one byte is available
+    // non-canonical mode: read() returns the bytes available (the port is
+    // non-blocking)
     settings.c_cc[VMIN]  = 1;
     settings.c_cc[VTIME] = 0;
 
     if (tcsetattr(portFD, TCSAFLUSH, &settings)<0) {
-        closeOnError("EBUS::setupPort: tcsetattr");
+        closeOnError("EBUS::setupPort: tcsetattr").raise();
     }
 
-    struct epoll_event event;
-    event.events = EPOLLIN;
-    event.data.fd = portFD;
-
-    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, portFD, &event)<0) {
-        closeOnError("EBUS::setupPort: epoll_ctl");
+    if (lowLatency) {
+        setupLowLatency(devicePath);
     }
 
     return true;
@@ -193,12 +661,528 @@ bool EBUS::setupPort(const std::string& devicePath) throw(OSError)
 
 //------------------------------------------------------------------------------
 
-void EBUS::closeOnError(const std::string prefix, int errorNumber)
-    throw(OSError)
+void EBUS::setupLowLatency(const std::string& devicePath)
+{
+    struct serial_struct serial;
+    if (ioctl(portFD, TIOCGSERIAL, &serial)<0) {
+        Log::info("EBUS::setupLowLatency: TIOCGSERIAL failed: %s",
+                  OSError::toString(errno).c_str());
+    } else if ((serial.flags&ASYNC_LOW_LATENCY)==0) {
+        serial.flags |= ASYNC_LOW_LATENCY;
+        if (ioctl(portFD, TIOCSSERIAL, &serial)<0) {
+            Log::info("EBUS::setupLowLatency: TIOCSSERIAL failed: %s",
+                      OSError::toString(errno).c_str());
+        }
+    }
+
+    // USB serial adapters (e.g. FTDI) may have a latency timer exposed in
+    // sysfs, which defaults to 16 ms.
+    char* realPath = realpath(devicePath.c_str(), 0);
+    if (realPath==0) return;
+
+    const char* deviceName = strrchr(realPath, '/');
+    deviceName = (deviceName==0) ? realPath : (deviceName + 1);
+    string timerPath =
+        string("/sys/class/tty/") + deviceName + "/device/latency_timer";
+    free(realPath);
+
+    FILE* f = fopen(timerPath.c_str(), "r+");
+    if (f==0) return;
+
+    unsigned oldValue = 0;
+    if (fscanf(f, "%u", &oldValue)==1 && oldValue>1) {
+        rewind(f);
+        if (fprintf(f, "1\n")<0 || fflush(f)!=0) {
+            Log::info("EBUS::setupLowLatency: failed to write %s: %s",
+                      timerPath.c_str(), OSError::toString(errno).c_str());
+        } else {
+            Log::info("EBUS::setupLowLatency: latency timer changed from %u ms to 1 ms",
+                      oldValue);
+        }
+    }
+    fclose(f);
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::setupReplay(const std::string& capturePath)
+{
+    portFD = ::open(capturePath.c_str(), O_RDONLY);
+    if (portFD<0) {
+        throw OSError("EBUS::setupReplay: open");
+    }
+
+    deviceType = DEVICE_REPLAY;
+    replayStartTime = currentTimeNanos();
+    replayOffset = 0;
+
+    if (replaySpeed>0) {
+        Log::info("Replaying capture %s at %.2fx speed",
+                  capturePath.c_str(), replaySpeed);
+    } else {
+        Log::info("Replaying capture %s as fast as possible",
+                  capturePath.c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::setupTCP(const std::string& address)
 {
-    OSError osError(prefix, errorNumber);
+    auto colon = address.rfind(':');
+    if (colon==string::npos) {
+        throw OSError("EBUS::setupTCP: missing port in " + address, EINVAL);
+    }
+
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
+    if (host.length()>=2 && host[0]=='[' && host[host.length()-1]==']') {
+        host = host.substr(1, host.length() - 2);
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo* addresses = 0;
+    int result = getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses);
+    if (result!=0) {
+        throw OSError(string("EBUS::setupTCP: getaddrinfo: ") +
+                      gai_strerror(result),
+                      (result==EAI_SYSTEM) ? errno : EHOSTUNREACH);
+    }
+
+    deviceType = DEVICE_TCP;
+    tcpAddress = address;
+    tcpAddresses = tcpNextAddress = addresses;
+    connectError = ECONNREFUSED;
+
+    connectNext();
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::connectNext()
+{
+    while(tcpNextAddress!=0) {
+        auto ai = tcpNextAddress;
+        tcpNextAddress = ai->ai_next;
+
+        portFD = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK,
+                        ai->ai_protocol);
+        if (portFD<0) {
+            connectError = errno;
+            continue;
+        }
+
+        if (connect(portFD, ai->ai_addr, ai->ai_addrlen)==0) {
+            setupConnection();
+            return;
+        }
+
+        connectError = errno;
+        if (connectError==EINPROGRESS) {
+            // The connection is finished when the socket becomes writable
+            if (reactor.add(portFD, EPOLLOUT, this).isOK()) {
+                state = STATE_CONNECTING;
+                stateDeadline = currentTimeNanos() +
+                    TIMEOUT_CONNECT*1000000ULL;
+                return;
+            }
+            connectError = errno;
+        }
+
+        ::close(portFD); portFD = -1;
+    }
+
+    freeaddrinfo(tcpAddresses);
+    tcpAddresses = 0;
+
+    throw OSError("EBUS::setupTCP: connect", connectError);
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::connectFinished(int errorNumber) noexcept
+{
+    reactor.remove(portFD);
+    state = STATE_OPENING;
+
+    try {
+        if (errorNumber==0) {
+            setupConnection();
+        } else {
+            connectError = errorNumber;
+            ::close(portFD); portFD = -1;
+            connectNext();
+        }
+        if (state==STATE_OPENING) finishOpen();
+    } catch(const OSError& e) {
+        retryOpen(e);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::setupConnection()
+{
+    freeaddrinfo(tcpAddresses);
+    tcpAddresses = tcpNextAddress = 0;
+
+    // Every symbol written should go out immediately
+    int value = 1;
+    if (setsockopt(portFD, IPPROTO_TCP, TCP_NODELAY,
+                   &value, sizeof(value))<0)
+    {
+        closeOnError("EBUS::setupConnection: setsockopt(TCP_NODELAY)").raise();
+    }
+    if (setsockopt(portFD, SOL_SOCKET, SO_KEEPALIVE,
+                   &value, sizeof(value))<0)
+    {
+        closeOnError("EBUS::setupConnection: setsockopt(SO_KEEPALIVE)").raise();
+    }
+
+    Log::info("Connected to %s", tcpAddress.c_str());
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::setupIOURing()
+{
+    // The ring of a port still open is kept, as it may have requests in
+    // flight on the port
+    if (ioURing!=0) return;
+
+    try {
+        ioURing = new IOURing(8);
+    } catch(const OSError& e) {
+        Log::error("EBUS::setupIOURing: failed to setup io_uring, using epoll: %s",
+                   e.what());
+        return;
+    }
+
+#if HAVE_LINUX_IO_URING_H
+    ringMultishotRead =
+        ioURing->isOperationSupported(IORING_OP_READ_MULTISHOT) &&
+        ioURing->setupBuffers(ringNumReadBuffers, ringReadBufferSize).isOK();
+    if (!ringMultishotRead) {
+        Log::info("Multishot reads are not supported by io_uring, a read is submitted after each completion");
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+Error EBUS::closeOnError(const char* context, int errorNumber) noexcept
+{
+    auto error = Error::os(context, errorNumber);
     close();
-    throw osError;
+    return error;
+}
+
+//------------------------------------------------------------------------------
+
+bool EBUS::notifyReceived(const Result<bool>& result) noexcept
+{
+    if (!result.isOK()) {
+        listener->failed(result.getError());
+        return true;
+    } else if (result.getValue()) {
+        listener->received();
+        return true;
+    } else {
+        return false;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+Result<bool> EBUS::receive() noexcept
+{
+    if (deviceType==DEVICE_REPLAY) {
+        return fillReplayBuffer();
+    } else if (ioURing!=0) {
+        return fillRingReceiveBuffer();
+    } else {
+        return fillReceiveBuffer();
+    }
+}
+
+//------------------------------------------------------------------------------
+
+size_t EBUS::compactReceiveBuffer()
+{
+    if (receiveOffset>1) {
+        size_t offset = receiveOffset - 1;
+        size_t length = receiveLength - offset;
+        memmove(receiveBuffer, receiveBuffer + offset, length);
+        memmove(receiveTimes, receiveTimes + offset,
+                length * sizeof(receiveTimes[0]));
+        receiveOffset = 1;
+        receiveLength = length;
+    }
+
+    return receiveBufferSize - receiveLength;
+}
+
+//------------------------------------------------------------------------------
+
+Result<bool> EBUS::fillReceiveBuffer() noexcept
+{
+    // If the listener has left the buffer full, it is notified again
+    size_t space = compactReceiveBuffer();
+    if (space==0) return true;
+
+    ssize_t length;
+    do {
+        addToCounter(statistics.numReadCalls);
+        length = ::read(portFD, receiveBuffer + receiveLength, space);
+    } while (length<0 && errno==EINTR);
+
+    if (length<0) {
+        if (errno==EAGAIN) return false;
+        return closeOnError("EBUS::fillReceiveBuffer: read");
+    } else if (length==0) {
+        return closeOnError("EBUS::fillReceiveBuffer: end of file", EIO);
+    }
+
+    bytesReceived(length);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+Result<bool> EBUS::fillRingReceiveBuffer() noexcept
+{
+#if HAVE_LINUX_IO_URING_H
+    size_t space = compactReceiveBuffer();
+
+    size_t length = 0;
+    const io_uring_cqe* cqe;
+    while((cqe = ioURing->peekCQE())!=0) {
+        auto userData = cqe->user_data;
+        auto result = cqe->res;
+        auto flags = cqe->flags;
+
+        // The bytes of the completions of a multishot read that do not fit
+        // into the receive buffer are left for the next call
+        if (userData==RING_DATA_READ && result>0 &&
+            length + result>space)
+        {
+            break;
+        }
+        ioURing->advanceCQ();
+
+        if (userData==RING_DATA_READ) {
+            // A multishot read terminates, e.g. if the provided buffers
+            // have run out, in which case it is re-armed.
+            if ((flags&IORING_CQE_F_MORE)==0) ringReadPending = false;
+            if (result==-ENOBUFS) continue;
+
+            if (result<0) {
+                return closeOnError("EBUS::fillRingReceiveBuffer: read",
+                                    -result);
+            } else if (result==0) {
+                return closeOnError(
+                    "EBUS::fillRingReceiveBuffer: end of file", EIO);
+            }
+
+            auto destination = receiveBuffer + receiveLength + length;
+            if ((flags&IORING_CQE_F_BUFFER)!=0) {
+                unsigned bufferID = flags>>IORING_CQE_BUFFER_SHIFT;
+                memcpy(destination, ioURing->getBuffer(bufferID), result);
+                ioURing->recycleBuffer(bufferID);
+            } else {
+                memcpy(destination, ringReadBuffer, result);
+            }
+            length += result;
+        } else if (userData==RING_DATA_WRITE) {
+            ringWritePending = false;
+            if (result<0) {
+                return closeOnError("EBUS::fillRingReceiveBuffer: write",
+                                    -result);
+            }
+            ringWriteOffset += result;
+        }
+    }
+
+    // The read is re-armed and the bytes queued while a write was in
+    // flight are submitted right away
+    auto error = submitRingRequests();
+    if (!error.isOK()) return error;
+
+    if (length>0) {
+        bytesReceived(length);
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+Error EBUS::flushWriteQueue() noexcept
+{
+    size_t offset = 0;
+    while(offset<writeQueueLength) {
+        addToCounter(statistics.numWriteCalls);
+        auto written = ::write(portFD, writeQueue + offset,
+                               writeQueueLength - offset);
+        if (written<0) {
+            if (errno==EINTR) continue;
+            if (errno==EAGAIN) break;
+            return closeOnError("EBUS::flushWriteQueue: write");
+        }
+        offset += written;
+        addToCounter(statistics.numBytesWritten, written);
+    }
+
+    writeQueueLength -= offset;
+    memmove(writeQueue, writeQueue + offset, writeQueueLength);
+
+    return updatePortEvents();
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::prepareRingRequests()
+{
+#if HAVE_LINUX_IO_URING_H
+    if (!ringReadPending) {
+        auto sqe = ioURing->getSQE();
+        if (sqe!=0) {
+            sqe->fd = portFD;
+            sqe->off = static_cast<uint64_t>(-1);
+            sqe->user_data = RING_DATA_READ;
+            if (ringMultishotRead) {
+                sqe->opcode = IORING_OP_READ_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = 0;
+            } else {
+                sqe->opcode = IORING_OP_READ;
+                sqe->addr = reinterpret_cast<uint64_t>(ringReadBuffer);
+                sqe->len = sizeof(ringReadBuffer);
+            }
+            ringReadPending = true;
+        }
+    }
+
+    // The bytes are written in the order they have been queued: a new write
+    // request is submitted only if the previous one has completed.
+    if (!ringWritePending && ringWriteOffset>=ringWriteLength &&
+        writeQueueLength>0)
+    {
+        memcpy(ringWriteBuffer, writeQueue, writeQueueLength);
+        ringWriteOffset = 0;
+        ringWriteLength = writeQueueLength;
+        writeQueueLength = 0;
+    }
+
+    if (!ringWritePending && ringWriteOffset<ringWriteLength) {
+        auto sqe = ioURing->getSQE();
+        if (sqe!=0) {
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = portFD;
+            sqe->addr =
+                reinterpret_cast<uint64_t>(ringWriteBuffer + ringWriteOffset);
+            sqe->len = ringWriteLength - ringWriteOffset;
+            sqe->off = static_cast<uint64_t>(-1);
+            sqe->user_data = RING_DATA_WRITE;
+            ringWritePending = true;
+        }
+    }
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+Error EBUS::submitRingRequests() noexcept
+{
+    prepareRingRequests();
+    if (ioURing->getNumPendingSubmissions()==0) return Error();
+
+    addToCounter(statistics.numRingEnterCalls);
+    auto error = ioURing->submit();
+    if (!error.isOK()) close();
+    return error;
+}
+
+//------------------------------------------------------------------------------
+
+void EBUS::bytesReceived(size_t length)
+{
+    // The bytes of a batch are assumed to have arrived back-to-back, but
+    // not earlier than the last byte of the previous batch.
+    auto now = currentTimeNanos();
+    auto previousTime =
+        (receiveLength>0) ? receiveTimes[receiveLength-1] : 0;
+    auto times = receiveTimes + receiveLength;
+    for(size_t i = 0; i<length; ++i) {
+        auto backTime = (length - 1 - i) * SYMBOL_DURATION;
+        auto t = (now>backTime) ? (now - backTime) : 0;
+        times[i] = (t<previousTime) ? previousTime : t;
+    }
+
+    addToCounter(statistics.numBytesRead, length);
+    receiveLength += length;
+}
+
+//------------------------------------------------------------------------------
+
+Result<bool> EBUS::fillReplayBuffer() noexcept
+{
+    size_t count = compactReceiveBuffer();
+    if (count==0) return true;
+
+    if (replaySpeed>0) {
+        auto now = currentTimeNanos();
+        auto due = static_cast<unsigned long long>(
+            (now - replayStartTime) * replaySpeed / SYMBOL_DURATION);
+        if (due<=replayOffset) {
+            replayTime = replayStartTime +
+                static_cast<unsigned long long>(
+                    (replayOffset + 1) * SYMBOL_DURATION / replaySpeed);
+            return false;
+        }
+        if (due - replayOffset < count) count = due - replayOffset;
+    }
+
+    ssize_t length;
+    do {
+        addToCounter(statistics.numReadCalls);
+        length = ::read(portFD, receiveBuffer + receiveLength, count);
+    } while (length<0 && errno==EINTR);
+
+    if (length<0) {
+        return closeOnError("EBUS::fillReplayBuffer: read");
+    } else if (length==0) {
+        close();
+        return Error::endOfFile();
+    }
+
+    // The receive times follow the original timing of the bus regardless of
+    // the replay speed.
+    auto times = receiveTimes + receiveLength;
+    for(ssize_t i = 0; i<length; ++i) {
+        times[i] = replayStartTime + (replayOffset + i + 1) * SYMBOL_DURATION;
+    }
+
+    addToCounter(statistics.numBytesRead, length);
+    replayOffset += length;
+    receiveLength += length;
+
+    // When replaying as fast as possible, the next bytes are read after
+    // the listener has processed these ones
+    replayTime = (replaySpeed>0) ?
+        (replayStartTime +
+         static_cast<unsigned long long>(
+             (replayOffset + 1) * SYMBOL_DURATION / replaySpeed)) :
+        currentTimeNanos();
+
+    return true;
 }
 
 //------------------------------------------------------------------------------
@@ -20,27 +20,293 @@
 #define EBUS_H
 //------------------------------------------------------------------------------
 
-#include "OSError.h"
-#include "TimeoutException.h"
+#include "Reactor.h"
+#include "Result.h"
+#include "util.h"
+
+#include <atomic>
+#include <string>
 
 #include <inttypes.h>
 
 //------------------------------------------------------------------------------
 
+class IOURing;
+struct addrinfo;
+
+//------------------------------------------------------------------------------
+
 #define LOG_BYTES_RECEIVED 0
 
+
 //------------------------------------------------------------------------------
 
 /**
  * The main eBUS handler class.
+ *
+ * The device can be a serial port, a network adapter given as
+ * tcp://<host>:<port> which provides the raw bytes of the bus over a TCP
+ * connection, or a regular file containing a raw capture of the bytes on the
+ * bus. In the latter case the bytes are replayed either at the original speed
+ * of the bus, at a multiple of it or as fast as possible.
+ *
+ * The handler does not block. Its port, its timer and the other file
+ * descriptors it needs are registered with a reactor, which may be shared
+ * by several buses, and the events are reported to a listener: the
+ * opening of the device, the bytes received, the passing of the deadline
+ * and the failures. The bytes and the deadline are kept by a timer with a
+ * nanosecond resolution. A replayed capture is paced by the timer as well.
+ *
+ * Serial ports and network adapters are normally handled with epoll and
+ * non-blocking read()/write(). Optionally io_uring can be used instead, in
+ * which case a read is kept armed on the port all the time, and the file
+ * descriptor of the ring is registered with the reactor. If the kernel
+ * supports multishot reads, a single read request serves all received
+ * bytes, otherwise a new request is submitted after each completion. The
+ * symbols written are submitted right away.
  */
-class EBUS
+class EBUS : private Reactor::Handler
 {
+public:
+    /**
+     * The interface of the objects the events of the bus are reported to.
+     * The functions are called by the reactor, and they may call any
+     * function of the handler, including closing and opening the device.
+     */
+    class Listener
+    {
+    public:
+        /**
+         * Called when the device has been opened.
+         */
+        virtual void opened() noexcept = 0;
+
+        /**
+         * Called when bytes have been put into the receive buffer. They
+         * should be consumed, otherwise no more bytes are read once the
+         * buffer is full.
+         */
+        virtual void received() noexcept = 0;
+
+        /**
+         * Called when the deadline has passed without any byte received.
+         * The deadline is cleared then.
+         */
+        virtual void deadlinePassed() noexcept = 0;
+
+        /**
+         * Called when the device has been closed due to the given error.
+         * If the end of a replayed capture is reached, it is an end-of-file
+         * error.
+         */
+        virtual void failed(const Error& error) noexcept = 0;
+
+    protected:
+        /**
+         * Destroy the listener.
+         */
+        ~Listener();
+    };
+
+    /**
+     * The baud rate of the bus.
+     */
+    static const unsigned BAUD_RATE = 2400;
+
+    /**
+     * The time it takes to transfer a symbol (8 data bits with a start and a
+     * stop bit) in nanoseconds.
+     */
+    static const unsigned long long SYMBOL_DURATION =
+        10ULL * 1000000000ULL / BAUD_RATE;
+
+    /**
+     * The timeout of connecting to a network adapter in milliseconds.
+     */
+    static const int TIMEOUT_CONNECT = 5000;
+
+    /**
+     * The maximal time to wait for a device file to appear in milliseconds,
+     * after which opening it is retried anyway.
+     */
+    static const int TIMEOUT_DEVICE_WAIT = 60000;
+
+    /**
+     * Statistics about the I/O operations performed.
+     */
+    struct Statistics
+    {
+        /**
+         * The number of wakeups, i.e. the epoll_wait() calls of the reactor
+         * that have returned events of the bus.
+         */
+        std::atomic<unsigned long long> numWaitCalls;
+
+        /**
+         * The number of read() calls.
+         */
+        std::atomic<unsigned long long> numReadCalls;
+
+        /**
+         * The number of bytes read.
+         */
+        std::atomic<unsigned long long> numBytesRead;
+
+        /**
+         * The number of write() calls.
+         */
+        std::atomic<unsigned long long> numWriteCalls;
+
+        /**
+         * The number of bytes written.
+         */
+        std::atomic<unsigned long long> numBytesWritten;
+
+        /**
+         * The number of io_uring_enter() calls.
+         */
+        std::atomic<unsigned long long> numRingEnterCalls;
+
+        /**
+         * The number of timerfd_settime() calls and reads of the timer
+         * expirations.
+         */
+        std::atomic<unsigned long long> numTimerCalls;
+
+        /**
+         * Construct the statistics with all counters being 0.
+         */
+        Statistics();
+    };
+
 private:
     /**
-     * The epoll file descriptor.
+     * Type for the state of the handler.
+     */
+    typedef enum {
+        // The device is closed
+        STATE_CLOSED,
+
+        // The device is being opened, or it is waited for
+        STATE_OPENING,
+
+        // A network adapter is being connected to
+        STATE_CONNECTING,
+
+        // The device is open
+        STATE_OPEN
+    } state_t;
+
+    /**
+     * Type for the kind of the device.
+     */
+    typedef enum {
+        // A serial port
+        DEVICE_SERIAL,
+
+        // A capture file to be replayed
+        DEVICE_REPLAY,
+
+        // A network adapter connected to via TCP
+        DEVICE_TCP
+    } deviceType_t;
+
+    /**
+     * The time in nanoseconds before the expiration of the timer within
+     * which it is re-armed for a later deadline right away instead of
+     * letting it expire early.
+     */
+    static const unsigned long long timerRearmMargin = 4 * SYMBOL_DURATION;
+
+    /**
+     * The size of the receive buffer.
+     */
+    static const size_t receiveBufferSize = 256;
+
+    /**
+     * The size of the buffers of the bytes to write. It is large enough for
+     * a whole telegram with all its symbols escaped.
+     */
+    static const size_t writeBufferSize = 1024;
+
+    /**
+     * The number of buffers provided to io_uring for the multishot read.
+     */
+    static const unsigned ringNumReadBuffers = 16;
+
+    /**
+     * The size of the buffers provided to io_uring for the multishot read.
+     * The bytes of several completions fit into the receive buffer.
+     */
+    static const size_t ringReadBufferSize = receiveBufferSize / 4;
+
+    /**
+     * The user data of the read requests submitted via io_uring.
+     */
+    static const uint64_t RING_DATA_READ = 1;
+
+    /**
+     * The user data of the write requests submitted via io_uring.
      */
-    int epollFD;
+    static const uint64_t RING_DATA_WRITE = 2;
+
+    /**
+     * The reactor the file descriptors are registered with.
+     */
+    Reactor& reactor;
+
+    /**
+     * The listener the events are reported to.
+     */
+    Listener* listener;
+
+    /**
+     * The prefix of the log messages logged while handling the events, if
+     * not empty.
+     */
+    std::string logPrefix;
+
+    /**
+     * The state of the handler.
+     */
+    state_t state;
+
+    /**
+     * The timer file descriptor used for the deadlines. It is registered
+     * with the reactor while the device is not closed.
+     */
+    int timerFD;
+
+    /**
+     * The deadline the timer is armed for in nanoseconds of the monotonic
+     * clock, or 0 if the timer is disarmed or it has expired.
+     */
+    unsigned long long timerDeadline;
+
+    /**
+     * Indicate if the events are being handled, in which case the timer is
+     * updated only when the handling is finished.
+     */
+    bool handlingEvents;
+
+    /**
+     * The number of epoll_wait() calls of the reactor when the events of
+     * the bus have been handled last.
+     */
+    unsigned long long lastNumWaits;
+
+    /**
+     * The deadline in nanoseconds of the monotonic clock until which a byte
+     * should be received, or 0 if there is none.
+     */
+    unsigned long long deadline;
+
+    /**
+     * The time in nanoseconds of the monotonic clock when the opening of
+     * the device should be retried, or the connection to a network adapter
+     * times out. If 0, the device is waited for without a timeout.
+     */
+    unsigned long long stateDeadline;
 
     /**
      * The path of the device.
@@ -52,6 +318,185 @@ private:
      */
     int portFD;
 
+    /**
+     * The epoll events the port is registered for.
+     */
+    uint32_t portEvents;
+
+    /**
+     * The inotify file descriptor watching for the device file to appear,
+     * or -1.
+     */
+    int inotifyFD;
+
+    /**
+     * The error of the last failed attempt to open the device.
+     */
+    std::string lastError;
+
+    /**
+     * The delay in seconds before the opening of the device is retried.
+     */
+    unsigned retryDelay;
+
+    /**
+     * The address of the network adapter being connected to.
+     */
+    std::string tcpAddress;
+
+    /**
+     * The addresses of the network adapter to connect to, or 0.
+     */
+    struct addrinfo* tcpAddresses;
+
+    /**
+     * The address of the network adapter to try to connect to next, if
+     * connecting to the current one fails.
+     */
+    struct addrinfo* tcpNextAddress;
+
+    /**
+     * The error number of the last failed attempt to connect.
+     */
+    int connectError;
+
+    /**
+     * The kind of the device currently open.
+     */
+    deviceType_t deviceType;
+
+    /**
+     * Indicate if serial ports should be configured for low latency.
+     */
+    bool lowLatency;
+
+    /**
+     * The time in nanoseconds to wait after the port has become readable
+     * before reading it, if the reads are batched, so that more bytes are
+     * read with a single wakeup. If 0, the low-power mode is disabled.
+     */
+    unsigned long long readBatchWindow;
+
+    /**
+     * Indicate if the reads are currently batched.
+     */
+    bool readBatching;
+
+    /**
+     * The time in nanoseconds of the monotonic clock when the port should
+     * be read, if a batch is being collected, otherwise 0.
+     */
+    unsigned long long batchEnd;
+
+    /**
+     * The replay speed as a multiple of the original speed of the bus. If 0,
+     * the capture is replayed as fast as possible.
+     */
+    double replaySpeed;
+
+    /**
+     * The monotonic time in nanoseconds when the replay has started.
+     */
+    unsigned long long replayStartTime;
+
+    /**
+     * The number of bytes replayed so far.
+     */
+    unsigned long long replayOffset;
+
+    /**
+     * The time in nanoseconds of the monotonic clock when the next bytes of
+     * the capture are due, or 0 if no capture is being replayed.
+     */
+    unsigned long long replayTime;
+
+    /**
+     * The buffer of the bytes read from the port but not consumed yet.
+     */
+    uint8_t receiveBuffer[receiveBufferSize];
+
+    /**
+     * The offset of the next unconsumed byte in the receive buffer.
+     */
+    size_t receiveOffset;
+
+    /**
+     * The number of valid bytes in the receive buffer.
+     */
+    size_t receiveLength;
+
+    /**
+     * The monotonic times in nanoseconds when the bytes in the receive buffer
+     * have been received.
+     */
+    unsigned long long receiveTimes[receiveBufferSize];
+
+    /**
+     * Indicate if io_uring should be used for serial ports and network
+     * adapters.
+     */
+    bool useIOURing;
+
+    /**
+     * The io_uring instance, if io_uring is used for the currently open
+     * port.
+     */
+    IOURing* ioURing;
+
+    /**
+     * Indicate if the read request submitted via io_uring is a multishot
+     * one reading into the buffers provided to the ring.
+     */
+    bool ringMultishotRead;
+
+    /**
+     * The buffer the single-shot read request submitted via io_uring reads
+     * into.
+     */
+    uint8_t ringReadBuffer[receiveBufferSize];
+
+    /**
+     * Indicate if a read request is pending in io_uring.
+     */
+    bool ringReadPending;
+
+    /**
+     * The bytes to be written that the port has not accepted or that have
+     * not been submitted to io_uring yet.
+     */
+    uint8_t writeQueue[writeBufferSize];
+
+    /**
+     * The number of bytes in the write queue.
+     */
+    size_t writeQueueLength;
+
+    /**
+     * The bytes submitted for writing via io_uring.
+     */
+    uint8_t ringWriteBuffer[writeBufferSize];
+
+    /**
+     * The offset of the first byte of the write buffer that has not been
+     * written yet.
+     */
+    size_t ringWriteOffset;
+
+    /**
+     * The number of bytes in the write buffer.
+     */
+    size_t ringWriteLength;
+
+    /**
+     * Indicate if a write request is pending in io_uring.
+     */
+    bool ringWritePending;
+
+    /**
+     * The I/O statistics.
+     */
+    Statistics statistics;
+
 #if LOG_BYTES_RECEIVED
     /**
      * The bytes read so far without logging.
@@ -71,9 +516,11 @@ private:
 
 public:
     /**
-     * Construct the eBUS handler for the given device.
+     * Construct the eBUS handler for the given device, whose file
+     * descriptors will be registered with the given reactor. It throws an
+     * OSError if the timer file descriptor cannot be set up.
      */
-    EBUS(const std::string& devicePath) throw(OSError);
+    EBUS(Reactor& reactor, const std::string& devicePath);
 
     /**
      * Destroy the eBUS handler by closing the device.
@@ -81,44 +528,219 @@ public:
     ~EBUS();
 
     /**
-     * Try to open the device and wait if it is not yet available.
+     * Set the listener the events are reported to. It should be called
+     * before open().
+     */
+    void setListener(Listener* listener);
+
+    /**
+     * Set the prefix of the log messages logged while handling the events,
+     * e.g. the name of the bus, if there are several buses.
+     */
+    void setLogPrefix(const std::string& prefix);
+
+    /**
+     * Set the replay speed as a multiple of the original speed of the bus. If
+     * 0, captures are replayed as fast as possible. The default is 1.
+     */
+    void setReplaySpeed(double speed);
+
+    /**
+     * Set whether serial ports should be configured for low latency. If so,
+     * the low latency flag of the driver is set and the latency timer of USB
+     * serial adapters is set to its minimum. It takes effect when the port
+     * is opened the next time.
      */
-    void open() throw(OSError);
+    void setLowLatency(bool lowLatency);
 
     /**
-     * Read a byte from the bus. Wait indefinitely if no byte is available
-     * immediately.
+     * Enable the low-power mode with the given read batch window in
+     * nanoseconds, or disable it, if the window is 0. In the low-power mode
+     * a missing device is waited for without a timeout, and when the reads
+     * are batched (see setReadBatching()), the bytes are read only after
+     * the window has elapsed since the port has become readable. The
+     * receive times of the bytes are less accurate then, since they are
+     * derived from the time of the read.
      */
-    uint8_t read() throw(OSError);
+    void setLowPower(unsigned long long readBatchWindow);
 
     /**
-     * Read a byte from the bus with the given timeout.
+     * Set whether the reads should be batched in the low-power mode. It is
+     * expected to be disabled when the timing matters, e.g. when a telegram
+     * is to be sent. The batching applies to the epoll-based reads only.
+     */
+    void setReadBatching(bool batching);
+
+    /**
+     * Set whether io_uring should be used instead of epoll and
+     * read()/write() for serial ports and network adapters. It takes effect
+     * when the port is opened the next time.
+     */
+    void setUseIOURing(bool useIOURing);
+
+    /**
+     * Determine if the device is a capture being replayed.
+     */
+    bool isReplaying() const;
+
+    /**
+     * Start opening the device, if it is closed. The opening is attempted
+     * from the reactor, and if it fails, it is retried. For device files
+     * the directory containing the file is watched with inotify, so the
+     * device is reopened as soon as it (re)appears. A network adapter is
+     * connected to in a non-blocking way with a timeout, although its
+     * address is resolved synchronously. When the device is open, the
+     * listener is notified.
+     *
+     * @return an error, if the timer cannot be registered with the reactor.
+     */
+    Error open() noexcept;
+
+    /**
+     * Get the I/O statistics.
+     */
+    const Statistics& getStatistics() const;
+
+    /**
+     * Determine if all bytes read from the device have been consumed.
+     */
+    bool isReceiveBufferEmpty() const;
+
+    /**
+     * Get the monotonic time in nanoseconds when the last byte consumed from
+     * the receive buffer has been received. If several bytes have been
+     * received by a single read() call, the times of the earlier ones are
+     * derived from the time of the last one using the baud rate.
+     */
+    unsigned long long getLastReceiveTime() const;
+
+    /**
+     * Set the deadline in nanoseconds of the monotonic clock until which a
+     * byte should be received. If it passes without any byte received, the
+     * listener is notified. If it is 0, there is no deadline.
+     */
+    void setDeadline(unsigned long long deadline);
+
+    /**
+     * Consume the next byte from the receive buffer, if any.
      *
-     * @return true if the byte could be read within the given amount of time.
+     * @return whether there was a byte in the buffer.
      */
-    bool readMaybe(uint8_t& symbol, unsigned timeout) throw(OSError);
+    bool nextReceived(uint8_t& byte);
 
     /**
-     * Read a byte from the bus with the given timeout in milliseconds. If the
-     * timeout is exceed  a TimeoutException is thrown.
+     * Get the bytes in the receive buffer that have not been consumed yet
+     * and their receive times, without consuming them. They can be
+     * consumed by skipReceived().
+     *
+     * @return the number of the bytes.
      */
-    uint8_t read(unsigned timeout) throw(OSError, TimeoutException);
+    size_t peekReceived(const uint8_t*& bytes,
+                        const unsigned long long*& times) const;
+
+    /**
+     * Consume the given number of bytes from the receive buffer.
+     */
+    void skipReceived(size_t length);
 
     /**
      * Write a byte to the bus.
      */
-    void write(uint8_t symbol) throw(OSError);
+    Error write(uint8_t symbol) noexcept;
 
     /**
-     * Close the device.
+     * Write the given bytes to the bus with as few system calls as
+     * possible. The bytes the port does not accept right away are queued
+     * and written when the port becomes writable. If io_uring is used and
+     * a previous write request is still in flight, the bytes are submitted
+     * when it completes.
+     *
+     * If an error occurs, the device is closed, and the error is returned
+     * without notifying the listener.
+     */
+    Error write(const uint8_t* buffer, size_t length) noexcept;
+
+    /**
+     * Discard the bytes written, but not transmitted yet. It is used to
+     * abort sending a telegram, if a collision is detected. For a network
+     * adapter the bytes already passed to the kernel cannot be discarded.
+     */
+    Error flushOutput() noexcept;
+
+    /**
+     * Close the device. The listener is not notified.
      */
     void close();
 
 private:
     /**
-     * Setup the epoll file descriptor.
+     * Handle the events of the given file descriptor.
+     */
+    virtual void handleEvents(int fd, uint32_t events) noexcept;
+
+    /**
+     * Handle the expiration of the timer.
+     */
+    void handleTimer() noexcept;
+
+    /**
+     * Handle the given events of the port, or of the ring, if io_uring is
+     * used.
+     */
+    void handlePortEvents(uint32_t events) noexcept;
+
+    /**
+     * Try to open the device. If it fails, the retry is scheduled.
+     */
+    void tryOpen() noexcept;
+
+    /**
+     * Schedule the retry of opening the device after the given failure.
+     */
+    void retryOpen(const OSError& error) noexcept;
+
+    /**
+     * Finish opening the device, whose port has been set up: register the
+     * port or the ring with the reactor and notify the listener.
+     */
+    void finishOpen();
+
+    /**
+     * Start waiting for the device file to appear or change. It watches the
+     * directory of the device file, or its nearest existing ancestor, if
+     * the directory does not exist either. If the device file exists, the
+     * wait ends after the given retry delay in seconds at the latest.
+     */
+    void waitDevice(unsigned retryDelay);
+
+    /**
+     * Stop waiting for the device file, if it is waited for.
+     */
+    void stopWaitingDevice();
+
+    /**
+     * Setup the timer file descriptor.
+     */
+    void setupTimer();
+
+    /**
+     * Arm the timer for the given deadline in nanoseconds of the monotonic
+     * clock, or disarm it, if the deadline is 0. The timer is not touched if
+     * it is already in the right state.
+     */
+    Error setTimer(unsigned long long deadline) noexcept;
+
+    /**
+     * Arm the timer for the earliest of the deadlines of the current state,
+     * unless it is armed for an earlier time already.
      */
-    void setupEPoll() throw(OSError);
+    void updateTimer() noexcept;
+
+    /**
+     * Register the port for reading, unless a batch is being collected,
+     * and for writing, if there are bytes queued.
+     */
+    Error updatePortEvents() noexcept;
 
     /**
      * Setup the serial port.
@@ -126,14 +748,134 @@ private:
      * @return whether the port could be setup. If false is returned, the file
      * descriptor might still be valid!
      */
-    bool setupPort(const std::string& devicePath) throw(OSError);
+    bool setupPort(const std::string& devicePath);
 
     /**
-     * Close the port and throw an OSError with the given error message and the
+     * Configure the serial port opened from the given path for low latency.
+     * Failures are logged, but are not fatal, since not all drivers support
+     * it.
+     */
+    void setupLowLatency(const std::string& devicePath);
+
+    /**
+     * Setup the replay of the given capture file.
+     */
+    void setupReplay(const std::string& capturePath);
+
+    /**
+     * Start connecting to the network adapter with the given address of the
+     * form <host>:<port>.
+     */
+    void setupTCP(const std::string& address);
+
+    /**
+     * Start connecting to the next address of the network adapter. If the
+     * connection is made right away, it is set up. If it is in progress,
+     * the state becomes STATE_CONNECTING. It throws an OSError, if there is
+     * no address left to try.
+     */
+    void connectNext();
+
+    /**
+     * Called when connecting to the current address of the network adapter
+     * has finished with the given error number (0 if it has succeeded).
+     */
+    void connectFinished(int errorNumber) noexcept;
+
+    /**
+     * Setup the connection to the network adapter just made.
+     */
+    void setupConnection();
+
+    /**
+     * Setup io_uring for the port just opened. If it fails, epoll is used.
+     * If there is a ring already, it is kept.
+     */
+    void setupIOURing();
+
+    /**
+     * Close the port and return an OS error with the given context and the
      * error code before closing the port.
      */
-    void closeOnError(const std::string prefix = "", int errorNumber = -1)
-        throw(OSError);
+    Error closeOnError(const char* context, int errorNumber = -1) noexcept;
+
+    /**
+     * Notify the listener about the given result of receiving bytes: the
+     * bytes received or the error.
+     *
+     * @return whether the listener has been notified.
+     */
+    bool notifyReceived(const Result<bool>& result) noexcept;
+
+    /**
+     * Put the bytes available from the device into the receive buffer
+     * without blocking.
+     *
+     * @return whether any bytes have been put into the buffer.
+     */
+    Result<bool> receive() noexcept;
+
+    /**
+     * Move the bytes not consumed yet to the beginning of the receive
+     * buffer, keeping the last byte consumed for its receive time.
+     *
+     * @return the free space after the bytes.
+     */
+    size_t compactReceiveBuffer();
+
+    /**
+     * Fill the receive buffer with the bytes available on the port. The
+     * receive times of the bytes are also determined.
+     *
+     * @return whether any bytes have been put into the buffer.
+     */
+    Result<bool> fillReceiveBuffer() noexcept;
+
+    /**
+     * Fill the receive buffer with the next bytes of the replayed capture
+     * that are due according to the replay speed. If no byte is due, the
+     * time when the next one will be due is determined.
+     *
+     * @return whether any bytes have been put into the buffer.
+     */
+    Result<bool> fillReplayBuffer() noexcept;
+
+    /**
+     * Fill the receive buffer with the completed reads of io_uring. The
+     * read is re-armed and any pending bytes to write are submitted as
+     * well.
+     *
+     * @return whether any bytes have been put into the buffer.
+     */
+    Result<bool> fillRingReceiveBuffer() noexcept;
+
+    /**
+     * Write the bytes queued, as many as the port accepts.
+     */
+    Error flushWriteQueue() noexcept;
+
+    /**
+     * Prepare the read and write requests for io_uring as needed.
+     */
+    void prepareRingRequests();
+
+    /**
+     * Submit the read and write requests via io_uring as needed without
+     * waiting for completions.
+     */
+    Error submitRingRequests() noexcept;
+
+    /**
+     * Called when the given number of bytes have been put into the receive
+     * buffer from the port after the bytes already there. It determines
+     * their receive times.
+     */
+    void bytesReceived(size_t length);
+
+    /**
+     * Get the next byte from the receive buffer, which should not be empty.
+     */
+    uint8_t nextReceivedByte();
 
     /**
      * Add a byte read.
@@ -145,14 +887,127 @@ private:
 // Inline definitions
 //------------------------------------------------------------------------------
 
-inline uint8_t EBUS::read(unsigned timeout) throw(OSError, TimeoutException)
+inline EBUS::Listener::~Listener()
 {
-    uint8_t symbol;
-    if (!readMaybe(symbol, timeout)) throw TimeoutException();
-    return symbol;
 }
 
 //------------------------------------------------------------------------------
+
+inline EBUS::Statistics::Statistics() :
+    numWaitCalls(0),
+    numReadCalls(0),
+    numBytesRead(0),
+    numWriteCalls(0),
+    numBytesWritten(0),
+    numRingEnterCalls(0),
+    numTimerCalls(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline const EBUS::Statistics& EBUS::getStatistics() const
+{
+    return statistics;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setListener(Listener* listener)
+{
+    this->listener = listener;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setLogPrefix(const std::string& prefix)
+{
+    logPrefix = prefix;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setReplaySpeed(double speed)
+{
+    replaySpeed = speed;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setLowLatency(bool lowLatency)
+{
+    this->lowLatency = lowLatency;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setLowPower(unsigned long long readBatchWindow)
+{
+    this->readBatchWindow = readBatchWindow;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setReadBatching(bool batching)
+{
+    readBatching = batching;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setUseIOURing(bool useIOURing)
+{
+    this->useIOURing = useIOURing;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool EBUS::isReplaying() const
+{
+    return deviceType==DEVICE_REPLAY;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool EBUS::isReceiveBufferEmpty() const
+{
+    return receiveOffset>=receiveLength;
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long long EBUS::getLastReceiveTime() const
+{
+    return (receiveOffset>0) ? receiveTimes[receiveOffset-1] : 0;
+}
+
+//------------------------------------------------------------------------------
+
+inline size_t EBUS::peekReceived(const uint8_t*& bytes,
+                                 const unsigned long long*& times) const
+{
+    bytes = receiveBuffer + receiveOffset;
+    times = receiveTimes + receiveOffset;
+    return receiveLength - receiveOffset;
+}
+
+//------------------------------------------------------------------------------
+
+inline void EBUS::setDeadline(unsigned long long deadline)
+{
+    this->deadline = deadline;
+    if (!handlingEvents) updateTimer();
+}
+
+//------------------------------------------------------------------------------
+
+inline Error EBUS::write(uint8_t symbol) noexcept
+{
+    return write(&symbol, 1);
+}
+
+//------------------------------------------------------------------------------
+
 #endif // EBUS_H
 
 // Local Variables:
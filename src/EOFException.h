@@ -16,19 +16,19 @@
 // along with this program; if not, write to the Free Software
 // Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
-#ifndef TIMEOUTEXCEPTION_H
-#define TIMEOUTEXCEPTION_H
+#ifndef EOFEXCEPTION_H
+#define EOFEXCEPTION_H
 //------------------------------------------------------------------------------
 
 /**
- * An exception thrown when a timeout occurs.
+ * An exception thrown when the end of a replayed capture is reached.
  */
-class TimeoutException
+class EOFException
 {
 };
 
 //------------------------------------------------------------------------------
-#endif // TIMEOUTEXCEPTION_H
+#endif // EOFEXCEPTION_H
 
 // Local Variables:
 // mode: C++
@@ -0,0 +1,396 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "IOURing.h"
+
+#include <cstring>
+#include <cerrno>
+
+#if HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <csignal>
+#endif
+
+//------------------------------------------------------------------------------
+
+#if HAVE_LINUX_IO_URING_H
+
+//------------------------------------------------------------------------------
+
+bool IOURing::isSupported()
+{
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+IOURing::IOURing(unsigned numEntries) :
+    ringFD(-1),
+    sqRing(MAP_FAILED),
+    sqRingSize(0),
+    cqRing(MAP_FAILED),
+    cqRingSize(0),
+    sqes(reinterpret_cast<io_uring_sqe*>(MAP_FAILED)),
+    sqesSize(0),
+    bufferRing(MAP_FAILED),
+    bufferRingSize(0),
+    buffers(0),
+    bufferSize(0),
+    bufferMask(0)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ringFD = syscall(__NR_io_uring_setup, numEntries, &params);
+    if (ringFD<0) {
+        throw OSError("IOURing::IOURing: io_uring_setup");
+    }
+
+    if ((params.features&IORING_FEAT_EXT_ARG)==0) {
+        ::close(ringFD);
+        throw OSError("IOURing::IOURing: no support for timeouts", ENOSYS);
+    }
+
+    sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    sqRing = mmap(0, sqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQ_RING);
+
+    cqRingSize = params.cq_off.cqes +
+        params.cq_entries * sizeof(struct io_uring_cqe);
+    cqRing = mmap(0, cqRingSize, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_CQ_RING);
+
+    sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = reinterpret_cast<io_uring_sqe*>(
+        mmap(0, sqesSize, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ringFD, IORING_OFF_SQES));
+
+    if (sqRing==MAP_FAILED || cqRing==MAP_FAILED || sqes==MAP_FAILED) {
+        OSError osError("IOURing::IOURing: mmap");
+        release();
+        throw osError;
+    }
+
+    auto sqBase = reinterpret_cast<char*>(sqRing);
+    sqHead = reinterpret_cast<unsigned*>(sqBase + params.sq_off.head);
+    sqTail = reinterpret_cast<unsigned*>(sqBase + params.sq_off.tail);
+    sqMask = *reinterpret_cast<unsigned*>(sqBase + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqArray = reinterpret_cast<unsigned*>(sqBase + params.sq_off.array);
+
+    auto cqBase = reinterpret_cast<char*>(cqRing);
+    cqHead = reinterpret_cast<unsigned*>(cqBase + params.cq_off.head);
+    cqTail = reinterpret_cast<unsigned*>(cqBase + params.cq_off.tail);
+    cqMask = *reinterpret_cast<unsigned*>(cqBase + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cqBase + params.cq_off.cqes);
+}
+
+//------------------------------------------------------------------------------
+
+IOURing::~IOURing()
+{
+    release();
+}
+
+//------------------------------------------------------------------------------
+
+int IOURing::getFD() const
+{
+    return ringFD;
+}
+
+//------------------------------------------------------------------------------
+
+io_uring_sqe* IOURing::getSQE()
+{
+    unsigned tail = *sqTail;
+    if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+        return 0;
+    }
+
+    unsigned index = tail & sqMask;
+    io_uring_sqe* sqe = sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray[index] = index;
+
+    __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    return sqe;
+}
+
+//------------------------------------------------------------------------------
+
+unsigned IOURing::getNumPendingSubmissions() const
+{
+    return *sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+}
+
+//------------------------------------------------------------------------------
+
+bool IOURing::isOperationSupported(unsigned opcode) const
+{
+    static const size_t numOps = 256;
+
+    union {
+        struct io_uring_probe probe;
+        uint8_t data[sizeof(struct io_uring_probe) +
+                     numOps * sizeof(struct io_uring_probe_op)];
+    } u;
+    memset(&u, 0, sizeof(u));
+
+    if (syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_PROBE,
+                &u.probe, numOps)<0)
+    {
+        return false;
+    }
+
+    return opcode<=u.probe.last_op && opcode<u.probe.ops_len &&
+        (u.probe.ops[opcode].flags&IO_URING_OP_SUPPORTED)!=0;
+}
+
+//------------------------------------------------------------------------------
+
+Error IOURing::setupBuffers(unsigned numBuffers, size_t bufferSize) noexcept
+{
+    if (bufferRing!=MAP_FAILED) {
+        return Error::os("IOURing::setupBuffers: already set up", EBUSY);
+    }
+
+    size_t ringSize = numBuffers * sizeof(struct io_uring_buf);
+    size_t size = ringSize + numBuffers * bufferSize;
+    void* memory = mmap(0, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (memory==MAP_FAILED) {
+        return Error::os("IOURing::setupBuffers: mmap");
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = reinterpret_cast<uint64_t>(memory);
+    reg.ring_entries = numBuffers;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, ringFD, IORING_REGISTER_PBUF_RING,
+                &reg, 1)<0)
+    {
+        auto error = Error::os("IOURing::setupBuffers: io_uring_register");
+        munmap(memory, size);
+        return error;
+    }
+
+    bufferRing = memory;
+    bufferRingSize = size;
+    buffers = reinterpret_cast<uint8_t*>(memory) + ringSize;
+    this->bufferSize = bufferSize;
+    bufferMask = numBuffers - 1;
+
+    for(unsigned bufferID = 0; bufferID<numBuffers; ++bufferID) {
+        recycleBuffer(bufferID);
+    }
+
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+const uint8_t* IOURing::getBuffer(unsigned bufferID) const
+{
+    return buffers + bufferID * bufferSize;
+}
+
+//------------------------------------------------------------------------------
+
+void IOURing::recycleBuffer(unsigned bufferID)
+{
+    // The ring is accessed as an array of entries, as the flexible array of
+    // struct io_uring_buf_ring is laid out differently in C++. The tail is
+    // the reserved field of the first entry.
+    auto ring = reinterpret_cast<struct io_uring_buf*>(bufferRing);
+    uint16_t tail = ring->resv;
+
+    auto& buf = ring[tail & bufferMask];
+    buf.addr = reinterpret_cast<uint64_t>(getBuffer(bufferID));
+    buf.len = bufferSize;
+    buf.bid = bufferID;
+
+    __atomic_store_n(&ring->resv, tail + 1, __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------------------------------
+
+Error IOURing::submit() noexcept
+{
+    while (true) {
+        unsigned toSubmit = getNumPendingSubmissions();
+        if (toSubmit==0) return Error();
+
+        if (syscall(__NR_io_uring_enter, ringFD, toSubmit, 0, 0, 0,
+                    _NSIG/8)<0)
+        {
+            // If the completion queue is full, the entries are submitted
+            // after the completions have been consumed
+            if (errno==EBUSY) return Error();
+            if (errno!=EINTR) {
+                return Error::os("IOURing::submit: io_uring_enter");
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+const io_uring_cqe* IOURing::peekCQE() const
+{
+    unsigned head = *cqHead;
+    if (head==__atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return 0;
+    return cqes + (head & cqMask);
+}
+
+//------------------------------------------------------------------------------
+
+void IOURing::advanceCQ()
+{
+    __atomic_store_n(cqHead, *cqHead + 1, __ATOMIC_RELEASE);
+}
+
+//------------------------------------------------------------------------------
+
+void IOURing::release()
+{
+    if (sqes!=MAP_FAILED) munmap(sqes, sqesSize);
+    if (cqRing!=MAP_FAILED) munmap(cqRing, cqRingSize);
+    if (sqRing!=MAP_FAILED) munmap(sqRing, sqRingSize);
+    ::close(ringFD);
+    if (bufferRing!=MAP_FAILED) munmap(bufferRing, bufferRingSize);
+}
+
+//------------------------------------------------------------------------------
+
+#else // HAVE_LINUX_IO_URING_H
+
+//------------------------------------------------------------------------------
+
+bool IOURing::isSupported()
+{
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+IOURing::IOURing(unsigned /*numEntries*/)
+{
+    throw OSError("IOURing::IOURing: not supported by the build", ENOSYS);
+}
+
+//------------------------------------------------------------------------------
+
+IOURing::~IOURing()
+{
+}
+
+//------------------------------------------------------------------------------
+
+int IOURing::getFD() const
+{
+    return -1;
+}
+
+//------------------------------------------------------------------------------
+
+io_uring_sqe* IOURing::getSQE()
+{
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+unsigned IOURing::getNumPendingSubmissions() const
+{
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool IOURing::isOperationSupported(unsigned /*opcode*/) const
+{
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+Error IOURing::setupBuffers(unsigned /*numBuffers*/, size_t /*bufferSize*/)
+    noexcept
+{
+    return Error::os("IOURing::setupBuffers: not supported by the build",
+                     ENOSYS);
+}
+
+//------------------------------------------------------------------------------
+
+const uint8_t* IOURing::getBuffer(unsigned /*bufferID*/) const
+{
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void IOURing::recycleBuffer(unsigned /*bufferID*/)
+{
+}
+
+//------------------------------------------------------------------------------
+
+Error IOURing::submit() noexcept
+{
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+const io_uring_cqe* IOURing::peekCQE() const
+{
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+void IOURing::advanceCQ()
+{
+}
+
+//------------------------------------------------------------------------------
+
+void IOURing::release()
+{
+}
+
+//------------------------------------------------------------------------------
+
+#endif // HAVE_LINUX_IO_URING_H
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
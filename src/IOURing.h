@@ -0,0 +1,251 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef IOURING_H
+#define IOURING_H
+//------------------------------------------------------------------------------
+
+#include "Result.h"
+
+#include <inttypes.h>
+#include <cstddef>
+
+//------------------------------------------------------------------------------
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+//------------------------------------------------------------------------------
+
+/**
+ * A minimal wrapper over an io_uring instance using the system calls
+ * directly. It supports getting submission queue entries, submitting them
+ * with or without waiting for completions with a timeout, and reaping the
+ * completions. It can also provide a ring of buffers, from which the
+ * kernel selects one for each completion of a read, so that a multishot
+ * read can stay armed on a file.
+ */
+class IOURing
+{
+public:
+    /**
+     * Determine if io_uring is supported by the build.
+     */
+    static bool isSupported();
+
+private:
+    /**
+     * The file descriptor of the ring.
+     */
+    int ringFD;
+
+    /**
+     * The memory of the submission queue ring.
+     */
+    void* sqRing;
+
+    /**
+     * The size of the memory of the submission queue ring.
+     */
+    size_t sqRingSize;
+
+    /**
+     * The memory of the completion queue ring.
+     */
+    void* cqRing;
+
+    /**
+     * The size of the memory of the completion queue ring.
+     */
+    size_t cqRingSize;
+
+    /**
+     * The submission queue entries.
+     */
+    io_uring_sqe* sqes;
+
+    /**
+     * The size of the memory of the submission queue entries.
+     */
+    size_t sqesSize;
+
+    /**
+     * The head of the submission queue (updated by the kernel).
+     */
+    unsigned* sqHead;
+
+    /**
+     * The tail of the submission queue (updated by us).
+     */
+    unsigned* sqTail;
+
+    /**
+     * The mask of the submission queue indexes.
+     */
+    unsigned sqMask;
+
+    /**
+     * The number of entries in the submission queue.
+     */
+    unsigned sqEntries;
+
+    /**
+     * The array of the indexes of the submission queue entries.
+     */
+    unsigned* sqArray;
+
+    /**
+     * The head of the completion queue (updated by us).
+     */
+    unsigned* cqHead;
+
+    /**
+     * The tail of the completion queue (updated by the kernel).
+     */
+    unsigned* cqTail;
+
+    /**
+     * The mask of the completion queue indexes.
+     */
+    unsigned cqMask;
+
+    /**
+     * The completion queue entries.
+     */
+    io_uring_cqe* cqes;
+
+    /**
+     * The memory of the ring of the provided buffers followed by the
+     * buffers themselves, or MAP_FAILED, if there are no provided buffers.
+     */
+    void* bufferRing;
+
+    /**
+     * The size of the memory of the provided buffers.
+     */
+    size_t bufferRingSize;
+
+    /**
+     * The first provided buffer.
+     */
+    uint8_t* buffers;
+
+    /**
+     * The size of a provided buffer.
+     */
+    size_t bufferSize;
+
+    /**
+     * The mask of the indexes of the ring of the provided buffers.
+     */
+    unsigned bufferMask;
+
+public:
+    /**
+     * Construct the ring with the given number of submission queue entries.
+     * It throws an OSError if the ring cannot be set up.
+     */
+    IOURing(unsigned numEntries);
+
+    /**
+     * The copy constructor is deleted.
+     */
+    IOURing(const IOURing&) = delete;
+
+    /**
+     * Destroy the ring.
+     */
+    ~IOURing();
+
+    /**
+     * Get the file descriptor of the ring. It is readable, when there are
+     * completions available, so it can be watched by epoll.
+     */
+    int getFD() const;
+
+    /**
+     * Get a cleared submission queue entry. It will be submitted with the
+     * next call to submit().
+     *
+     * @return the entry or 0 if the submission queue is full.
+     */
+    io_uring_sqe* getSQE();
+
+    /**
+     * Get the number of submission queue entries not submitted yet.
+     */
+    unsigned getNumPendingSubmissions() const;
+
+    /**
+     * Determine if the kernel supports the operation with the given
+     * opcode.
+     */
+    bool isOperationSupported(unsigned opcode) const;
+
+    /**
+     * Set up the given number of buffers of the given size for the reads
+     * requesting buffer selection (IOSQE_BUFFER_SELECT) from buffer group
+     * 0. The number of buffers must be a power of 2. The buffer of a
+     * completion is identified by the upper bits of its flags, and it
+     * should be recycled once its contents are consumed.
+     */
+    Error setupBuffers(unsigned numBuffers, size_t bufferSize) noexcept;
+
+    /**
+     * Get the provided buffer with the given identifier.
+     */
+    const uint8_t* getBuffer(unsigned bufferID) const;
+
+    /**
+     * Give the provided buffer with the given identifier back to the
+     * kernel.
+     */
+    void recycleBuffer(unsigned bufferID);
+
+    /**
+     * Submit the pending submission queue entries without waiting for any
+     * completions.
+     */
+    Error submit() noexcept;
+
+    /**
+     * Get the next completion, if any. The returned entry remains valid
+     * until advanceCQ() is called.
+     */
+    const io_uring_cqe* peekCQE() const;
+
+    /**
+     * Mark the completion returned by peekCQE() as consumed.
+     */
+    void advanceCQ();
+
+private:
+    /**
+     * Release the memory mappings and close the file descriptor.
+     */
+    void release();
+};
+
+//------------------------------------------------------------------------------
+#endif // IOURING_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -37,6 +37,10 @@ FILE* Log::logFile = 0;
 
 bool Log::shouldReopenFile = false;
 
+std::mutex Log::mutex;
+
+thread_local string Log::threadPrefix;
+
 //------------------------------------------------------------------------------
 
 void Log::log(bool error, const char* format, va_list& ap)
@@ -51,7 +55,14 @@ void Log::log(bool error, const char* format, va_list& ap)
     strftime(timeStr, sizeof(timeStr), "%Y-%m-%d %H:%M:%S", &lt);
 
     char buffer1[1100];
-    snprintf(buffer1, sizeof(buffer), "[%s] %s\n", timeStr, buffer);
+    if (threadPrefix.empty()) {
+        snprintf(buffer1, sizeof(buffer1), "[%s] %s\n", timeStr, buffer);
+    } else {
+        snprintf(buffer1, sizeof(buffer1), "[%s] [%s] %s\n", timeStr,
+                 threadPrefix.c_str(), buffer);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
 
     if (useStdout) {
         fwrite(buffer1, strlen(buffer1), 1, error ? stderr : stdout);
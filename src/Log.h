@@ -21,6 +21,7 @@
 //------------------------------------------------------------------------------
 
 #include <string>
+#include <mutex>
 
 #include <cstdio>
 #include <cstdarg>
@@ -54,6 +55,17 @@ private:
      */
     static bool shouldReopenFile;
 
+    /**
+     * The mutex protecting the output, since the logging functions may be
+     * called from several threads.
+     */
+    static std::mutex mutex;
+
+    /**
+     * The prefix of the log messages of the current thread, if not empty.
+     */
+    static thread_local std::string threadPrefix;
+
 public:
     /**
      * Enable logging to the standard output.
@@ -80,6 +92,12 @@ public:
      */
     static void reopenFile();
 
+    /**
+     * Set the prefix of the log messages of the current thread, e.g. the
+     * name of the bus the thread handles. An empty prefix means no prefix.
+     */
+    static void setThreadPrefix(const std::string& prefix);
+
     /**
      * Normal log.
      */
@@ -143,6 +161,13 @@ inline void Log::reopenFile()
 
 //------------------------------------------------------------------------------
 
+inline void Log::setThreadPrefix(const std::string& prefix)
+{
+    threadPrefix = prefix;
+}
+
+//------------------------------------------------------------------------------
+
 inline void Log::info(const char* format, ...)
 {
     va_list ap;
@@ -20,92 +20,221 @@
 
 #include "MessageHandler.h"
 
+#include "Address.h"
 #include "BusHandler.h"
+#include "EBUS.h"
 #include "Telegram.h"
+#include "SymbolScanner.h"
 #include "Log.h"
 
 #include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 //------------------------------------------------------------------------------
 
-void MessageHandler::run() throw (OSError)
+/**
+ * The maximal number of symbols of the master part of a telegram following
+ * the source address as transmitted, i.e. with every symbol escaped.
+ */
+static const size_t maxNumEscapedMasterSymbols =
+    2*(5 + Telegram::maxNumDataSymbols);
+
+/**
+ * Put the master part of the given telegram following the source address
+ * into the given buffer as it should be transmitted, including its CRC.
+ *
+ * @return the number of symbols put into the buffer.
+ */
+static size_t escapeMasterPart(symbol_t* buffer, const Telegram& telegram)
 {
-    BusHandler::symbol_t history[BusHandler::historyLength];
+    size_t length = 0;
+    length += BusHandler::escapeSymbol(buffer + length,
+                                       telegram.destination);
+    length += BusHandler::escapeSymbol(buffer + length,
+                                       telegram.primaryCommand);
+    length += BusHandler::escapeSymbol(buffer + length,
+                                       telegram.secondaryCommand);
+    length += BusHandler::escapeSymbol(buffer + length,
+                                       telegram.numDataSymbols);
+    for(size_t i = 0; i<telegram.numDataSymbols; ++i) {
+        length += BusHandler::escapeSymbol(buffer + length,
+                                           telegram.dataSymbols[i]);
+    }
 
-    bool synPending = false;
-    while(true) {
-        if (!synPending) {
-            signalChanged(false);
-            Log::info("Waiting for signal...");
-            while(!busHandler.waitSignal(1000)) {
-                Log::info("Still no signal...");
-            }
-            Log::info("Signal detected");
-            signalChanged(true);
-        }
+    // The source address never needs escaping
+    auto crc = CRC::update(CRC::update(0, telegram.source), buffer, length);
+    length += BusHandler::escapeSymbol(buffer + length, crc);
 
-        bool dumpData = false;
-        unsigned waitSYNBeforeSend = 0;
-        unsigned long long lastSYNTime = 0;
-        try {
-            synPending = false;
-            while (true) {
-                auto source = BusHandler::SYMBOL_SYN;
-                while (source == BusHandler::SYMBOL_SYN) {
-                    lastSYNTime = currentTimeMillis();
-                    if (!busHandler.nextRawSymbolMaybe(source)) {
-                        Log::info("Timeout waiting for a message...");
-                    }
-                    if (waitSYNBeforeSend>0) --waitSYNBeforeSend;
-                    if (waitSYNBeforeSend==0 &&
-                        source==BusHandler::SYMBOL_SYN && !sendQueue.empty())
-                    {
-                        waitSYNBeforeSend = trySend();
-                    }
-                }
-
-                if (!BusHandler::isMasterAddress(source)) {
-                    Log::info("The first byte after SYN is not master address: 0x%02x, delay: %llu ms!",
-                              source, currentTimeMillis() - lastSYNTime);
-                    continue;
-                }
-
-                readTelegram(source);
-            }
+    return length;
+}
 
-        } catch(const TimeoutException&) {
-            Log::info("Timeout occurred");
-            dumpData = true;
-        } catch(const SYNException&) {
-            Log::info("Unexpected SYN symbol!");
-            synPending = true;
-            dumpData = true;
-        }
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+MessageHandler::~MessageHandler()
+{
+    Event event;
+    while(completionEvents.pop(event)) {
+        delete event.telegram;
+    }
 
-        if (dumpData) {
-            size_t historySize = busHandler.getHistory(history);
-            if (historySize>0) {
-                char buffer[3*historySize + 32];
-                strcpy(buffer, "  the bytes received so far:");
-                size_t bufferLength = strlen(buffer);
+    SendQueue::Entry entry;
+    while(sendRequests.pop(entry)) {
+        delete entry.telegram;
+    }
 
-                for(size_t i = 0; i<historySize; ++i) {
-                    bufferLength += snprintf(buffer + bufferLength,
-                                             sizeof(buffer) - bufferLength,
-                                             " %02x", history[i]);
-                }
+    if (eventFD>=0) ::close(eventFD);
+}
 
-                Log::info("%s", buffer);
-            }
+//------------------------------------------------------------------------------
+
+void MessageHandler::start(bool measureRoundTrip)
+{
+    roundTripRequested = measureRoundTrip;
+    busHandler.open().raise();
+}
+
+//------------------------------------------------------------------------------
+
+SendQueue::handle_t MessageHandler::send(Telegram* telegram,
+                                         SendQueue::priority_t priority,
+                                         unsigned timeout)
+{
+    if (!Address::isMaster(telegram->source)) {
+        Log::error("The source address %02x is not a master address, dropping the telegram",
+                   telegram->source);
+        delete telegram;
+        return 0;
+    }
+
+    if (eventFD>=0 && numSendsPending>=completionQueueSize) {
+        Log::error("Too many telegrams being sent, dropping one");
+        delete telegram;
+        return 0;
+    }
+
+    SendQueue::Entry entry;
+    entry.handle = ++lastHandle;
+    entry.telegram = telegram;
+    entry.priority = priority;
+    entry.deadline = (timeout>0) ?
+        (currentTimeNanos() + timeout*1000000ULL) : 0;
+    entry.numFailures = 0;
+
+    if (eventFD<0) {
+        sendQueue.push(entry);
+    } else if (!sendRequests.push(entry)) {
+        Log::error("Too many telegrams to send, dropping one");
+        delete telegram;
+        return 0;
+    }
+
+    ++numSendsPending;
+
+    return entry.handle;
+}
+
+//------------------------------------------------------------------------------
+
+SendQueue::handle_t MessageHandler::send(Telegram* telegram,
+                                         const completion_t& completion,
+                                         SendQueue::priority_t priority,
+                                         unsigned timeout)
+{
+    // The telegram will get the next handle
+    auto handle = lastHandle + 1;
+    completions[handle] = completion;
+
+    if (send(telegram, priority, timeout)==0) {
+        completions.erase(handle);
+        return 0;
+    }
+
+    return handle;
+}
+
+//------------------------------------------------------------------------------
+
+bool MessageHandler::setResponse(const Responder::Update& update)
+{
+    if (eventFD<0) {
+        return responder.setResponse(update);
+    } else if (!Responder::check(update)) {
+        return false;
+    } else if (!responseUpdates.push(update)) {
+        Log::error("Too many responses to set, dropping one");
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::cancel(SendQueue::handle_t handle)
+{
+    if (eventFD<0) {
+        cancelSending(handle);
+    } else if (!cancelRequests.push(handle)) {
+        Log::error("Too many cancellations, dropping one");
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::enableDispatching()
+{
+    if (eventFD>=0) return;
+
+    eventFD = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    if (eventFD<0) throw OSError("eventfd");
+}
+
+//------------------------------------------------------------------------------
+
+bool MessageHandler::dispatch()
+{
+    uint64_t value;
+    if (::read(eventFD, &value, sizeof(value))<0 &&
+        errno!=EAGAIN && errno!=EINTR)
+    {
+        Log::error("Reading the event file descriptor failed: %s",
+                   OSError::toString(errno).c_str());
+    }
+
+    bool isStopped = stopped.load(std::memory_order_acquire);
+
+    Event event;
+    while(events.pop(event)) {
+        if (event.telegram==0) {
+            signalChanged(event.hasSignal);
+        } else {
+            received(*event.telegram);
+            freeTelegrams.push(event.telegram);
         }
     }
+
+    while(completionEvents.pop(event)) {
+        completeSending(event.handle, *event.telegram, event.status);
+        delete event.telegram;
+    }
+
+    return !isStopped;
 }
 
 //------------------------------------------------------------------------------
 
-void MessageHandler::send(Telegram* telegram)
+void MessageHandler::stopDispatching()
 {
-    sendQueue.push_back(telegram);
+    stopped.store(true, std::memory_order_release);
+
+    uint64_t value = 1;
+    if (eventFD>=0 && ::write(eventFD, &value, sizeof(value))<0) {
+        Log::error("Writing the event file descriptor failed: %s",
+                   OSError::toString(errno).c_str());
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -122,141 +251,992 @@ void MessageHandler::signalChanged(bool /*hasSignal*/)
 
 //------------------------------------------------------------------------------
 
-void MessageHandler::readTelegram(symbol_t source)
-    throw(SYNException, TimeoutException, OSError)
+void MessageHandler::sendFinished(SendQueue::handle_t /*handle*/,
+                                  const Telegram& /*telegram*/,
+                                  SendQueue::status_t /*status*/)
+{
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::notifyReceived(Telegram& telegram)
+{
+    if (eventFD<0) {
+        received(telegram);
+        return;
+    }
+
+    auto queued = spareTelegram;
+    spareTelegram = 0;
+    while(queued==0 && !freeTelegrams.pop(queued)) {
+        if (!losslessDispatching) {
+            addToCounter(numDroppedEvents);
+            return;
+        }
+        usleep(eventQueueWaitInterval);
+    }
+
+    // The move assignment copies the telegram, so the parser may reuse it
+    *queued = std::move(telegram);
+    if (!pushEvent(Event{queued, false, 0, SendQueue::STATUS_SENT})) {
+        spareTelegram = queued;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::notifySignalChanged(bool hasSignal)
+{
+    if (eventFD<0) {
+        signalChanged(hasSignal);
+    } else {
+        pushEvent(Event{0, hasSignal, 0, SendQueue::STATUS_SENT});
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::notifySendFinished(const SendQueue::Entry& entry,
+                                        SendQueue::status_t status,
+                                        Telegram& telegram)
+{
+    if (entry.handle==arbitrating) {
+        arbitration.cancelled();
+        arbitrating = 0;
+    }
+
+    if (eventFD<0) {
+        completeSending(entry.handle, telegram, status);
+        delete entry.telegram;
+    } else {
+        if (&telegram!=entry.telegram) *entry.telegram = std::move(telegram);
+        pushCompletion(Event{entry.telegram, false, entry.handle, status});
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::completeSending(SendQueue::handle_t handle,
+                                     const Telegram& telegram,
+                                     SendQueue::status_t status)
+{
+    auto i = completions.find(handle);
+    if (i!=completions.end()) {
+        // The function may send further telegrams, so it is removed first
+        auto completion = std::move(i->second);
+        completions.erase(i);
+        completion(telegram, status);
+    }
+
+    --numSendsPending;
+    sendFinished(handle, telegram, status);
+}
+
+//------------------------------------------------------------------------------
+
+bool MessageHandler::pushEvent(const Event& event)
 {
-    busHandler.resetCRC(source);
-    busHandler.resetHistory(source);
+    if (losslessDispatching) {
+        while(!events.push(event)) {
+            usleep(eventQueueWaitInterval);
+        }
+    } else if (!events.push(event)) {
+        addToCounter(numDroppedEvents);
+        return false;
+    }
 
-    auto destination = busHandler.nextSymbol();
+    signalEventFD();
+    return true;
+}
 
-    auto primaryCommand = busHandler.nextSymbol();
-    auto secondaryCommand = busHandler.nextSymbol();
+//------------------------------------------------------------------------------
 
-    auto numDataSymbols = busHandler.nextSymbol();
+void MessageHandler::pushCompletion(const Event& event)
+{
+    if (!completionEvents.push(event)) {
+        // It should not happen, see send()
+        Log::error("The queue of the finished sendings is full, dropping one");
+        delete event.telegram;
+        return;
+    }
 
-    Telegram telegram(source, destination,
-                      primaryCommand, secondaryCommand,
-                      numDataSymbols);
+    signalEventFD();
+}
 
-    for(unsigned i = 0; i<numDataSymbols; ++i) {
-        telegram.dataSymbols[i] = busHandler.nextSymbol();
+//------------------------------------------------------------------------------
+
+void MessageHandler::signalEventFD()
+{
+    uint64_t value = 1;
+    if (::write(eventFD, &value, sizeof(value))<0) {
+        Log::error("Writing the event file descriptor failed: %s",
+                   OSError::toString(errno).c_str());
     }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::acceptSendRequests()
+{
+    SendQueue::Entry entry;
+    while(sendRequests.pop(entry)) {
+        sendQueue.push(entry);
+    }
+
+    SendQueue::handle_t handle;
+    while(cancelRequests.pop(handle)) {
+        cancelSending(handle);
+    }
+
+    Responder::Update update;
+    while(responseUpdates.pop(update)) {
+        responder.setResponse(update);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::cancelSending(SendQueue::handle_t handle)
+{
+    // The telegram whose source address or master part is being written
+    // is being sent as well
+    if (handle==sending ||
+        (handle==arbitrating &&
+         (action==ACTION_ARBITRATING || action==ACTION_SENDING)))
+    {
+        return;
+    }
+
+    SendQueue::Entry entry;
+    if (sendQueue.take(handle, entry)) {
+        notifySendFinished(entry, SendQueue::STATUS_CANCELLED,
+                           *entry.telegram);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::expireSendings()
+{
+    auto now = currentTimeNanos();
+
+    SendQueue::Entry entry;
+    while(sendQueue.takeExpired(now, entry)) {
+        Log::error("The telegram from %02x to %02x could not be sent in time",
+                   entry.telegram->source, entry.telegram->destination);
+        notifySendFinished(entry, SendQueue::STATUS_EXPIRED, *entry.telegram);
+    }
+}
+
+//------------------------------------------------------------------------------
 
-    auto crc = busHandler.getCRC();
+void MessageHandler::processStatus(TelegramParser::status_t status)
+{
+    if (status==TelegramParser::STATUS_INCOMPLETE) return;
 
-    unsigned char sentCRC = busHandler.nextSymbol();
+    auto& telegram = parser.getTelegram();
+    bool isSlave = Address::isSlave(telegram.destination);
 
-    telegram.crcOK = crc==sentCRC;
+    if (status==TelegramParser::STATUS_COMPLETE ||
+        status==TelegramParser::STATUS_NO_ACK)
+    {
+        arbitration.masterSeen(telegram.source);
+        if (sending==0) trafficSchedule.observe(telegram);
+    }
 
-    BusHandler::symbol_t ack = BusHandler::SYMBOL_NACK;
-    if (!BusHandler::isBroadcastAddress(destination)) {
-        try {
-            ack = busHandler.nextSymbol();
-        } catch(const SYNException&) {
-            Log::error("Missing ACK symbol, SYN received instead");
-            received(telegram);
-            throw;
+    switch(status) {
+      case TelegramParser::STATUS_COMPLETE:
+        if (!Address::isBroadcast(telegram.destination) &&
+            telegram.acknowledgement!=Telegram::ACK)
+        {
+            Log::error("No ACK at the end of the message: %s",
+                       (telegram.acknowledgement==Telegram::NACK) ?
+                       "NACK" : "invalid symbol");
+        } else if (isSlave &&
+                   telegram.masterAcknowledgement!=Telegram::ACK)
+        {
+            Log::error("No ACK at the end of the slave reply: %s",
+                       (telegram.masterAcknowledgement==Telegram::NACK) ?
+                       "NACK" : "invalid symbol");
         }
-        if (ack!=BusHandler::SYMBOL_ACK) {
-            Log::error("No ACK at the end of the message: %02x", ack);
+        break;
+      case TelegramParser::STATUS_NO_ACK:
+        Log::error("Missing ACK symbol, SYN received instead");
+        break;
+      case TelegramParser::STATUS_INVALID_SOURCE:
+        Log::info("The first byte after SYN is not master address: 0x%02x, delay: %llu us!",
+                  telegram.source,
+                  (telegram.startTime - telegram.synTime)/1000);
+        break;
+      case TelegramParser::STATUS_SYN:
+        Log::info("Unexpected SYN symbol!");
+        dumpSymbols();
+        break;
+      case TelegramParser::STATUS_TIMEOUT:
+        Log::info("Timeout occurred");
+        dumpSymbols();
+        break;
+      default:
+        Log::info("Telegram interrupted: %s",
+                  TelegramParser::status2String(status));
+        dumpSymbols();
+        break;
+    }
+
+    if (sending!=0) {
+        // Our own telegram is reported only if it has been sent
+        // successfully, otherwise it is retried.
+        bool isOK = status==TelegramParser::STATUS_COMPLETE &&
+            (Address::isBroadcast(telegram.destination) ||
+             (telegram.acknowledgement==Telegram::ACK &&
+              (!isSlave || telegram.replyCRCOK)));
+
+        auto handle = sending;
+        sending = 0;
+
+        if (telegram.replyRepeated) addToCounter(numReplyRepetitions);
+
+        if (isOK) {
+            if (telegram.repeated || telegram.replyRepeated) {
+                addToCounter(numRecoveredByRepetition);
+            }
+
+            // The move constructor copies the telegram, so it remains
+            // intact to be reported as received as well.
+            SendQueue::Entry entry;
+            if (sendQueue.take(handle, entry)) {
+                notifySendFinished(entry, SendQueue::STATUS_SENT, telegram);
+            }
+        } else {
+            sendingFailed(handle);
+            return;
         }
-        telegram.acknowledgement = Telegram::symbol2ack(ack);
     }
 
-    if (BusHandler::isSlaveAddress(destination) &&
-        ack==BusHandler::SYMBOL_ACK)
+    if (status==TelegramParser::STATUS_COMPLETE ||
+        status==TelegramParser::STATUS_NO_ACK)
     {
-        readReplyAndACK(telegram);
+        notifyReceived(telegram);
     }
+}
+
+//------------------------------------------------------------------------------
 
-    received(telegram);
+void MessageHandler::parseSymbols(const symbol_t* symbols,
+                                  const unsigned long long* times,
+                                  size_t length)
+{
+    size_t offset = 0;
+    while(offset<length) {
+        TelegramParser::status_t status;
+        offset += parser.push(symbols + offset, times + offset,
+                              length - offset, status);
+        processStatus(status);
+    }
 }
 
 //------------------------------------------------------------------------------
 
-void MessageHandler::readReply(Telegram& telegram)
-    throw(SYNException, TimeoutException, OSError)
+unsigned MessageHandler::parseReceived(symbol_t& lastSymbol)
 {
-    busHandler.resetCRC();
+    const symbol_t* symbols;
+    const unsigned long long* times;
+    auto length = busHandler.peekRawSymbols(symbols, times);
+    if (length==0) return 0;
+
+    unsigned numSYNs = 0;
 
-    auto numReplySymbols = busHandler.nextSymbol();
-    telegram.startReply(numReplySymbols);
-    for(unsigned i = 0; i<numReplySymbols; ++i) {
-        telegram.replyDataSymbols[i] = busHandler.nextSymbol();
+    SymbolScanner::Frames frames(symbols, length, BusHandler::SYMBOL_SYN);
+    size_t frameOffset, frameLength;
+    while(frames.next(frameOffset, frameLength)) {
+        parseSymbols(symbols + frameOffset, times + frameOffset, frameLength);
+        ++numSYNs;
     }
 
-    auto replyCRC = busHandler.getCRC();
-    auto sentReplyCRC = busHandler.nextSymbol();
-    telegram.replyCRCOK = replyCRC == sentReplyCRC;
+    auto offset = frames.getOffset();
+    parseSymbols(symbols + offset, times + offset, length - offset);
+
+    lastSymbol = symbols[length - 1];
+
+    busHandler.skipRawSymbols(length);
+
+    return numSYNs;
 }
 
 //------------------------------------------------------------------------------
 
-void MessageHandler::readReplyAndACK(Telegram& telegram)
-    throw(SYNException, TimeoutException, OSError)
+void MessageHandler::sendingFailed(SendQueue::handle_t handle)
 {
-    readReply(telegram);
+    SendQueue::Entry entry;
+    if (sendQueue.failed(handle)>=SendQueue::maxNumFailures &&
+        sendQueue.take(handle, entry))
+    {
+        Log::error("Sending the telegram from %02x to %02x failed too many times, giving up",
+                   entry.telegram->source, entry.telegram->destination);
+        notifySendFinished(entry, SendQueue::STATUS_FAILED, *entry.telegram);
+    }
+}
 
-    auto replyACK = busHandler.nextSymbol();
-    if (replyACK!=BusHandler::SYMBOL_ACK) {
-        Log::error("No ACK at the end of the slave reply: %02x", replyACK);
+//------------------------------------------------------------------------------
+
+void MessageHandler::dumpSymbols()
+{
+    auto numSymbols = parser.getNumSymbols();
+    if (numSymbols==0) return;
+
+    auto symbols = parser.getSymbols();
+
+    char buffer[3*TelegramParser::maxNumSymbols + 32];
+    strcpy(buffer, "  the bytes received so far:");
+    size_t bufferLength = strlen(buffer);
+
+    for(size_t i = 0; i<numSymbols; ++i) {
+        bufferLength += snprintf(buffer + bufferLength,
+                                 sizeof(buffer) - bufferLength,
+                                 " %02x", symbols[i]);
     }
-    telegram.masterAcknowledgement = Telegram::symbol2ack(replyACK);
+
+    Log::info("%s", buffer);
 }
 
 //------------------------------------------------------------------------------
 
-unsigned MessageHandler::trySend()
-    throw(SYNException, TimeoutException, OSError)
+void MessageHandler::busOpened() noexcept
 {
-    auto telegram = sendQueue.front();
+    // A telegram being sent when the bus failed remains queued
+    sending = 0;
+    losslessDispatching = busHandler.isReplaying();
 
-    busHandler.resetCRC();
-    auto symbol = busHandler.writeSymbol(telegram->source);
-    if (symbol==telegram->source) {
-        busHandler.writeSymbol(telegram->destination);
-        busHandler.writeSymbol(telegram->primaryCommand);
-        busHandler.writeSymbol(telegram->secondaryCommand);
-        busHandler.writeSymbol(telegram->numDataSymbols);
-        for(size_t i = 0; i<telegram->numDataSymbols; ++i) {
-            busHandler.writeSymbol(telegram->dataSymbols[i]);
+    if (roundTripRequested && !busHandler.isReplaying()) {
+        Log::info("Measuring the write-to-echo round trip...");
+        action = ACTION_MEASURING;
+        busHandler.measureRoundTrip();
+        return;
+    }
+
+    action = ACTION_NONE;
+    loseSignal();
+    waitNext();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::symbolsReceived() noexcept
+{
+    while(action==ACTION_NONE) {
+        if (!hasSignal) {
+            if (!busHandler.findSignal()) break;
+            signalDetected();
+        } else {
+            symbol_t symbol;
+            if (!busHandler.nextRawSymbol(symbol)) break;
+            processSymbol(symbol, false);
         }
-        busHandler.writeSymbol(busHandler.getCRC());
-        telegram->crcOK = true;
-
-        bool isOK = true;
-        if (!BusHandler::isBroadcastAddress(telegram->destination)) {
-            auto ack = busHandler.nextSymbol();
-            if (ack!=BusHandler::SYMBOL_ACK) {
-                Log::error("No ACK at received from destination: %02x", ack);
-            }
-            telegram->acknowledgement = Telegram::symbol2ack(ack);
-            if (telegram->acknowledgement==Telegram::ACK) {
-                if (BusHandler::isSlaveAddress(telegram->destination)) {
-                    readReply(*telegram);
-                    isOK = telegram->replyCRCOK;
-
-                    auto replyACK = isOK ?
-                        BusHandler::SYMBOL_ACK : BusHandler::SYMBOL_NACK;
-                    busHandler.writeSymbol(replyACK);
-
-                    telegram->masterAcknowledgement =
-                        Telegram::symbol2ack(replyACK);
-                }
-            } else {
-                isOK = false;
+    }
+
+    waitNext();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::timedOut() noexcept
+{
+    if (!hasSignal) {
+        if (autoSYN &&
+            (currentTimeNanos() - busHandler.getLastReceiveTime())
+            >= autoSYNTimeout*1000000ULL)
+        {
+            auto error = generateSYN();
+            if (!error.isOK()) {
+                busFailed(error);
+                return;
             }
+            action = ACTION_STARTING_SYN;
+            return;
         }
-        if (isOK) {
-            received(*telegram);
-            sendQueue.pop_front();
-            delete telegram;
+        Log::info("Still no signal...");
+        signalDeadline = BusHandler::deadlineIn(1000000ULL);
+    } else if (generatingSYN) {
+        auto error = generateSYN();
+        if (!error.isOK()) {
+            busFailed(error);
+            return;
         }
-        return 0;
+        action = ACTION_GENERATING_SYN;
+        return;
+    } else if (parser.isIdle()) {
+        // Only the first one of the timeouts in a row is logged
+        if (numIdleTimeouts++==0) {
+            Log::info("Timeout waiting for a message...");
+        }
+        if (autoSYN &&
+            (currentTimeNanos() - busHandler.getLastReceiveTime())
+            >= autoSYNTimeout*1000000ULL)
+        {
+            loseSignal();
+        } else if (lowPower && !autoSYN &&
+                   numIdleTimeouts>=maxNumIdleTimeouts)
+        {
+            loseSignal();
+        }
+    } else {
+        processStatus(parser.timeout());
+        loseSignal();
+    }
+
+    waitNext();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::symbolWritten(const Result<symbol_t>& result) noexcept
+{
+    switch(action) {
+      case ACTION_ARBITRATING:
+        arbitrated(result);
+        break;
+      case ACTION_SENDING_MASTER_ACK:
+        masterACKSent(result);
+        break;
+      case ACTION_STARTING_SYN:
+        synStarted(result);
+        break;
+      case ACTION_GENERATING_SYN:
+        synGenerated(result);
+        break;
+      default:
+        break;
+    }
+
+    waitNext();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::symbolsWritten(const Result<bool>& result) noexcept
+{
+    switch(action) {
+      case ACTION_SENDING:
+        sent(result);
+        break;
+      case ACTION_REPEATING:
+        repeated(result);
+        break;
+      case ACTION_RESPONDING:
+        responded(result);
+        break;
+      default:
+        break;
+    }
+
+    waitNext();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::roundTripMeasured(const Result<unsigned long long>& result)
+    noexcept
+{
+    if (!result.isOK()) {
+        busFailed(result.getError());
+        return;
+    }
+
+    roundTripRequested = false;
+    auto roundTrip = result.getValue();
+    if (roundTrip==0) {
+        Log::info("Could not measure the write-to-echo round trip, e.g. because the bus is not silent, it will be measured when the arbitration is first won");
+        roundTripPending = true;
+    } else {
+        adaptEchoTimeout(roundTrip);
+    }
+
+    action = ACTION_NONE;
+    loseSignal();
+    waitNext();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::busFailed(const Error& error) noexcept
+{
+    action = ACTION_CLOSED;
+    if (error.getKind()==Error::END_OF_FILE) return;
+
+    Log::error("OSError: %s, trying to open the port again",
+               error.toString().c_str());
+    auto openError = busHandler.open();
+    if (!openError.isOK()) {
+        Log::error("Could not open the port again: %s",
+                   openError.toString().c_str());
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::waitNext()
+{
+    if (action!=ACTION_NONE) return;
+
+    if (!hasSignal) {
+        busHandler.setDeadline(signalDeadline);
+    } else if (generatingSYN) {
+        // The deadline is counted from the reception of the last symbol,
+        // so that the SYN symbols are spaced evenly regardless of the
+        // processing time
+        busHandler.setDeadline(busHandler.getLastSymbolTime() +
+                               BusHandler::INTERVAL_AUTO_SYN*1000ULL);
+    } else {
+        busHandler.setDeadline(
+            BusHandler::deadlineIn(BusHandler::TIMEOUT_AUTO_SYN));
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::loseSignal()
+{
+    hasSignal = false;
+    generatingSYN = false;
+    notifySignalChanged(false);
+    Log::info("Waiting for signal...");
+    if (lowPower && !autoSYN) {
+        busHandler.setReadBatching(true);
+        signalDeadline = 0;
+    } else {
+        signalDeadline = BusHandler::deadlineIn(1000000ULL);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::signalDetected()
+{
+    Log::info("Signal detected");
+    notifySignalChanged(true);
+
+    hasSignal = true;
+    numIdleTimeouts = 0;
+    arbitration.reset();
+    parser.reset();
+    parser.push(BusHandler::SYMBOL_SYN, busHandler.getLastSymbolTime());
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::processSymbol(symbol_t symbol, bool generated)
+{
+    numIdleTimeouts = 0;
+    processStatus(parser.push(symbol, busHandler.getLastSymbolTime()));
+    unsigned numSYNs = (symbol==BusHandler::SYMBOL_SYN) ? 1 : 0;
+    unsigned numForeignSYNs = generated ? 0 : numSYNs;
+
+    // The rest of the symbols already received are parsed at once, unless
+    // the telegram being sent needs our attention. Sending can be
+    // attempted only after the last of them anyway.
+    if (sending==0) {
+        auto numReceivedSYNs = parseReceived(symbol);
+        numSYNs += numReceivedSYNs;
+        numForeignSYNs += numReceivedSYNs;
+    }
+
+    arbitration.synReceived(numSYNs);
+    if (generatingSYN && numForeignSYNs>0) stopGeneratingSYN();
+
+    Error error;
+    if (symbol==BusHandler::SYMBOL_SYN) {
+        if (eventFD>=0) acceptSendRequests();
+        if (!sendQueue.empty()) expireSendings();
+        if (lowPower) {
+            // The batching would delay the symbols that should prevent
+            // generating a SYN symbol, and the queries to our slave
+            // address beyond the reply window
+            busHandler.setReadBatching(sendQueue.empty() &&
+                                       !generatingSYN &&
+                                       responder.getAddress()==0);
+        }
+        if (arbitration.canStart() && !sendQueue.empty() &&
+            (!trafficScheduling ||
+             trafficSchedule.canStart(busHandler.getLastSymbolTime())))
+        {
+            error = trySend();
+        }
+    } else if (sending!=0 && parser.isAwaitingMasterACK()) {
+        error = sendMasterACK();
+    } else if (sending!=0 && parser.isAwaitingRepetition()) {
+        error = repeatSending();
+    } else if (responder.getAddress()!=0 &&
+               (parser.isAwaitingACK() ||
+                parser.isAwaitingReplyRepetition()) &&
+               parser.getTelegram().destination==responder.getAddress())
+    {
+        error = respond();
+    }
+
+    if (!error.isOK()) busFailed(error);
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::echoFailed(const Error& error)
+{
+    if (error.getKind()!=Error::TIMEOUT) {
+        busFailed(error);
+        return;
+    }
+
+    addToCounter(numEchoTimeouts);
+    Log::error("Timeout waiting for the echo of a symbol written");
+    processStatus(parser.timeout());
+    loseSignal();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::adaptEchoTimeout(unsigned long long roundTrip)
+{
+    // The echo of the first symbol after SYN should arrive before the next
+    // symbol would be due, otherwise we cannot tell in time whether the
+    // arbitration is won.
+    auto latency = (roundTrip>EBUS::SYMBOL_DURATION) ?
+        (roundTrip - EBUS::SYMBOL_DURATION) : 0;
+    bool viable = latency<EBUS::SYMBOL_DURATION;
+    Log::info("Write-to-echo round trip: %llu us (latency over the symbol time: %llu us), sending is %s",
+              roundTrip/1000, latency/1000, viable ? "viable" : "NOT viable");
+
+    // Allow for some jitter of the latency when waiting for the echoes
+    auto echoTimeout = 2*latency + EBUS::SYMBOL_DURATION;
+    Log::info("Echo timeout: %llu us", echoTimeout/1000);
+    busHandler.setEchoTimeout(echoTimeout);
+}
+
+//------------------------------------------------------------------------------
+
+Error MessageHandler::trySend() noexcept
+{
+    auto entry = sendQueue.next();
+    auto handle = entry->handle;
+
+    // The arbitration engine counts the losses of a telegram in a row
+    if (handle!=arbitrating) {
+        arbitration.cancelled();
+        arbitrating = handle;
+    }
+
+    busHandler.resetCRC();
+    auto error = busHandler.writeSymbol(entry->telegram->source);
+    if (error.isOK()) action = ACTION_ARBITRATING;
+
+    return error;
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::arbitrated(const Result<symbol_t>& result)
+{
+    if (!result.isOK()) {
+        echoFailed(result.getError());
+        return;
+    }
+
+    // The telegram cannot be cancelled while it is arbitrating
+    auto handle = arbitrating;
+    auto telegram = sendQueue.find(handle)->telegram;
+    auto symbol = result.getValue();
+
+    // The symbol received is the source address of the telegram started,
+    // whether it is ours or not.
+    processStatus(parser.push(symbol, busHandler.getLastSymbolTime()));
+
+    auto arbitrationResult =
+        arbitration.arbitrated(telegram->source, symbol,
+                               busHandler.getLastSymbolTime());
+    trafficSchedule.arbitrated(arbitrationResult==Arbitration::RESULT_WON);
+    if (arbitrationResult==Arbitration::RESULT_GIVEN_UP) {
+        action = ACTION_NONE;
+        Log::error("Arbitration lost too many times, giving up the telegram from %02x to %02x",
+                   telegram->source, telegram->destination);
+        SendQueue::Entry given;
+        if (sendQueue.take(handle, given)) {
+            notifySendFinished(given, SendQueue::STATUS_GIVEN_UP,
+                               *given.telegram);
+        }
+        return;
+    } else if (arbitrationResult!=Arbitration::RESULT_WON) {
+        action = ACTION_NONE;
+        return;
+    }
+
+    if (roundTripPending) {
+        roundTripPending = false;
+        adaptEchoTimeout(busHandler.getLastRoundTrip());
+    }
+
+    // The arbitration is won, so the rest of the telegram is written at
+    // once and the echoes are verified afterwards.
+    symbol_t buffer[maxNumEscapedMasterSymbols];
+    size_t length = escapeMasterPart(buffer, *telegram);
+
+    action = ACTION_SENDING;
+    auto error = busHandler.writeSymbols(buffer, length);
+    if (!error.isOK()) {
+        addToCounter(numSendsAborted);
+        busFailed(error);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::sent(const Result<bool>& result)
+{
+    auto handle = arbitrating;
+    action = ACTION_NONE;
+
+    if (!result.isOK()) {
+        addToCounter(numSendsAborted);
+        echoFailed(result.getError());
+        return;
+    }
+    if (!result.getValue()) {
+        addToCounter(numSendsAborted);
+        Log::error("Echo mismatch, sending aborted");
+        parser.reset();
+        arbitration.aborted();
+        sendingFailed(handle);
+        return;
+    }
+
+    // The rest of the telegram (the acknowledgement, the reply) is
+    // received as any other symbols. A broadcast telegram is complete
+    // already.
+    sending = handle;
+    size_t length;
+    auto symbols = busHandler.getWrittenSymbols(length);
+    TelegramParser::status_t status;
+    parser.push(symbols, length, busHandler.getLastSymbolTime(), status);
+    processStatus(status);
+}
+
+//------------------------------------------------------------------------------
+
+Error MessageHandler::repeatSending() noexcept
+{
+    auto entry = sendQueue.find(sending);
+    if (entry==0) return Error();
+
+    // The bus is still ours, so the source address is written together
+    // with the rest without any arbitration.
+    symbol_t buffer[1 + maxNumEscapedMasterSymbols];
+    buffer[0] = entry->telegram->source;
+    size_t length = 1 + escapeMasterPart(buffer + 1, *entry->telegram);
+
+    addToCounter(numRepetitions);
+
+    auto error = busHandler.writeSymbols(buffer, length);
+    if (!error.isOK()) {
+        addToCounter(numSendsAborted);
+        return error;
+    }
+
+    action = ACTION_REPEATING;
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::repeated(const Result<bool>& result)
+{
+    action = ACTION_NONE;
+
+    if (!result.isOK()) {
+        addToCounter(numSendsAborted);
+        echoFailed(result.getError());
+        return;
+    }
+    if (!result.getValue()) {
+        addToCounter(numSendsAborted);
+        Log::error("Echo mismatch, repetition aborted");
+        parser.reset();
+        auto handle = sending;
+        sending = 0;
+        sendingFailed(handle);
+        return;
+    }
+
+    size_t length;
+    auto symbols = busHandler.getWrittenSymbols(length);
+    TelegramParser::status_t status;
+    parser.push(symbols, length, busHandler.getLastSymbolTime(), status);
+    processStatus(status);
+}
+
+//------------------------------------------------------------------------------
+
+Error MessageHandler::sendMasterACK() noexcept
+{
+    auto ack = parser.getTelegram().replyCRCOK ?
+        BusHandler::SYMBOL_ACK : BusHandler::SYMBOL_NACK;
+
+    auto error = busHandler.writeSymbol(ack);
+    if (error.isOK()) action = ACTION_SENDING_MASTER_ACK;
+
+    return error;
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::masterACKSent(const Result<symbol_t>& result)
+{
+    action = ACTION_NONE;
+
+    if (!result.isOK()) {
+        echoFailed(result.getError());
+        return;
+    }
+
+    processStatus(parser.push(result.getValue(),
+                              busHandler.getLastSymbolTime()));
+}
+
+//------------------------------------------------------------------------------
+
+Error MessageHandler::respond() noexcept
+{
+    auto& telegram = parser.getTelegram();
+    auto& statistics = responder.getStatistics();
+    auto response = responder.find(telegram.primaryCommand,
+                                   telegram.secondaryCommand);
+
+    const symbol_t* symbols;
+    size_t length;
+    if (parser.isAwaitingReplyRepetition()) {
+        // The acknowledgement has been sent already
+        if (response==0) return Error();
+        symbols = response->symbols + 1;
+        length = response->length - 1;
+        addToCounter(statistics.numRepetitions);
+    } else if (!telegram.crcOK) {
+        static const symbol_t nack = BusHandler::SYMBOL_NACK;
+        symbols = &nack;
+        length = 1;
+        addToCounter(statistics.numNACKs);
+    } else if (response==0) {
+        addToCounter(statistics.numUnknown);
+        return Error();
     } else {
-        return ((symbol&0x0f)==(telegram->source&0x0f)) ? 1 : 2;
+        symbols = response->symbols;
+        length = response->length;
+
+        auto latency = currentTimeNanos() - telegram.endTime;
+        addToCounter(statistics.numResponses);
+        addToCounter(statistics.totalLatency, latency);
+        raiseCounter(statistics.maxLatency, latency);
+    }
+
+    auto error = busHandler.writeSymbols(symbols, length);
+    if (error.isOK()) action = ACTION_RESPONDING;
+
+    return error;
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::responded(const Result<bool>& result)
+{
+    action = ACTION_NONE;
+
+    if (!result.isOK()) {
+        echoFailed(result.getError());
+        return;
+    }
+    if (!result.getValue()) {
+        Log::error("Echo mismatch, response aborted");
+        parser.reset();
+        return;
     }
+
+    size_t length;
+    auto symbols = busHandler.getWrittenSymbols(length);
+    TelegramParser::status_t status;
+    parser.push(symbols, length, busHandler.getLastSymbolTime(), status);
+    processStatus(status);
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::synStarted(const Result<symbol_t>& result)
+{
+    action = ACTION_NONE;
+
+    if (!result.isOK()) {
+        if (result.getError().getKind()!=Error::TIMEOUT) {
+            busFailed(result.getError());
+            return;
+        }
+        addToCounter(numEchoTimeouts);
+        Log::error("Timeout waiting for the echo of a SYN symbol generated");
+    } else if (result.getValue()==BusHandler::SYMBOL_SYN) {
+        addToCounter(numAutoSYNs);
+
+        Log::info("No SYN generator detected, generating SYN symbols");
+        generatingSYN = true;
+        addToCounter(numAutoSYNTakeovers);
+        if (lowPower) busHandler.setReadBatching(false);
+
+        signalDetected();
+        return;
+    }
+
+    Log::info("Still no signal...");
+    signalDeadline = BusHandler::deadlineIn(1000000ULL);
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::synGenerated(const Result<symbol_t>& result)
+{
+    action = ACTION_NONE;
+
+    if (!result.isOK()) {
+        if (result.getError().getKind()!=Error::TIMEOUT) {
+            busFailed(result.getError());
+            return;
+        }
+        addToCounter(numEchoTimeouts);
+        Log::error("Timeout waiting for the echo of a SYN symbol generated");
+        processStatus(parser.timeout());
+        loseSignal();
+        return;
+    }
+
+    auto symbol = result.getValue();
+    if (symbol==BusHandler::SYMBOL_SYN) {
+        addToCounter(numAutoSYNs);
+        if (generatingSYN) {
+            auto spacing = busHandler.getLastSymbolTime() - synPrecedingTime;
+            addToCounter(totalAutoSYNSpacing, spacing);
+            raiseCounter(maxAutoSYNSpacing, spacing);
+        }
+    }
+
+    processSymbol(symbol, true);
+}
+
+//------------------------------------------------------------------------------
+
+void MessageHandler::stopGeneratingSYN()
+{
+    Log::info("Another SYN generator detected, stopping generating SYN symbols");
+    generatingSYN = false;
+    addToCounter(numAutoSYNStandDowns);
+}
+
+//------------------------------------------------------------------------------
+
+Error MessageHandler::generateSYN() noexcept
+{
+    synPrecedingTime = busHandler.getLastSymbolTime();
+    return busHandler.writeSymbol(BusHandler::SYMBOL_SYN);
 }
 
 //------------------------------------------------------------------------------
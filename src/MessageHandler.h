@@ -20,12 +20,19 @@
 #define MESSAGEHANDLER_H
 //------------------------------------------------------------------------------
 
-// FIXME: do not include BusHandler once SYNException is moved out
 #include "BusHandler.h"
-#include "OSError.h"
+#include "Arbitration.h"
+#include "SendQueue.h"
+#include "Responder.h"
+#include "TrafficSchedule.h"
+#include "TelegramParser.h"
+#include "Result.h"
+#include "SPSCQueue.h"
 #include "util.h"
 
-#include <deque>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
 
 //------------------------------------------------------------------------------
 
@@ -35,10 +42,151 @@ class Telegram;
 
 /**
  * The class handling the reception and the sending of messages.
+ *
+ * It is driven by the callbacks of the bus handler, which are called by the
+ * reactor driving the bus, so several buses can be handled by the same
+ * thread. The thread calling the reactor is referred to as the thread
+ * running the handler.
  */
-class MessageHandler
+class MessageHandler : private BusHandler::Listener
 {
+public:
+    /**
+     * The default time in milliseconds within which a telegram should be
+     * sent.
+     */
+    static const unsigned defaultSendTimeout = 10000;
+
+    /**
+     * Type for the functions to call when the sending of a telegram has
+     * finished. The telegram passed is the one received, if it has been
+     * sent successfully, i.e. it contains the acknowledgements, the reply
+     * and the timing as well. Otherwise it is the telegram to send.
+     */
+    typedef std::function<void (const Telegram& telegram,
+                                SendQueue::status_t status)> completion_t;
+
 private:
+    /**
+     * The capacity of the queue of the events to be dispatched, except
+     * for those reporting a finished sending. It is also the number of the
+     * telegrams preallocated for the telegrams received.
+     */
+    static const size_t eventQueueSize = 256;
+
+    /**
+     * The capacity of the queue of the events reporting a finished
+     * sending. It is also the maximal number of telegrams passed to send()
+     * whose completion has not been dispatched yet, so the queue never
+     * overflows.
+     */
+    static const size_t completionQueueSize = 64;
+
+    /**
+     * The capacity of the queue of the telegrams passed to send() while
+     * dispatching.
+     */
+    static const size_t sendRequestQueueSize = 64;
+
+    /**
+     * The capacity of the queue of the handles passed to cancel() while
+     * dispatching.
+     */
+    static const size_t cancelRequestQueueSize = 64;
+
+    /**
+     * The capacity of the queue of the responses passed to setResponse()
+     * while dispatching.
+     */
+    static const size_t responseUpdateQueueSize = 16;
+
+    /**
+     * The interval in microseconds to wait for a free telegram or for the
+     * event queue to have free space, if the dispatching is lossless.
+     */
+    static const unsigned eventQueueWaitInterval = 100;
+
+    /**
+     * The time in milliseconds the bus should be silent before we start
+     * generating the SYN symbols in the auto-SYN mode.
+     */
+    static const unsigned autoSYNTimeout = 1000;
+
+    /**
+     * The number of timeouts in a row while the parser is idle, after which
+     * the signal is considered lost in the low-power mode, so that it is
+     * waited for without periodic wakeups.
+     */
+    static const unsigned maxNumIdleTimeouts = 3;
+
+    /**
+     * The actions of the handler, i.e. what the bus handler is doing for
+     * it.
+     */
+    typedef enum {
+        // The bus is not open
+        ACTION_CLOSED,
+
+        // The symbols received are processed
+        ACTION_NONE,
+
+        // The write-to-echo round trip is being measured
+        ACTION_MEASURING,
+
+        // The first SYN symbol is being generated in the auto-SYN mode
+        ACTION_STARTING_SYN,
+
+        // A SYN symbol is being generated in the auto-SYN mode
+        ACTION_GENERATING_SYN,
+
+        // Our source address is being written for the arbitration
+        ACTION_ARBITRATING,
+
+        // The rest of the master part of the telegram is being written
+        // after winning the arbitration
+        ACTION_SENDING,
+
+        // The master part of the telegram being sent is being repeated
+        ACTION_REPEATING,
+
+        // The acknowledgement of the reply to the telegram being sent is
+        // being written
+        ACTION_SENDING_MASTER_ACK,
+
+        // The response to a query to our slave address is being written
+        ACTION_RESPONDING
+    } action_t;
+
+    /**
+     * An event passed from the thread running the handler to the thread
+     * dispatching the events.
+     */
+    struct Event
+    {
+        /**
+         * The telegram received or whose sending has finished, or 0 if the
+         * signal status has changed. A telegram received is one of the
+         * preallocated ones.
+         */
+        Telegram* telegram;
+
+        /**
+         * Whether there is a signal, if the signal status has changed.
+         */
+        bool hasSignal;
+
+        /**
+         * The handle of the telegram whose sending has finished, or 0 if
+         * the event is not about sending.
+         */
+        SendQueue::handle_t handle;
+
+        /**
+         * The status of the telegram whose sending has finished.
+         */
+        SendQueue::status_t status;
+    };
+
     /**
      * The bus handler we work with.
      */
@@ -47,7 +195,256 @@ private:
     /**
      * The queue of telegrams to send.
      */
-    std::deque<Telegram*> sendQueue;
+    SendQueue sendQueue;
+
+    /**
+     * The parser of the telegrams received.
+     */
+    TelegramParser parser;
+
+    /**
+     * The arbitration engine deciding when the telegrams may be sent.
+     */
+    Arbitration arbitration;
+
+    /**
+     * The table of the responses to the queries to our slave address.
+     */
+    Responder responder;
+
+    /**
+     * The schedule of the periodic traffic of the other masters.
+     */
+    TrafficSchedule trafficSchedule;
+
+    /**
+     * The handle of the telegram being sent, if the arbitration has been
+     * won for it, otherwise 0. It remains in the send queue until it is
+     * finished.
+     */
+    SendQueue::handle_t sending;
+
+    /**
+     * The handle of the telegram the arbitration has been attempted for
+     * last.
+     */
+    SendQueue::handle_t arbitrating;
+
+    /**
+     * The handle of the telegram enqueued last.
+     */
+    SendQueue::handle_t lastHandle;
+
+    /**
+     * The functions to call when the sending of the telegrams with the
+     * given handles has finished. It is used only by the thread calling
+     * send() and dispatch(), or by the thread running the handler, if the
+     * events are not dispatched.
+     */
+    std::unordered_map<SendQueue::handle_t, completion_t> completions;
+
+    /**
+     * The event file descriptor signalled when events are pushed to the
+     * event queue. It is -1, if the events are not dispatched, but the
+     * callbacks are called directly by the thread running the handler.
+     */
+    int eventFD;
+
+    /**
+     * The queue of the events to be dispatched, except for those reporting
+     * a finished sending.
+     */
+    SPSCQueue<Event, eventQueueSize> events;
+
+    /**
+     * The queue of the events reporting a finished sending.
+     */
+    SPSCQueue<Event, completionQueueSize> completionEvents;
+
+    /**
+     * The telegrams preallocated for passing the telegrams received to
+     * the dispatching thread, so that the thread running the handler does
+     * not have to allocate memory.
+     */
+    Telegram telegrams[eventQueueSize];
+
+    /**
+     * The queue of the preallocated telegrams that are free. The
+     * dispatching thread returns the telegrams to it after dispatching
+     * them.
+     */
+    SPSCQueue<Telegram*, eventQueueSize> freeTelegrams;
+
+    /**
+     * A free preallocated telegram taken by the thread running the
+     * handler, whose event has been dropped, or 0.
+     */
+    Telegram* spareTelegram;
+
+    /**
+     * The number of telegrams passed to send() whose completion has not
+     * been dispatched yet. It is used only by the thread calling send().
+     */
+    size_t numSendsPending;
+
+    /**
+     * The queue of the telegrams passed to send() while dispatching. They
+     * are moved to the send queue by the thread running the handler.
+     */
+    SPSCQueue<SendQueue::Entry, sendRequestQueueSize> sendRequests;
+
+    /**
+     * The queue of the handles passed to cancel() while dispatching. They
+     * are processed by the thread running the handler.
+     */
+    SPSCQueue<SendQueue::handle_t, cancelRequestQueueSize> cancelRequests;
+
+    /**
+     * The queue of the responses passed to setResponse() while
+     * dispatching. They are put into the table of the responses by the
+     * thread running the handler.
+     */
+    SPSCQueue<Responder::Update, responseUpdateQueueSize> responseUpdates;
+
+    /**
+     * Indicate if the thread running the handler should wait for the
+     * dispatching thread instead of dropping events when the event queue is
+     * full or there is no free telegram. This is not acceptable for a live
+     * bus, where the timing must be kept, but it is for a replayed capture,
+     * so it is enabled when the bus is a replayed capture. The events
+     * reporting that the sending of a telegram has finished are never
+     * dropped, and they are never waited for either.
+     */
+    bool losslessDispatching;
+
+    /**
+     * Indicate if the low-power mode is enabled.
+     */
+    bool lowPower;
+
+    /**
+     * Indicate if the auto-SYN mode is enabled, i.e. we generate the SYN
+     * symbols if there is no SYN generator on the bus.
+     */
+    bool autoSYN;
+
+    /**
+     * Indicate if we are generating the SYN symbols currently.
+     */
+    bool generatingSYN;
+
+    /**
+     * Indicate if the arbitrations are deferred while a periodic telegram
+     * of another master is expected to be started.
+     */
+    bool trafficScheduling;
+
+    /**
+     * Indicate if the write-to-echo round trip should be measured when the
+     * arbitration is won the next time.
+     */
+    bool roundTripPending;
+
+    /**
+     * Indicate if the write-to-echo round trip should be measured when the
+     * bus is opened.
+     */
+    bool roundTripRequested;
+
+    /**
+     * The current action.
+     */
+    action_t action;
+
+    /**
+     * Indicate if there is signal on the bus.
+     */
+    bool hasSignal;
+
+    /**
+     * The number of timeouts in a row while the parser is idle.
+     */
+    unsigned numIdleTimeouts;
+
+    /**
+     * The deadline in nanoseconds of the monotonic clock for the signal to
+     * appear, or 0 if it is waited for indefinitely.
+     */
+    unsigned long long signalDeadline;
+
+    /**
+     * The monotonic time in nanoseconds when the last symbol before the SYN
+     * symbol being generated has been received.
+     */
+    unsigned long long synPrecedingTime;
+
+    /**
+     * Indicate if the thread running the handler has stopped.
+     */
+    std::atomic<bool> stopped;
+
+    /**
+     * The number of events dropped, because the event queue was full.
+     */
+    std::atomic<unsigned long> numDroppedEvents;
+
+    /**
+     * The number of sendings aborted after winning the arbitration, because
+     * of an echo mismatch or timeout.
+     */
+    std::atomic<unsigned long> numSendsAborted;
+
+    /**
+     * The number of times the echo of a symbol written has not arrived in
+     * time.
+     */
+    std::atomic<unsigned long> numEchoTimeouts;
+
+    /**
+     * The number of times the master part of a telegram sent has been
+     * repeated, because the destination has responded with NACK.
+     */
+    std::atomic<unsigned long> numRepetitions;
+
+    /**
+     * The number of times the slave has repeated its reply to a telegram
+     * sent, because its CRC was wrong.
+     */
+    std::atomic<unsigned long> numReplyRepetitions;
+
+    /**
+     * The number of telegrams sent successfully thanks to a repetition.
+     */
+    std::atomic<unsigned long> numRecoveredByRepetition;
+
+    /**
+     * The number of SYN symbols generated in the auto-SYN mode.
+     */
+    std::atomic<unsigned long> numAutoSYNs;
+
+    /**
+     * The number of times we have started generating the SYN symbols.
+     */
+    std::atomic<unsigned long> numAutoSYNTakeovers;
+
+    /**
+     * The number of times we have stopped generating the SYN symbols,
+     * because another SYN generator has appeared.
+     */
+    std::atomic<unsigned long> numAutoSYNStandDowns;
+
+    /**
+     * The total of the times in nanoseconds between the last symbol
+     * received and the echo of the SYN symbol generated after it, while
+     * generating the SYN symbols.
+     */
+    std::atomic<unsigned long long> totalAutoSYNSpacing;
+
+    /**
+     * The maximal time in nanoseconds between the last symbol received and
+     * the echo of the SYN symbol generated after it.
+     */
+    std::atomic<unsigned long long> maxAutoSYNSpacing;
 
 public:
     /**
@@ -56,14 +453,249 @@ public:
     MessageHandler(BusHandler& busHandler);
 
     /**
-     * Handle the messages.
+     * Destroy the message handler.
+     */
+    virtual ~MessageHandler();
+
+    /**
+     * Set whether the low-power mode is enabled. In this mode the signal is
+     * waited for without any periodic wakeup, and the reads are batched
+     * while there is nothing to send. If queries to our slave address are
+     * answered, the reads are not batched while there is signal.
+     */
+    void setLowPower(bool lowPower);
+
+    /**
+     * Set the value of the lock counter after winning the arbitration. If
+     * it is 0, the number of masters seen on the bus is used.
+     */
+    void setLockCount(unsigned lockCount);
+
+    /**
+     * Set whether the auto-SYN mode is enabled. In this mode, if the bus
+     * has been silent for a while, we start generating the SYN symbols
+     * ourselves, and we stop it as soon as a SYN symbol generated by
+     * someone else is received.
+     */
+    void setAutoSYN(bool autoSYN);
+
+    /**
+     * Set whether the arbitrations are deferred while a periodic telegram
+     * of another master is expected to be started. The schedule of the
+     * periodic traffic is learnt and the collisions are counted even if it
+     * is not enabled, so that the collision rates can be compared.
+     */
+    void setTrafficScheduling(bool trafficScheduling);
+
+    /**
+     * Set our slave address. The queries to it are answered from the table
+     * of the responses, if the table contains a response to their
+     * commands. If it is 0, no queries are answered. It should be called
+     * before start().
+     */
+    void setSlaveAddress(symbol_t address);
+
+    /**
+     * Get our slave address, or 0 if no queries are answered.
+     */
+    symbol_t getSlaveAddress() const;
+
+    /**
+     * Set the response to the identification query in the table of the
+     * responses. See Responder::setIdentification(). It should be called
+     * before start().
+     */
+    void setIdentification(symbol_t manufacturer, const char* id,
+                           uint16_t softwareVersion,
+                           uint16_t hardwareVersion);
+
+    /**
+     * Set the given response in the table of the responses, e.g. to update
+     * the value of an emulated sensor. It should be called from the same
+     * thread as send(). If the events are dispatched, the response is
+     * passed to the thread running the handler via a lock-free queue, and
+     * it takes effect at the next SYN symbol.
+     *
+     * @return whether the response has been accepted. It is rejected, if
+     * its data does not fit into a response, or the queue is full.
+     */
+    bool setResponse(const Responder::Update& update);
+
+    /**
+     * Start handling the messages by opening the bus. The messages are
+     * handled by the reactor driving the bus. If the bus fails, it is
+     * opened again, until the end of a replayed capture is reached. It
+     * throws an OSError, if the bus cannot be opened.
+     *
+     * If the write-to-echo round trip should be measured, it is done when
+     * the bus has been opened, and the echo timeout is adapted to it. If
+     * the bus is not silent, a SYN symbol cannot be written for the
+     * measurement without disturbing the arbitrations, so the round trip
+     * of our source address is measured when the arbitration is won the
+     * next time instead. The default echo timeout is used until then.
+     */
+    void start(bool measureRoundTrip);
+
+    /**
+     * Send the given telegram. It will be enqueued, and attempted to be sent
+     * according to its priority. If it cannot be sent within the given
+     * timeout in milliseconds, it expires. If the timeout is 0, it never
+     * expires. When the sending is finished in any way, sendFinished() is
+     * called.
+     *
+     * If the events are dispatched, it should be called from the thread
+     * calling dispatch(), and the telegram is passed to the thread running
+     * the handler via a lock-free queue.
+     *
+     * @return the handle of the telegram, which can be used to cancel its
+     * sending, or 0 if the telegram has been dropped, because there are
+     * too many telegrams to send. If the events are dispatched, at most
+     * completionQueueSize telegrams can be sent at the same time.
+     */
+    SendQueue::handle_t send(Telegram* telegram,
+                             SendQueue::priority_t priority =
+                             SendQueue::PRIORITY_NORMAL,
+                             unsigned timeout = defaultSendTimeout);
+
+    /**
+     * Send the given telegram like send() above, and call the given
+     * function when the sending has finished. If the events are
+     * dispatched, the function is called by dispatch(), otherwise by the
+     * thread running the handler. It is not called, if the telegram has
+     * been dropped.
+     *
+     * This way several requests can be outstanding at the same time, each
+     * with its own function to process the reply.
+     */
+    SendQueue::handle_t send(Telegram* telegram,
+                             const completion_t& completion,
+                             SendQueue::priority_t priority =
+                             SendQueue::PRIORITY_NORMAL,
+                             unsigned timeout = defaultSendTimeout);
+
+    /**
+     * Cancel the sending of the telegram with the given handle, unless its
+     * sending has already finished or it is being sent. It should be called
+     * from the same thread as send().
+     */
+    void cancel(SendQueue::handle_t handle);
+
+    /**
+     * Enable dispatching the events. After this, received() and
+     * signalChanged() are not called by the thread running the handler,
+     * but the events are queued
+     * and the callbacks are called by dispatch(), which is expected to run
+     * in another thread. This way the thread running the handler does not
+     * have to wait for the (possibly slow) processing of the telegrams. It
+     * throws an OSError if the event file descriptor cannot be created.
      */
-    void run() throw (OSError);
+    void enableDispatching();
 
     /**
-     * Send the given telegram. It will be enqueued, and attempted to be sent.
+     * Get the file descriptor which becomes readable if there are events
+     * to dispatch.
      */
-    void send(Telegram* telegram);
+    int getEventFD() const;
+
+    /**
+     * Dispatch the events queued so far.
+     *
+     * @return whether the thread running the handler is still active, or
+     * there are events left.
+     */
+    bool dispatch();
+
+    /**
+     * Indicate that the thread running the handler has stopped. The thread
+     * calling dispatch() is woken up.
+     */
+    void stopDispatching();
+
+    /**
+     * Get the number of events dropped, because the event queue was full.
+     */
+    unsigned long getNumDroppedEvents() const;
+
+    /**
+     * Get the number of sendings aborted after winning the arbitration,
+     * because of an echo mismatch or timeout.
+     */
+    unsigned long getNumSendsAborted() const;
+
+    /**
+     * Get the number of times the echo of a symbol written has not arrived
+     * in time.
+     */
+    unsigned long getNumEchoTimeouts() const;
+
+    /**
+     * Get the number of times the master part of a telegram sent has been
+     * repeated, because the destination has responded with NACK.
+     */
+    unsigned long getNumRepetitions() const;
+
+    /**
+     * Get the number of times the slave has repeated its reply to a
+     * telegram sent, because its CRC was wrong.
+     */
+    unsigned long getNumReplyRepetitions() const;
+
+    /**
+     * Get the number of telegrams sent successfully thanks to a repetition.
+     */
+    unsigned long getNumRecoveredByRepetition() const;
+
+    /**
+     * Get the number of SYN symbols generated in the auto-SYN mode.
+     */
+    unsigned long getNumAutoSYNs() const;
+
+    /**
+     * Get the number of times we have started generating the SYN symbols.
+     */
+    unsigned long getNumAutoSYNTakeovers() const;
+
+    /**
+     * Get the number of times we have stopped generating the SYN symbols,
+     * because another SYN generator has appeared.
+     */
+    unsigned long getNumAutoSYNStandDowns() const;
+
+    /**
+     * Get the total of the times in nanoseconds between the last symbol
+     * received and the echo of the SYN symbol generated after it. It is
+     * measured for the SYN symbols generated except for the first one
+     * after each takeover.
+     */
+    unsigned long long getTotalAutoSYNSpacing() const;
+
+    /**
+     * Get the maximal time in nanoseconds between the last symbol received
+     * and the echo of the SYN symbol generated after it.
+     */
+    unsigned long long getMaxAutoSYNSpacing() const;
+
+    /**
+     * Get the value of the lock counter after winning the arbitration.
+     */
+    unsigned getLockCount() const;
+
+    /**
+     * Get the statistics of the responses to the queries to our slave
+     * address.
+     */
+    const Responder::Statistics& getResponderStatistics() const;
+
+    /**
+     * Get the statistics of the traffic schedule and of the collisions.
+     */
+    const TrafficSchedule::Statistics& getTrafficStatistics() const;
+
+    /**
+     * Get the statistics of the arbitrations in the given priority class.
+     */
+    const Arbitration::Statistics&
+    getArbitrationStatistics(unsigned priorityClass) const;
 
 protected:
     /**
@@ -76,32 +708,285 @@ protected:
      */
     virtual void signalChanged(bool hasSignal);
 
+    /**
+     * Called when the sending of the telegram with the given handle has
+     * finished with the given status, after the completion function of the
+     * telegram, if any. If the telegram has been sent successfully, the
+     * telegram passed is the one received, i.e. it contains the reply as
+     * well.
+     */
+    virtual void sendFinished(SendQueue::handle_t handle,
+                              const Telegram& telegram,
+                              SendQueue::status_t status);
+
 private:
     /**
-     * Read a telegram from the given source.
+     * Notify about the reception of the given telegram. If the events are
+     * dispatched, the telegram is moved into a free preallocated one which
+     * is queued. If there is none, the event is dropped, unless the
+     * dispatching is lossless.
+     */
+    void notifyReceived(Telegram& telegram);
+
+    /**
+     * Notify about the change of the signal status.
+     */
+    void notifySignalChanged(bool hasSignal);
+
+    /**
+     * Notify about the sending of the telegram of the given entry, which
+     * has been removed from the send queue, having finished with the given
+     * status. The telegram of the entry is deleted or passed on. The
+     * telegram given is the one to report, which may be the telegram of
+     * the entry or the one received. If the events are dispatched and it
+     * is the latter, it is moved into the telegram of the entry, which is
+     * queued.
+     */
+    void notifySendFinished(const SendQueue::Entry& entry,
+                            SendQueue::status_t status,
+                            Telegram& telegram);
+
+    /**
+     * Call the completion function of the telegram with the given handle,
+     * if any, and sendFinished().
+     */
+    void completeSending(SendQueue::handle_t handle,
+                         const Telegram& telegram,
+                         SendQueue::status_t status);
+
+    /**
+     * Push the given event into the event queue and signal the event file
+     * descriptor. If the queue is full, the event is dropped, unless the
+     * dispatching is lossless, in which case the dispatching thread is
+     * waited for.
+     *
+     * @return whether the event has been pushed.
+     */
+    bool pushEvent(const Event& event);
+
+    /**
+     * Push the given event reporting a finished sending into its queue and
+     * signal the event file descriptor. The queue cannot be full, as
+     * send() limits the number of telegrams pending.
+     */
+    void pushCompletion(const Event& event);
+
+    /**
+     * Signal the event file descriptor.
+     */
+    void signalEventFD();
+
+    /**
+     * Move the telegrams passed to send() while dispatching to the send
+     * queue, and process the cancellations passed to cancel() and the
+     * responses passed to setResponse().
+     */
+    void acceptSendRequests();
+
+    /**
+     * Remove the telegram with the given handle from the send queue, if it
+     * is there and not being sent.
+     */
+    void cancelSending(SendQueue::handle_t handle);
+
+    /**
+     * Remove the telegrams whose deadline has passed from the send queue.
+     */
+    void expireSendings();
+
+    /**
+     * Process the given status of the telegram parser, i.e. notify about
+     * the telegram completed, and log the errors.
+     */
+    void processStatus(TelegramParser::status_t status);
+
+    /**
+     * Parse the given symbols in bulk and process the resulting statuses.
+     */
+    void parseSymbols(const symbol_t* symbols,
+                      const unsigned long long* times, size_t length);
+
+    /**
+     * Parse the symbols already received, but not yet processed, in bulk,
+     * one SYN-delimited frame at a time.
+     *
+     * @param lastSymbol will be set to the last symbol parsed, if any.
+     *
+     * @return the number of SYN symbols among the symbols parsed.
+     */
+    unsigned parseReceived(symbol_t& lastSymbol);
+
+    /**
+     * Count a failed sending of the telegram with the given handle, and
+     * give it up if it has failed too many times.
+     */
+    void sendingFailed(SendQueue::handle_t handle);
+
+    /**
+     * Log the symbols of the telegram received so far.
+     */
+    void dumpSymbols();
+
+    /**
+     * Called when the bus has been opened.
+     */
+    virtual void busOpened() noexcept;
+
+    /**
+     * Called when symbols have been received while nothing is being
+     * written. They are processed until an action is started.
+     */
+    virtual void symbolsReceived() noexcept;
+
+    /**
+     * Called when no symbol has been received until the deadline.
+     */
+    virtual void timedOut() noexcept;
+
+    /**
+     * Called with the echo of the symbol written by the current action.
      */
-    void readTelegram(symbol_t source)
-        throw(SYNException, TimeoutException, OSError);
+    virtual void symbolWritten(const Result<symbol_t>& result) noexcept;
 
     /**
-     * Read the slave reply.
+     * Called with the result of writing the symbols of the current
+     * action.
      */
-    void readReply(Telegram& telegram)
-        throw(SYNException, TimeoutException, OSError);
+    virtual void symbolsWritten(const Result<bool>& result) noexcept;
 
     /**
-     * Read the slave reply and the corresponding master acknowledgement.
+     * Called with the result of the measurement of the write-to-echo round
+     * trip.
      */
-    void readReplyAndACK(Telegram& telegram)
-        throw(SYNException, TimeoutException, OSError);
+    virtual void roundTripMeasured(const Result<unsigned long long>& result)
+        noexcept;
 
     /**
-     * Try to send the first telegram in the queue.
+     * Called when the bus has failed. Unless the end of a replayed capture
+     * has been reached, the bus is opened again.
+     */
+    virtual void busFailed(const Error& error) noexcept;
+
+    /**
+     * Set the deadline of the bus handler for the current state, if no
+     * action is in progress.
+     */
+    void waitNext();
+
+    /**
+     * Indicate that the signal has been lost, so that it is waited for.
+     */
+    void loseSignal();
+
+    /**
+     * Indicate that the signal has been detected by the SYN symbol received
+     * last.
+     */
+    void signalDetected();
+
+    /**
+     * Process the given symbol received, and the rest of the symbols
+     * already received, unless the telegram being sent needs our
+     * attention. Then start sending, acknowledging or responding, if it is
+     * the time for that.
      *
-     * @return 0 on success, otherwise the number of SYN symbols to wait for
-     * trying to send again.
+     * @param generated indicates if the symbol is the echo of a SYN symbol
+     * generated.
      */
-    unsigned trySend() throw(SYNException, TimeoutException, OSError);
+    void processSymbol(symbol_t symbol, bool generated);
+
+    /**
+     * Called when writing a symbol or symbols has failed with the given
+     * error. A timeout is counted, and the signal is waited for again,
+     * other errors are handled by busFailed().
+     */
+    void echoFailed(const Error& error);
+
+    /**
+     * Adapt the echo timeout to the given write-to-echo round trip, and log
+     * whether sending is viable with it.
+     */
+    void adaptEchoTimeout(unsigned long long roundTrip);
+
+    /**
+     * Try to send the next telegram in the queue by writing its source
+     * address for the arbitration.
+     */
+    Error trySend() noexcept;
+
+    /**
+     * Called with the echo of our source address written for the
+     * arbitration. If the arbitration is won, the rest of the telegram is
+     * written. If it is lost, it is retried when the arbitration engine
+     * allows, unless the telegram is given up.
+     */
+    void arbitrated(const Result<symbol_t>& result);
+
+    /**
+     * Called when the rest of the master part of the telegram being sent
+     * has been written.
+     */
+    void sent(const Result<bool>& result);
+
+    /**
+     * Repeat the master part of the telegram being sent right away, because
+     * the destination has responded with NACK to it.
+     */
+    Error repeatSending() noexcept;
+
+    /**
+     * Called when the master part of the telegram being sent has been
+     * repeated.
+     */
+    void repeated(const Result<bool>& result);
+
+    /**
+     * Send the acknowledgement of the master for the slave reply to the
+     * telegram being sent.
+     */
+    Error sendMasterACK() noexcept;
+
+    /**
+     * Called when the acknowledgement of the master has been written.
+     */
+    void masterACKSent(const Result<symbol_t>& result);
+
+    /**
+     * Respond to the query addressed to our slave address, whose master
+     * part has just been received. If its CRC is wrong, NACK is sent,
+     * otherwise the response from the table, if any. If the master has
+     * responded with NACK to our response, it is repeated.
+     */
+    Error respond() noexcept;
+
+    /**
+     * Called when the response to the query has been written.
+     */
+    void responded(const Result<bool>& result);
+
+    /**
+     * Called with the echo of the first SYN symbol generated after the bus
+     * has been silent in the auto-SYN mode. If it is a SYN symbol, we
+     * start generating the SYN symbols, and the signal is detected.
+     */
+    void synStarted(const Result<symbol_t>& result);
+
+    /**
+     * Called with the echo of a SYN symbol generated while we are
+     * generating the SYN symbols. It is processed as any symbol received.
+     */
+    void synGenerated(const Result<symbol_t>& result);
+
+    /**
+     * Stop generating the SYN symbols, because another SYN generator has
+     * appeared.
+     */
+    void stopGeneratingSYN();
+
+    /**
+     * Write a SYN symbol to the bus.
+     */
+    Error generateSYN() noexcept;
 };
 
 //------------------------------------------------------------------------------
@@ -109,8 +994,208 @@ private:
 //------------------------------------------------------------------------------
 
 inline MessageHandler::MessageHandler(BusHandler& busHandler) :
-    busHandler(busHandler)
+    busHandler(busHandler),
+    sending(0),
+    arbitrating(0),
+    lastHandle(0),
+    eventFD(-1),
+    spareTelegram(0),
+    numSendsPending(0),
+    losslessDispatching(false),
+    lowPower(false),
+    autoSYN(false),
+    generatingSYN(false),
+    trafficScheduling(false),
+    roundTripPending(false),
+    roundTripRequested(false),
+    action(ACTION_CLOSED),
+    hasSignal(false),
+    numIdleTimeouts(0),
+    signalDeadline(0),
+    synPrecedingTime(0),
+    stopped(false),
+    numDroppedEvents(0),
+    numSendsAborted(0),
+    numEchoTimeouts(0),
+    numRepetitions(0),
+    numReplyRepetitions(0),
+    numRecoveredByRepetition(0),
+    numAutoSYNs(0),
+    numAutoSYNTakeovers(0),
+    numAutoSYNStandDowns(0),
+    totalAutoSYNSpacing(0),
+    maxAutoSYNSpacing(0)
+{
+    for(auto& telegram: telegrams) freeTelegrams.push(&telegram);
+    busHandler.setListener(this);
+}
+
+//------------------------------------------------------------------------------
+
+inline void MessageHandler::setLowPower(bool lowPower)
+{
+    this->lowPower = lowPower;
+}
+
+//------------------------------------------------------------------------------
+
+inline void MessageHandler::setLockCount(unsigned lockCount)
+{
+    arbitration.setLockCount(lockCount);
+}
+
+//------------------------------------------------------------------------------
+
+inline void MessageHandler::setAutoSYN(bool autoSYN)
+{
+    this->autoSYN = autoSYN;
+}
+
+//------------------------------------------------------------------------------
+
+inline void MessageHandler::setTrafficScheduling(bool trafficScheduling)
+{
+    this->trafficScheduling = trafficScheduling;
+}
+
+//------------------------------------------------------------------------------
+
+inline void MessageHandler::setSlaveAddress(symbol_t address)
+{
+    responder.setAddress(address);
+}
+
+//------------------------------------------------------------------------------
+
+inline symbol_t MessageHandler::getSlaveAddress() const
+{
+    return responder.getAddress();
+}
+
+//------------------------------------------------------------------------------
+
+inline void MessageHandler::setIdentification(symbol_t manufacturer,
+                                              const char* id,
+                                              uint16_t softwareVersion,
+                                              uint16_t hardwareVersion)
+{
+    responder.setIdentification(manufacturer, id,
+                                softwareVersion, hardwareVersion);
+}
+
+//------------------------------------------------------------------------------
+
+inline int MessageHandler::getEventFD() const
+{
+    return eventFD;
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumDroppedEvents() const
+{
+    return numDroppedEvents.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumSendsAborted() const
+{
+    return numSendsAborted.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumEchoTimeouts() const
+{
+    return numEchoTimeouts.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumRepetitions() const
+{
+    return numRepetitions.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumReplyRepetitions() const
+{
+    return numReplyRepetitions.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumRecoveredByRepetition() const
+{
+    return numRecoveredByRepetition.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumAutoSYNs() const
+{
+    return numAutoSYNs.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumAutoSYNTakeovers() const
+{
+    return numAutoSYNTakeovers.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long MessageHandler::getNumAutoSYNStandDowns() const
+{
+    return numAutoSYNStandDowns.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long long MessageHandler::getTotalAutoSYNSpacing() const
+{
+    return totalAutoSYNSpacing.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long long MessageHandler::getMaxAutoSYNSpacing() const
+{
+    return maxAutoSYNSpacing.load(std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned MessageHandler::getLockCount() const
+{
+    return arbitration.getLockCount();
+}
+
+//------------------------------------------------------------------------------
+
+inline const Arbitration::Statistics&
+MessageHandler::getArbitrationStatistics(unsigned priorityClass) const
+{
+    return arbitration.getStatistics(priorityClass);
+}
+
+//------------------------------------------------------------------------------
+
+inline const Responder::Statistics&
+MessageHandler::getResponderStatistics() const
+{
+    return responder.getStatistics();
+}
+
+//------------------------------------------------------------------------------
+
+inline const TrafficSchedule::Statistics&
+MessageHandler::getTrafficStatistics() const
 {
+    return trafficSchedule.getStatistics();
 }
 
 //------------------------------------------------------------------------------
@@ -36,7 +36,7 @@ string OSError::toString(int errorNumber, const std::string& prefix)
     if (errorStr==0) {
         snprintf(buf, sizeof(buf), "Unknown error: %d", errorNumber);
     } else if (errorStr!=buf) {
-        strncpy(buf, errorStr, sizeof(buf));
+        snprintf(buf, sizeof(buf), "%s", errorStr);
     }
 
     return prefix.empty() ? buf : (prefix + ": " + buf);
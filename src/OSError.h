@@ -34,7 +34,8 @@ public:
     /**
      * Get the string representation of the given error code.
      */
-    std::string toString(int errorNumber, const std::string& prefix = "");
+    static std::string toString(int errorNumber,
+                                const std::string& prefix = "");
 
 public:
     /**
@@ -0,0 +1,126 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "Reactor.h"
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+Reactor::Reactor() :
+    epollFD(epoll_create1(EPOLL_CLOEXEC)),
+    numRegistered(0),
+    numWaits(0),
+    stopped(false)
+{
+    if (epollFD<0) throw OSError("Reactor::Reactor: epoll_create1");
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+Reactor::~Reactor()
+{
+    ::close(epollFD);
+}
+
+//------------------------------------------------------------------------------
+
+Error Reactor::add(int fd, uint32_t events, Handler* handler) noexcept
+{
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFD, EPOLL_CTL_ADD, fd, &event)<0) {
+        return Error::os("Reactor::add: epoll_ctl");
+    }
+
+    if (static_cast<size_t>(fd)>=handlers.size()) {
+        handlers.resize(fd + 1, 0);
+    }
+    handlers[fd] = handler;
+    ++numRegistered;
+
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+Error Reactor::modify(int fd, uint32_t events) noexcept
+{
+    struct epoll_event event;
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(epollFD, EPOLL_CTL_MOD, fd, &event)<0) {
+        return Error::os("Reactor::modify: epoll_ctl");
+    }
+
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+void Reactor::remove(int fd) noexcept
+{
+    if (fd<0 || static_cast<size_t>(fd)>=handlers.size() || handlers[fd]==0) {
+        return;
+    }
+
+    epoll_ctl(epollFD, EPOLL_CTL_DEL, fd, 0);
+    handlers[fd] = 0;
+    --numRegistered;
+}
+
+//------------------------------------------------------------------------------
+
+Error Reactor::run() noexcept
+{
+    stopped = false;
+
+    struct epoll_event events[maxNumEvents];
+    while(numRegistered>0 && !stopped) {
+        ++numWaits;
+        int numEvents = epoll_wait(epollFD, events, maxNumEvents, -1);
+        if (numEvents<0) {
+            if (errno==EINTR) continue;
+            return Error::os("Reactor::run: epoll_wait");
+        }
+
+        // A handler may unregister any descriptor, so the handler of each
+        // one is looked up only when its turn comes
+        for(int i = 0; i<numEvents; ++i) {
+            int fd = events[i].data.fd;
+            auto handler = handlers[fd];
+            if (handler!=0) handler->handleEvents(fd, events[i].events);
+        }
+    }
+
+    return Error();
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,178 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef REACTOR_H
+#define REACTOR_H
+//------------------------------------------------------------------------------
+
+#include "Result.h"
+
+#include <vector>
+
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * An event loop over a single epoll instance. The file descriptors of
+ * several buses (their ports, timers, etc.) are registered with it, each
+ * with a handler, which is called when the descriptor is ready. This way
+ * any number of buses is driven by one thread, which sleeps in a single
+ * epoll_wait() while all of them are silent.
+ *
+ * The handlers should not block, as that would delay all the other
+ * descriptors.
+ */
+class Reactor
+{
+public:
+    /**
+     * The interface of the handlers of the file descriptors.
+     */
+    class Handler
+    {
+    public:
+        /**
+         * Called when the given file descriptor registered with the
+         * handler is ready with the given epoll events.
+         */
+        virtual void handleEvents(int fd, uint32_t events) noexcept = 0;
+
+    protected:
+        /**
+         * Destroy the handler.
+         */
+        ~Handler();
+    };
+
+private:
+    /**
+     * The maximal number of events returned by one epoll_wait() call.
+     */
+    static const int maxNumEvents = 16;
+
+    /**
+     * The epoll file descriptor.
+     */
+    int epollFD;
+
+    /**
+     * The handlers of the registered file descriptors indexed by the
+     * descriptors. The entries of the descriptors not registered are 0.
+     */
+    std::vector<Handler*> handlers;
+
+    /**
+     * The number of the file descriptors registered.
+     */
+    size_t numRegistered;
+
+    /**
+     * The number of epoll_wait() calls made so far.
+     */
+    unsigned long long numWaits;
+
+    /**
+     * Indicate if the loop should stop.
+     */
+    bool stopped;
+
+public:
+    /**
+     * Construct the reactor. It throws an OSError if the epoll file
+     * descriptor cannot be created.
+     */
+    Reactor();
+
+    /**
+     * The copy constructor is deleted.
+     */
+    Reactor(const Reactor&) = delete;
+
+    /**
+     * Destroy the reactor.
+     */
+    ~Reactor();
+
+    /**
+     * Register the given file descriptor to be watched for the given epoll
+     * events, and to be handled by the given handler.
+     */
+    Error add(int fd, uint32_t events, Handler* handler) noexcept;
+
+    /**
+     * Change the epoll events the given registered file descriptor is
+     * watched for.
+     */
+    Error modify(int fd, uint32_t events) noexcept;
+
+    /**
+     * Unregister the given file descriptor, if it is registered. It should
+     * be called before the descriptor is closed. The events of the
+     * descriptor already returned by epoll_wait() are not handled.
+     */
+    void remove(int fd) noexcept;
+
+    /**
+     * Handle the events of the registered file descriptors until there is
+     * none registered, or stop() is called.
+     */
+    Error run() noexcept;
+
+    /**
+     * Make run() return after handling the events already returned by
+     * epoll_wait(). It should be called by a handler.
+     */
+    void stop();
+
+    /**
+     * Get the number of epoll_wait() calls made so far.
+     */
+    unsigned long long getNumWaits() const;
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline Reactor::Handler::~Handler()
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline void Reactor::stop()
+{
+    stopped = true;
+}
+
+//------------------------------------------------------------------------------
+
+inline unsigned long long Reactor::getNumWaits() const
+{
+    return numWaits;
+}
+
+//------------------------------------------------------------------------------
+#endif // REACTOR_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,114 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "Responder.h"
+
+#include "BusHandler.h"
+#include "CRC.h"
+#include "Log.h"
+
+#include <cstring>
+
+//------------------------------------------------------------------------------
+
+Responder::Statistics::Statistics() :
+    numResponses(0),
+    numRepetitions(0),
+    numUnknown(0),
+    numNACKs(0),
+    totalLatency(0),
+    maxLatency(0)
+{
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+bool Responder::check(const Update& update)
+{
+    if (update.numDataSymbols>maxNumDataSymbols) {
+        Log::error("The response to %02x%02x has %zu data symbols, at most %zu are allowed",
+                   update.primaryCommand, update.secondaryCommand,
+                   update.numDataSymbols, maxNumDataSymbols);
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+bool Responder::setResponse(const Update& update)
+{
+    if (!check(update)) return false;
+
+    auto numDataSymbols = update.numDataSymbols;
+
+    Response& response = responses[key(update.primaryCommand,
+                                       update.secondaryCommand)];
+
+    response.symbols[0] = BusHandler::SYMBOL_ACK;
+    size_t length = 1;
+    length += BusHandler::escapeSymbol(response.symbols + length,
+                                       numDataSymbols);
+    for(size_t i = 0; i<numDataSymbols; ++i) {
+        length += BusHandler::escapeSymbol(response.symbols + length,
+                                           update.dataSymbols[i]);
+    }
+
+    // The CRC is computed over the escaped symbols after the ACK
+    auto crc = CRC::compute(response.symbols + 1, length - 1);
+    length += BusHandler::escapeSymbol(response.symbols + length, crc);
+
+    response.length = length;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+void Responder::setIdentification(symbol_t manufacturer, const char* id,
+                                  uint16_t softwareVersion,
+                                  uint16_t hardwareVersion)
+{
+    Update update;
+    update.primaryCommand = identificationPrimaryCommand;
+    update.secondaryCommand = identificationSecondaryCommand;
+    update.numDataSymbols = 10;
+
+    update.dataSymbols[0] = manufacturer;
+    size_t idLength = strlen(id);
+    for(size_t i = 0; i<5; ++i) {
+        update.dataSymbols[1 + i] = (i<idLength) ? id[i] : ' ';
+    }
+    update.dataSymbols[6] = softwareVersion>>8;
+    update.dataSymbols[7] = softwareVersion&0xff;
+    update.dataSymbols[8] = hardwareVersion>>8;
+    update.dataSymbols[9] = hardwareVersion&0xff;
+
+    setResponse(update);
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,293 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef RESPONDER_H
+#define RESPONDER_H
+//------------------------------------------------------------------------------
+
+#include <atomic>
+#include <unordered_map>
+
+#include <cstddef>
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * The table of the responses to the master-slave telegrams addressed to
+ * our slave address. The responses are kept escaped together with their
+ * CRC, so they can be written as they are right after the telegram has
+ * been received.
+ *
+ * The table is used by the thread running the message handler. The
+ * statistics may be read by other threads.
+ */
+class Responder
+{
+public:
+    /**
+     * Type for symbols.
+     */
+    typedef uint8_t symbol_t;
+
+    /**
+     * The maximal number of data symbols in a response.
+     */
+    static const size_t maxNumDataSymbols = 16;
+
+    /**
+     * The primary command of the identification query.
+     */
+    static const symbol_t identificationPrimaryCommand = 0x07;
+
+    /**
+     * The secondary command of the identification query.
+     */
+    static const symbol_t identificationSecondaryCommand = 0x04;
+
+    /**
+     * A response to be set, e.g. passed from another thread.
+     */
+    struct Update
+    {
+        /**
+         * The primary command of the queries to respond to.
+         */
+        symbol_t primaryCommand;
+
+        /**
+         * The secondary command of the queries to respond to.
+         */
+        symbol_t secondaryCommand;
+
+        /**
+         * The number of the data symbols of the response.
+         */
+        size_t numDataSymbols;
+
+        /**
+         * The data symbols of the response.
+         */
+        symbol_t dataSymbols[maxNumDataSymbols];
+    };
+
+    /**
+     * A response as it should be transmitted.
+     */
+    struct Response
+    {
+        /**
+         * The symbols of the response: the acknowledgement of the query
+         * followed by the escaped number of the data symbols, the data
+         * symbols and the CRC.
+         */
+        symbol_t symbols[1 + 2*(maxNumDataSymbols + 2)];
+
+        /**
+         * The number of the symbols, including the acknowledgement.
+         */
+        size_t length;
+    };
+
+    /**
+     * Statistics about the responses.
+     */
+    struct Statistics
+    {
+        /**
+         * The number of queries answered.
+         */
+        std::atomic<unsigned long> numResponses;
+
+        /**
+         * The number of times a response has been repeated, because the
+         * master has responded with NACK to it.
+         */
+        std::atomic<unsigned long> numRepetitions;
+
+        /**
+         * The number of queries not answered, because there is no response
+         * for their commands.
+         */
+        std::atomic<unsigned long> numUnknown;
+
+        /**
+         * The number of queries responded to with NACK, because their CRC
+         * was wrong.
+         */
+        std::atomic<unsigned long> numNACKs;
+
+        /**
+         * The total time in nanoseconds from receiving the last symbol of
+         * the queries until starting to write the responses.
+         */
+        std::atomic<unsigned long long> totalLatency;
+
+        /**
+         * The maximal time in nanoseconds from receiving the last symbol
+         * of a query until starting to write the response.
+         */
+        std::atomic<unsigned long long> maxLatency;
+
+        /**
+         * Construct the statistics with all counters being 0.
+         */
+        Statistics();
+    };
+
+private:
+    /**
+     * Get the key of the response to the given commands.
+     */
+    static unsigned key(symbol_t primaryCommand, symbol_t secondaryCommand);
+
+    /**
+     * Our slave address, or 0 if responding is disabled.
+     */
+    symbol_t address;
+
+    /**
+     * The responses by their key.
+     */
+    std::unordered_map<unsigned, Response> responses;
+
+    /**
+     * The statistics.
+     */
+    Statistics statistics;
+
+public:
+    /**
+     * Construct the responder. Responding is disabled.
+     */
+    Responder();
+
+    /**
+     * Set our slave address, or 0 to disable responding.
+     */
+    void setAddress(symbol_t address);
+
+    /**
+     * Get our slave address, or 0 if responding is disabled.
+     */
+    symbol_t getAddress() const;
+
+    /**
+     * Check if the given update is valid, i.e. its data fits into a
+     * response. If not, an error is logged.
+     */
+    static bool check(const Update& update);
+
+    /**
+     * Set the response given. If the update is not valid, it is rejected,
+     * and the previous response, if any, is kept.
+     *
+     * @return whether the response has been set.
+     */
+    bool setResponse(const Update& update);
+
+    /**
+     * Set the response to the identification query from the given data.
+     * The ID is padded with spaces or truncated to 5 characters, and the
+     * versions are in BCD format.
+     */
+    void setIdentification(symbol_t manufacturer, const char* id,
+                           uint16_t softwareVersion,
+                           uint16_t hardwareVersion);
+
+    /**
+     * Get the response to the given commands.
+     *
+     * @return the response, or 0 if there is none.
+     */
+    const Response* find(symbol_t primaryCommand,
+                         symbol_t secondaryCommand) const;
+
+    /**
+     * Get the statistics.
+     */
+    Statistics& getStatistics();
+
+    /**
+     * Get the statistics.
+     */
+    const Statistics& getStatistics() const;
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline unsigned Responder::key(symbol_t primaryCommand,
+                               symbol_t secondaryCommand)
+{
+    return (primaryCommand<<8) | secondaryCommand;
+}
+
+//------------------------------------------------------------------------------
+
+inline Responder::Responder() :
+    address(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline void Responder::setAddress(symbol_t address)
+{
+    this->address = address;
+}
+
+//------------------------------------------------------------------------------
+
+inline Responder::symbol_t Responder::getAddress() const
+{
+    return address;
+}
+
+//------------------------------------------------------------------------------
+
+inline const Responder::Response*
+Responder::find(symbol_t primaryCommand, symbol_t secondaryCommand) const
+{
+    auto i = responses.find(key(primaryCommand, secondaryCommand));
+    return (i==responses.end()) ? 0 : &i->second;
+}
+
+//------------------------------------------------------------------------------
+
+inline Responder::Statistics& Responder::getStatistics()
+{
+    return statistics;
+}
+
+//------------------------------------------------------------------------------
+
+inline const Responder::Statistics& Responder::getStatistics() const
+{
+    return statistics;
+}
+
+//------------------------------------------------------------------------------
+#endif // RESPONDER_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,313 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef RESULT_H
+#define RESULT_H
+//------------------------------------------------------------------------------
+
+#include "OSError.h"
+#include "EOFException.h"
+
+#include <string>
+
+#include <cerrno>
+
+//------------------------------------------------------------------------------
+
+/**
+ * An error reported by the I/O and symbol layer instead of throwing an
+ * exception. It is cheap to copy and it does not allocate any memory.
+ */
+class [[nodiscard]] Error
+{
+public:
+    /**
+     * The kinds of errors.
+     */
+    typedef enum {
+        // No error has occured
+        NONE,
+
+        // A timeout has occured
+        TIMEOUT,
+
+        // The end of a replayed capture has been reached
+        END_OF_FILE,
+
+        // An operating system call has failed
+        OS
+    } kind_t;
+
+    /**
+     * Get an error for a timeout.
+     */
+    static Error timeout() noexcept;
+
+    /**
+     * Get an error for the end of a replayed capture.
+     */
+    static Error endOfFile() noexcept;
+
+    /**
+     * Get an error for an operating system call that has failed. The
+     * context is a string literal describing the call, the error number is
+     * the current errno, if it is negative.
+     */
+    static Error os(const char* context, int errorNumber = -1) noexcept;
+
+private:
+    /**
+     * The kind of the error.
+     */
+    kind_t kind;
+
+    /**
+     * The context of the error for OS errors.
+     */
+    const char* context;
+
+    /**
+     * The error number for OS errors.
+     */
+    int errorNumber;
+
+public:
+    /**
+     * Construct the object indicating no error.
+     */
+    Error() noexcept;
+
+private:
+    /**
+     * Construct the error.
+     */
+    Error(kind_t kind, const char* context, int errorNumber) noexcept;
+
+public:
+    /**
+     * Determine if there is no error.
+     */
+    bool isOK() const noexcept;
+
+    /**
+     * Get the kind of the error.
+     */
+    kind_t getKind() const noexcept;
+
+    /**
+     * Get the string representation of the error, like the message of the
+     * exception raise() would throw.
+     */
+    std::string toString() const;
+
+    /**
+     * Throw the exception corresponding to the error: an OSError for OS
+     * errors and an EOFException for the end of a replayed capture. It is
+     * meant to be used at the top level of the program, where errors are
+     * handled by reconnecting to the bus. Nothing is thrown, if there is
+     * no error.
+     */
+    void raise() const;
+};
+
+//------------------------------------------------------------------------------
+
+/**
+ * The result of an operation of the I/O and symbol layer: either a value
+ * or an error.
+ *
+ * @param T the type of the value. It should be cheap to copy.
+ */
+template <typename T>
+class [[nodiscard]] Result
+{
+private:
+    /**
+     * The value, if there is no error.
+     */
+    T value;
+
+    /**
+     * The error.
+     */
+    Error error;
+
+public:
+    /**
+     * Construct the result with the given value.
+     */
+    Result(T value) noexcept;
+
+    /**
+     * Construct the result with the given error.
+     */
+    Result(Error error) noexcept;
+
+    /**
+     * Determine if there is no error.
+     */
+    bool isOK() const noexcept;
+
+    /**
+     * Get the value. It is meaningful only if there is no error.
+     */
+    T getValue() const noexcept;
+
+    /**
+     * Get the error.
+     */
+    const Error& getError() const noexcept;
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline Error Error::timeout() noexcept
+{
+    return Error(TIMEOUT, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+
+inline Error Error::endOfFile() noexcept
+{
+    return Error(END_OF_FILE, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+
+inline Error Error::os(const char* context, int errorNumber) noexcept
+{
+    return Error(OS, context, (errorNumber<0) ? errno : errorNumber);
+}
+
+//------------------------------------------------------------------------------
+
+inline Error::Error() noexcept :
+    kind(NONE),
+    context(0),
+    errorNumber(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline Error::Error(kind_t kind, const char* context, int errorNumber)
+    noexcept :
+    kind(kind),
+    context(context),
+    errorNumber(errorNumber)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline bool Error::isOK() const noexcept
+{
+    return kind==NONE;
+}
+
+//------------------------------------------------------------------------------
+
+inline Error::kind_t Error::getKind() const noexcept
+{
+    return kind;
+}
+
+//------------------------------------------------------------------------------
+
+inline std::string Error::toString() const
+{
+    switch(kind) {
+      case TIMEOUT:
+        return OSError::toString(ETIMEDOUT, "timeout");
+      case END_OF_FILE:
+        return "end of file";
+      case OS:
+        return OSError::toString(errorNumber, context);
+      default:
+        return "no error";
+    }
+}
+
+//------------------------------------------------------------------------------
+
+inline void Error::raise() const
+{
+    switch(kind) {
+      case TIMEOUT:
+        throw OSError("timeout", ETIMEDOUT);
+      case END_OF_FILE:
+        throw EOFException();
+      case OS:
+        throw OSError(context, errorNumber);
+      default:
+        break;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline Result<T>::Result(T value) noexcept :
+    value(value)
+{
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline Result<T>::Result(Error error) noexcept :
+    value(),
+    error(error)
+{
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline bool Result<T>::isOK() const noexcept
+{
+    return error.isOK();
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline T Result<T>::getValue() const noexcept
+{
+    return value;
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline const Error& Result<T>::getError() const noexcept
+{
+    return error;
+}
+
+//------------------------------------------------------------------------------
+#endif // RESULT_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,126 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+//------------------------------------------------------------------------------
+
+#include <atomic>
+
+#include <cstddef>
+
+//------------------------------------------------------------------------------
+
+/**
+ * A lock-free queue of a fixed size with a single producer and a single
+ * consumer thread.
+ *
+ * @param T the type of the items. It should be cheap to copy.
+ * @param size the capacity of the queue. It must be a power of 2.
+ */
+template <typename T, size_t size>
+class SPSCQueue
+{
+    static_assert((size&(size-1))==0, "the size must be a power of 2");
+
+private:
+    /**
+     * The items.
+     */
+    T items[size];
+
+    /**
+     * The index of the next item to pop. Only the consumer modifies it.
+     */
+    std::atomic<size_t> head;
+
+    /**
+     * The index of the next item to push. Only the producer modifies it.
+     */
+    std::atomic<size_t> tail;
+
+public:
+    /**
+     * Construct an empty queue.
+     */
+    SPSCQueue();
+
+    /**
+     * Push the given item. It should be called only by the producer.
+     *
+     * @return whether the item could be pushed, i.e. the queue was not
+     * full.
+     */
+    bool push(const T& item);
+
+    /**
+     * Pop the next item. It should be called only by the consumer.
+     *
+     * @return whether an item could be popped, i.e. the queue was not
+     * empty.
+     */
+    bool pop(T& item);
+};
+
+//------------------------------------------------------------------------------
+// Template definitions
+//------------------------------------------------------------------------------
+
+template <typename T, size_t size>
+inline SPSCQueue<T, size>::SPSCQueue() :
+    head(0),
+    tail(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T, size_t size>
+inline bool SPSCQueue<T, size>::push(const T& item)
+{
+    auto t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) >= size) return false;
+
+    items[t & (size-1)] = item;
+    tail.store(t + 1, std::memory_order_release);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T, size_t size>
+inline bool SPSCQueue<T, size>::pop(T& item)
+{
+    auto h = head.load(std::memory_order_relaxed);
+    if (h==tail.load(std::memory_order_acquire)) return false;
+
+    item = items[h & (size-1)];
+    head.store(h + 1, std::memory_order_release);
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+#endif // SPSCQUEUE_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
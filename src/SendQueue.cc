@@ -0,0 +1,193 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "SendQueue.h"
+
+#include "Telegram.h"
+
+#include <algorithm>
+
+//------------------------------------------------------------------------------
+
+const char* SendQueue::status2String(status_t status)
+{
+    switch(status) {
+      case STATUS_SENT: return "sent";
+      case STATUS_FAILED: return "failed";
+      case STATUS_GIVEN_UP: return "given up";
+      case STATUS_EXPIRED: return "expired";
+      case STATUS_CANCELLED: return "cancelled";
+      default: return "<unknown>";
+    }
+}
+
+//------------------------------------------------------------------------------
+
+bool SendQueue::isBefore(const Entry& entry, const Entry& other)
+{
+    if (entry.priority!=other.priority) {
+        return entry.priority<other.priority;
+    }
+    if (entry.numFailures!=other.numFailures) {
+        return entry.numFailures<other.numFailures;
+    }
+    if (entry.deadline!=other.deadline) {
+        // Entries without a deadline come last
+        return other.deadline==0 ||
+            (entry.deadline!=0 && entry.deadline<other.deadline);
+    }
+    return entry.handle<other.handle;
+}
+
+//------------------------------------------------------------------------------
+
+SendQueue::~SendQueue()
+{
+    for(auto destination: destinations) {
+        for(auto& entry: subQueues[destination]) {
+            delete entry.telegram;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void SendQueue::push(const Entry& entry)
+{
+    auto& subQueue = subQueues[entry.telegram->destination];
+    if (subQueue.empty()) {
+        destinations.push_back(entry.telegram->destination);
+    }
+
+    subQueue.insert(std::upper_bound(subQueue.begin(), subQueue.end(),
+                                     entry, &isBefore),
+                    entry);
+    ++numEntries;
+
+    if (entry.deadline!=0 &&
+        (earliestDeadline==0 || entry.deadline<earliestDeadline))
+    {
+        earliestDeadline = entry.deadline;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+const SendQueue::Entry* SendQueue::next() const
+{
+    const Entry* next = 0;
+    for(auto destination: destinations) {
+        const Entry& entry = subQueues[destination].front();
+        if (next==0 || isBefore(entry, *next)) next = &entry;
+    }
+    return next;
+}
+
+//------------------------------------------------------------------------------
+
+const SendQueue::Entry* SendQueue::find(handle_t handle) const
+{
+    for(auto destination: destinations) {
+        for(auto& entry: subQueues[destination]) {
+            if (entry.handle==handle) return &entry;
+        }
+    }
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+bool SendQueue::take(handle_t handle, Entry& entry)
+{
+    for(auto destination: destinations) {
+        auto& subQueue = subQueues[destination];
+        for(size_t i = 0; i<subQueue.size(); ++i) {
+            if (subQueue[i].handle==handle) {
+                remove(destination, i, entry);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+unsigned SendQueue::failed(handle_t handle)
+{
+    Entry entry;
+    if (!take(handle, entry)) return 0;
+
+    ++entry.numFailures;
+    push(entry);
+
+    return entry.numFailures;
+}
+
+//------------------------------------------------------------------------------
+
+bool SendQueue::takeExpired(unsigned long long now, Entry& entry)
+{
+    if (earliestDeadline==0 || now<earliestDeadline) return false;
+
+    // The earliest deadline is recomputed from the entries remaining
+    earliestDeadline = 0;
+    for(auto destination: destinations) {
+        auto& subQueue = subQueues[destination];
+        for(size_t i = 0; i<subQueue.size(); ++i) {
+            auto deadline = subQueue[i].deadline;
+            if (deadline==0) continue;
+            if (deadline<=now) {
+                remove(destination, i, entry);
+                // Further expired entries will be found by the next call
+                earliestDeadline = now;
+                return true;
+            }
+            if (earliestDeadline==0 || deadline<earliestDeadline) {
+                earliestDeadline = deadline;
+            }
+        }
+    }
+
+    return false;
+}
+
+//------------------------------------------------------------------------------
+
+void SendQueue::remove(uint8_t destination, size_t index, Entry& entry)
+{
+    auto& subQueue = subQueues[destination];
+    entry = subQueue[index];
+    subQueue.erase(subQueue.begin() + index);
+    --numEntries;
+
+    if (subQueue.empty()) {
+        destinations.erase(std::find(destinations.begin(),
+                                     destinations.end(), destination));
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,269 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef SENDQUEUE_H
+#define SENDQUEUE_H
+//------------------------------------------------------------------------------
+
+#include <vector>
+
+#include <cstddef>
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+class Telegram;
+
+//------------------------------------------------------------------------------
+
+/**
+ * The queue of the telegrams to send. The telegrams are kept in separate
+ * sub-queues for each destination address, so that a destination not
+ * accepting our telegrams does not block the telegrams to the others. The
+ * next telegram to send is chosen among the first ones of the sub-queues
+ * by their priority, their number of failures, their deadline and the
+ * order of their enqueueing, in this order.
+ *
+ * The queue owns the telegrams in it.
+ */
+class SendQueue
+{
+public:
+    /**
+     * Type for the handles identifying the telegrams enqueued. The value
+     * 0 is not a valid handle.
+     */
+    typedef unsigned long long handle_t;
+
+    /**
+     * The priorities of the telegrams.
+     */
+    typedef enum {
+        // High priority, e.g. a command issued by the user
+        PRIORITY_HIGH,
+
+        // Normal priority
+        PRIORITY_NORMAL,
+
+        // Low priority, e.g. periodic polling
+        PRIORITY_LOW
+    } priority_t;
+
+    /**
+     * The status of a telegram whose sending has finished.
+     */
+    typedef enum {
+        // The telegram has been sent successfully
+        STATUS_SENT,
+
+        // The telegram has been sent, but it has not been acknowledged or
+        // its reply was invalid too many times
+        STATUS_FAILED,
+
+        // The arbitration has been lost too many times
+        STATUS_GIVEN_UP,
+
+        // The deadline of the telegram has passed before it could be sent
+        STATUS_EXPIRED,
+
+        // The sending of the telegram has been cancelled
+        STATUS_CANCELLED
+    } status_t;
+
+    /**
+     * The number of times a telegram may be sent unsuccessfully before it
+     * is given up.
+     */
+    static const unsigned maxNumFailures = 3;
+
+    /**
+     * An entry of the queue.
+     */
+    struct Entry
+    {
+        /**
+         * The handle of the telegram.
+         */
+        handle_t handle;
+
+        /**
+         * The telegram.
+         */
+        Telegram* telegram;
+
+        /**
+         * The priority of the telegram.
+         */
+        priority_t priority;
+
+        /**
+         * The monotonic time in nanoseconds after which the telegram should
+         * not be sent anymore, or 0 if it has no deadline.
+         */
+        unsigned long long deadline;
+
+        /**
+         * The number of times the telegram has been sent unsuccessfully.
+         */
+        unsigned numFailures;
+    };
+
+    /**
+     * Get a string representation of the given status.
+     */
+    static const char* status2String(status_t status);
+
+private:
+    /**
+     * Determine if the given entry should be sent before the other one.
+     */
+    static bool isBefore(const Entry& entry, const Entry& other);
+
+    /**
+     * The sub-queues for each destination address, ordered by isBefore().
+     */
+    std::vector<Entry> subQueues[256];
+
+    /**
+     * The destination addresses whose sub-queue is not empty.
+     */
+    std::vector<uint8_t> destinations;
+
+    /**
+     * The number of the entries.
+     */
+    size_t numEntries;
+
+    /**
+     * A lower bound of the earliest deadline among the entries, or 0 if
+     * none of them has a deadline.
+     */
+    unsigned long long earliestDeadline;
+
+public:
+    /**
+     * Construct an empty queue.
+     */
+    SendQueue();
+
+    /**
+     * The copy constructor is deleted.
+     */
+    SendQueue(const SendQueue&) = delete;
+
+    /**
+     * Destroy the queue and the telegrams in it.
+     */
+    ~SendQueue();
+
+    /**
+     * Determine if the queue is empty.
+     */
+    bool empty() const;
+
+    /**
+     * Get the number of the telegrams in the queue.
+     */
+    size_t size() const;
+
+    /**
+     * Add the given entry to the queue.
+     */
+    void push(const Entry& entry);
+
+    /**
+     * Get the entry of the telegram to send next.
+     *
+     * @return the entry, or 0 if the queue is empty. It remains valid until
+     * the queue is modified.
+     */
+    const Entry* next() const;
+
+    /**
+     * Get the entry with the given handle.
+     *
+     * @return the entry, or 0 if it is not in the queue. It remains valid
+     * until the queue is modified.
+     */
+    const Entry* find(handle_t handle) const;
+
+    /**
+     * Remove the entry with the given handle from the queue.
+     *
+     * @return whether the entry has been found.
+     */
+    bool take(handle_t handle, Entry& entry);
+
+    /**
+     * Indicate that the telegram with the given handle has been sent
+     * unsuccessfully. Its number of failures is incremented, and it is
+     * moved behind the other telegrams of the same priority.
+     *
+     * @return the number of failures of the telegram, or 0 if it is not
+     * in the queue.
+     */
+    unsigned failed(handle_t handle);
+
+    /**
+     * Remove an entry whose deadline has passed by the given monotonic time
+     * in nanoseconds.
+     *
+     * @return whether such an entry has been found.
+     */
+    bool takeExpired(unsigned long long now, Entry& entry);
+
+private:
+    /**
+     * Remove the entry at the given index from the sub-queue of the given
+     * destination.
+     */
+    void remove(uint8_t destination, size_t index, Entry& entry);
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline SendQueue::SendQueue() :
+    numEntries(0),
+    earliestDeadline(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline bool SendQueue::empty() const
+{
+    return numEntries==0;
+}
+
+//------------------------------------------------------------------------------
+
+inline size_t SendQueue::size() const
+{
+    return numEntries;
+}
+
+//------------------------------------------------------------------------------
+#endif // SENDQUEUE_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,459 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "SymbolScanner.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define SYMBOLSCANNER_VECTORIZED 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define SYMBOLSCANNER_VECTORIZED 1
+#else
+#define SYMBOLSCANNER_VECTORIZED 0
+#endif
+
+//------------------------------------------------------------------------------
+
+typedef SymbolScanner::symbol_t symbol_t;
+
+//------------------------------------------------------------------------------
+
+#if SYMBOLSCANNER_VECTORIZED
+
+/**
+ * The number of symbols processed at once.
+ */
+static const size_t blockSize = 16;
+
+#if defined(__SSE2__)
+
+/**
+ * The number of bits per symbol in a match mask.
+ */
+static const unsigned bitsPerSymbol = 1;
+
+/**
+ * The match mask of a block in which all symbols match.
+ */
+static const uint64_t allMatch = 0xffff;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Load a block of symbols.
+ */
+static inline __m128i loadBlock(const symbol_t* symbols)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(symbols));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the mask of the symbols in the given block of the buffer that are
+ * equal to the given symbol.
+ */
+static inline uint64_t matchMask(const symbol_t* symbols, symbol_t symbol)
+{
+    auto matches = _mm_cmpeq_epi8(loadBlock(symbols),
+                                  _mm_set1_epi8(static_cast<char>(symbol)));
+    return static_cast<unsigned>(_mm_movemask_epi8(matches));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the mask of the symbols in the given block of the buffer that are
+ * equal to either of the given symbols.
+ */
+static inline uint64_t matchMask(const symbol_t* symbols,
+                                 symbol_t symbol1, symbol_t symbol2)
+{
+    auto block = loadBlock(symbols);
+    auto matches =
+        _mm_or_si128(_mm_cmpeq_epi8(block,
+                                    _mm_set1_epi8(static_cast<char>(symbol1))),
+                     _mm_cmpeq_epi8(block,
+                                    _mm_set1_epi8(static_cast<char>(symbol2))));
+    return static_cast<unsigned>(_mm_movemask_epi8(matches));
+}
+
+#else // __ARM_NEON
+
+/**
+ * The number of bits per symbol in a match mask.
+ */
+static const unsigned bitsPerSymbol = 4;
+
+/**
+ * The match mask of a block in which all symbols match.
+ */
+static const uint64_t allMatch = ~0ULL;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Convert the given result of a comparison to a match mask. NEON has no
+ * equivalent of movemask, but narrowing each 16-bit lane by 4 bits leaves
+ * 4 bits for each symbol.
+ */
+static inline uint64_t toMask(uint8x16_t matches)
+{
+    auto narrowed = vshrn_n_u16(vreinterpretq_u16_u8(matches), 4);
+    return vget_lane_u64(vreinterpret_u64_u8(narrowed), 0);
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the mask of the symbols in the given block of the buffer that are
+ * equal to the given symbol.
+ */
+static inline uint64_t matchMask(const symbol_t* symbols, symbol_t symbol)
+{
+    return toMask(vceqq_u8(vld1q_u8(symbols), vdupq_n_u8(symbol)));
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the mask of the symbols in the given block of the buffer that are
+ * equal to either of the given symbols.
+ */
+static inline uint64_t matchMask(const symbol_t* symbols,
+                                 symbol_t symbol1, symbol_t symbol2)
+{
+    auto block = vld1q_u8(symbols);
+    return toMask(vorrq_u8(vceqq_u8(block, vdupq_n_u8(symbol1)),
+                           vceqq_u8(block, vdupq_n_u8(symbol2))));
+}
+
+#endif // __ARM_NEON
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the offset of the first matching symbol in the given non-zero mask.
+ */
+static inline size_t firstMatch(uint64_t mask)
+{
+    return __builtin_ctzll(mask) / bitsPerSymbol;
+}
+
+#endif // SYMBOLSCANNER_VECTORIZED
+
+//------------------------------------------------------------------------------
+
+/**
+ * The SYN symbol of the eBUS, used as the delimiter by the check.
+ */
+static const symbol_t checkSYN = 0xaa;
+
+/**
+ * The escape symbol of the eBUS, used by the check.
+ */
+static const symbol_t checkEscape = 0xa9;
+
+/**
+ * The length of the longest buffer checked: two blocks of 16 symbols and
+ * a remainder.
+ */
+static const size_t checkLength = 40;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Find the first occurence of either of the given symbols one by one, as
+ * a reference for the check.
+ */
+static size_t referenceFind(const symbol_t* symbols, size_t length,
+                            symbol_t symbol1, symbol_t symbol2)
+{
+    size_t offset = 0;
+    while(offset<length && symbols[offset]!=symbol1 &&
+          symbols[offset]!=symbol2)
+    {
+        ++offset;
+    }
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Find the first symbol differing from the given one one by one, as a
+ * reference for the check.
+ */
+static size_t referenceFindOther(const symbol_t* symbols, size_t length,
+                                 symbol_t symbol)
+{
+    size_t offset = 0;
+    while(offset<length && symbols[offset]==symbol) ++offset;
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Unescape the given buffer symbol by symbol, as a reference for the check.
+ */
+static size_t referenceUnescape(const symbol_t* symbols, size_t length,
+                                symbol_t* unescaped, size_t maxLength,
+                                symbol_t delimiter, symbol_t escape,
+                                size_t& numConsumed)
+{
+    size_t offset = 0;
+    size_t numUnescaped = 0;
+    while(offset<length && numUnescaped<maxLength) {
+        auto symbol = symbols[offset];
+        if (symbol==delimiter) {
+            break;
+        } else if (symbol==escape) {
+            if (offset + 1>=length || symbols[offset + 1]>1) break;
+            unescaped[numUnescaped++] = escape + symbols[offset + 1];
+            offset += 2;
+        } else {
+            unescaped[numUnescaped++] = symbol;
+            ++offset;
+        }
+    }
+
+    numConsumed = offset;
+    return numUnescaped;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Check the kernels against the references on the given buffer.
+ */
+static bool checkBuffer(const symbol_t* symbols, size_t length)
+{
+    for(auto symbol: {checkSYN, checkEscape, symbol_t(0x00), symbol_t(0x01)})
+    {
+        if (SymbolScanner::find(symbols, length, symbol)!=
+            referenceFind(symbols, length, symbol, symbol) ||
+            SymbolScanner::findOther(symbols, length, symbol)!=
+            referenceFindOther(symbols, length, symbol))
+        {
+            return false;
+        }
+    }
+
+    if (SymbolScanner::find(symbols, length, checkSYN, checkEscape)!=
+        referenceFind(symbols, length, checkSYN, checkEscape))
+    {
+        return false;
+    }
+
+    for(size_t maxLength: {length, length/2}) {
+        symbol_t unescaped[checkLength];
+        symbol_t expected[checkLength];
+        size_t numConsumed = 0;
+        size_t expectedNumConsumed = 0;
+        auto numUnescaped =
+            SymbolScanner::unescape(symbols, length, unescaped, maxLength,
+                                    checkSYN, checkEscape, numConsumed);
+        auto expectedNumUnescaped =
+            referenceUnescape(symbols, length, expected, maxLength,
+                              checkSYN, checkEscape, expectedNumConsumed);
+        if (numUnescaped!=expectedNumUnescaped ||
+            numConsumed!=expectedNumConsumed ||
+            memcmp(unescaped, expected, numUnescaped)!=0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+bool SymbolScanner::isVectorized()
+{
+    return SYMBOLSCANNER_VECTORIZED;
+}
+
+//------------------------------------------------------------------------------
+
+size_t SymbolScanner::find(const symbol_t* symbols, size_t length,
+                           symbol_t symbol)
+{
+    size_t offset = 0;
+#if SYMBOLSCANNER_VECTORIZED
+    for(; offset + blockSize<=length; offset += blockSize) {
+        auto mask = matchMask(symbols + offset, symbol);
+        if (mask!=0) return offset + firstMatch(mask);
+    }
+#endif
+    while(offset<length && symbols[offset]!=symbol) ++offset;
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+size_t SymbolScanner::find(const symbol_t* symbols, size_t length,
+                           symbol_t symbol1, symbol_t symbol2)
+{
+    size_t offset = 0;
+#if SYMBOLSCANNER_VECTORIZED
+    for(; offset + blockSize<=length; offset += blockSize) {
+        auto mask = matchMask(symbols + offset, symbol1, symbol2);
+        if (mask!=0) return offset + firstMatch(mask);
+    }
+#endif
+    while(offset<length && symbols[offset]!=symbol1 &&
+          symbols[offset]!=symbol2)
+    {
+        ++offset;
+    }
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+size_t SymbolScanner::findOther(const symbol_t* symbols, size_t length,
+                                symbol_t symbol)
+{
+    size_t offset = 0;
+#if SYMBOLSCANNER_VECTORIZED
+    for(; offset + blockSize<=length; offset += blockSize) {
+        auto mask = matchMask(symbols + offset, symbol) ^ allMatch;
+        if (mask!=0) return offset + firstMatch(mask);
+    }
+#endif
+    while(offset<length && symbols[offset]==symbol) ++offset;
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+size_t SymbolScanner::unescape(const symbol_t* symbols, size_t length,
+                               symbol_t* unescaped, size_t maxLength,
+                               symbol_t delimiter, symbol_t escape,
+                               size_t& numConsumed)
+{
+    size_t offset = 0;
+    size_t numUnescaped = 0;
+    while(offset<length && numUnescaped<maxLength) {
+        auto runLength = find(symbols + offset,
+                              std::min(length - offset,
+                                       maxLength - numUnescaped),
+                              delimiter, escape);
+        memcpy(unescaped + numUnescaped, symbols + offset, runLength);
+        offset += runLength;
+        numUnescaped += runLength;
+
+        if (offset + 1>=length || numUnescaped>=maxLength ||
+            symbols[offset]!=escape || symbols[offset + 1]>1)
+        {
+            break;
+        }
+
+        unescaped[numUnescaped++] = escape + symbols[offset + 1];
+        offset += 2;
+    }
+
+    numConsumed = offset;
+    return numUnescaped;
+}
+
+//------------------------------------------------------------------------------
+
+bool SymbolScanner::check()
+{
+    static const symbol_t specials[] =
+        { checkSYN, checkEscape, 0x00, 0x01 };
+
+    symbol_t symbols[checkLength];
+
+    // The special symbols are put into ordinary data and into runs of
+    // each of them, e.g. SYNs of an idle bus. The symbols after the end of
+    // the shorter buffers must not be looked at, even if they would
+    // complete an escape sequence.
+    for(size_t background = 0; background<=4; ++background) {
+        for(size_t i = 0; i<checkLength; ++i) {
+            symbols[i] = (background==0) ?
+                (0x20 + i%16) : specials[background - 1];
+        }
+
+        for(size_t length = 0; length<=checkLength; ++length) {
+            if (!checkBuffer(symbols, length)) return false;
+
+            for(size_t offset = 0; offset<length; ++offset) {
+                auto original = symbols[offset];
+                for(auto special: specials) {
+                    symbols[offset] = special;
+                    if (!checkBuffer(symbols, length)) return false;
+                }
+                symbols[offset] = original;
+            }
+        }
+
+        for(size_t offset1 = 0; offset1<checkLength; ++offset1) {
+            auto original1 = symbols[offset1];
+            for(size_t offset2 = offset1 + 1; offset2<checkLength; ++offset2) {
+                auto original2 = symbols[offset2];
+                for(auto special1: specials) {
+                    symbols[offset1] = special1;
+                    for(auto special2: specials) {
+                        symbols[offset2] = special2;
+                        if (!checkBuffer(symbols, checkLength)) return false;
+                    }
+                }
+                symbols[offset2] = original2;
+            }
+            symbols[offset1] = original1;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+bool SymbolScanner::Frames::next(size_t& frameOffset, size_t& frameLength)
+{
+    auto delimiterOffset = offset +
+        find(symbols + offset, length - offset, delimiter);
+    if (delimiterOffset>=length) return false;
+
+    frameOffset = offset;
+    frameLength = delimiterOffset + 1 - offset;
+    offset = delimiterOffset + 1;
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,183 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef SYMBOLSCANNER_H
+#define SYMBOLSCANNER_H
+//------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+/**
+ * Kernels to scan buffers of raw symbols, e.g. for the SYN and the escape
+ * symbols. They process 16 symbols at a time with SSE2 or NEON, if the
+ * target supports either of them, otherwise the symbols are scanned one by
+ * one.
+ */
+class SymbolScanner
+{
+public:
+    /**
+     * Type for symbols.
+     */
+    typedef uint8_t symbol_t;
+
+    /**
+     * Iterator over the frames of a buffer delimited by a certain symbol,
+     * e.g. SYN. Each frame ends with the delimiter, so a run of delimiters
+     * yields frames consisting of the delimiter alone.
+     */
+    class Frames
+    {
+    private:
+        /**
+         * The buffer being split.
+         */
+        const symbol_t* symbols;
+
+        /**
+         * The length of the buffer.
+         */
+        size_t length;
+
+        /**
+         * The delimiter.
+         */
+        symbol_t delimiter;
+
+        /**
+         * The offset of the next frame.
+         */
+        size_t offset;
+
+    public:
+        /**
+         * Construct the iterator for the given buffer.
+         */
+        Frames(const symbol_t* symbols, size_t length, symbol_t delimiter);
+
+        /**
+         * Get the next frame.
+         *
+         * @return whether there is a next frame terminated by the
+         * delimiter. If not, the unterminated rest of the buffer starts at
+         * the offset returned by getOffset().
+         */
+        bool next(size_t& frameOffset, size_t& frameLength);
+
+        /**
+         * Get the offset of the next frame.
+         */
+        size_t getOffset() const;
+    };
+
+    /**
+     * Determine if the scanning is vectorized.
+     */
+    static bool isVectorized();
+
+    /**
+     * Check the kernels against their scalar equivalents. SYN, escape and
+     * escape sequence symbols are put alone and in pairs at every offset
+     * of buffers spanning several blocks, so that the block boundaries and
+     * the remainders are all covered.
+     *
+     * @return whether all results match.
+     */
+    static bool check();
+
+    /**
+     * Find the first occurence of the given symbol in the given buffer.
+     *
+     * @return the offset of the symbol, or the length of the buffer if it
+     * does not occur.
+     */
+    static size_t find(const symbol_t* symbols, size_t length,
+                       symbol_t symbol);
+
+    /**
+     * Find the first occurence of either of the given symbols in the given
+     * buffer.
+     *
+     * @return the offset of the symbol, or the length of the buffer if
+     * neither of them occurs.
+     */
+    static size_t find(const symbol_t* symbols, size_t length,
+                       symbol_t symbol1, symbol_t symbol2);
+
+    /**
+     * Find the first symbol in the given buffer that differs from the given
+     * one.
+     *
+     * @return the offset of the symbol, or the length of the buffer if all
+     * symbols are equal to the given one.
+     */
+    static size_t findOther(const symbol_t* symbols, size_t length,
+                            symbol_t symbol);
+
+    /**
+     * Unescape the given buffer of raw symbols. An escape symbol followed
+     * by 0 or 1 stands for the escape symbol itself or the symbol after it
+     * (i.e. SYN for eBUS). The runs between the escape sequences are copied
+     * as they are.
+     *
+     * The unescaping stops at the delimiter, at an invalid or incomplete
+     * escape sequence or if the given number of unescaped symbols are
+     * produced. These are left for the caller to handle.
+     *
+     * @param numConsumed will contain the number of raw symbols processed
+     *
+     * @return the number of unescaped symbols produced.
+     */
+    static size_t unescape(const symbol_t* symbols, size_t length,
+                           symbol_t* unescaped, size_t maxLength,
+                           symbol_t delimiter, symbol_t escape,
+                           size_t& numConsumed);
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline
+SymbolScanner::Frames::Frames(const symbol_t* symbols, size_t length,
+                              symbol_t delimiter) :
+    symbols(symbols),
+    length(length),
+    delimiter(delimiter),
+    offset(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline size_t SymbolScanner::Frames::getOffset() const
+{
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+#endif // SYMBOLSCANNER_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -25,6 +25,7 @@
 #include "util.h"
 
 #include <cassert>
+#include <cstring>
 
 //------------------------------------------------------------------------------
 
@@ -35,6 +36,12 @@
 class Telegram
 {
 public:
+    /**
+     * The maximal number of data symbols in the master or the slave part of
+     * a telegram.
+     */
+    static const size_t maxNumDataSymbols = 255;
+
     /**
      * Type for the acknowledgement status.
      */
@@ -83,7 +90,7 @@ public:
     /**
      * The data symbols.
      */
-    symbol_t* dataSymbols;
+    symbol_t dataSymbols[maxNumDataSymbols];
 
     /**
      * Indicate if the CRC was OK.
@@ -95,6 +102,13 @@ public:
      */
     acknowledgement_t acknowledgement;
 
+    /**
+     * Indicate if the master part has been repeated, because the
+     * destination has responded with NACK to it first. The fields of the
+     * master part and the acknowledgement are those of the repetition.
+     */
+    bool repeated;
+
     /**
      * The length of the reply data symbols for master-slave telegrams.
      */
@@ -103,7 +117,7 @@ public:
     /**
      * The data symbols of the reply for master-slave telegrams.
      */
-    symbol_t* replyDataSymbols;
+    symbol_t replyDataSymbols[maxNumDataSymbols];
 
     /**
      * Indicate if the CRC was OK in the reply of a master-slave telegram.
@@ -116,18 +130,56 @@ public:
      */
     acknowledgement_t masterAcknowledgement;
 
+    /**
+     * Indicate if the slave reply has been repeated, because the master has
+     * responded with NACK to it first. The fields of the reply and the
+     * acknowledgement of the master are those of the repetition.
+     */
+    bool replyRepeated;
+
+    /**
+     * The monotonic time in nanoseconds of the SYN symbol preceding the
+     * telegram.
+     */
+    unsigned long long synTime;
+
+    /**
+     * The monotonic time in nanoseconds of the source address symbol.
+     */
+    unsigned long long startTime;
+
+    /**
+     * The monotonic time in nanoseconds of the acknowledgement symbol sent
+     * by the destination, if any.
+     */
+    unsigned long long ackTime;
+
+    /**
+     * The monotonic time in nanoseconds of the first symbol of the reply
+     * for master-slave telegrams.
+     */
+    unsigned long long replyTime;
+
+    /**
+     * The monotonic time in nanoseconds of the last symbol of the telegram.
+     */
+    unsigned long long endTime;
+
 public:
+    /**
+     * Construct an empty telegram.
+     */
+    Telegram();
+
     /**
      * Construct the telegram with the given basic data.
-     *
-     * A buffer for the data symbols will be allocated too.
      */
     Telegram(symbol_t source, symbol_t destination,
              symbol_t primaryCommand, symbol_t secondaryCommand,
              size_t numDataSymbols);
 
     /**
-     * Move construct the telegram
+     * Move construct the telegram. Only the data symbols in use are copied.
      */
     Telegram(Telegram&& other);
 
@@ -137,13 +189,19 @@ public:
     Telegram(const Telegram&) = delete;
 
     /**
-     * Destroy the telegram.
+     * Move assign the given telegram. Only the data symbols in use are
+     * copied.
+     */
+    Telegram& operator=(Telegram&& other);
+
+    /**
+     * Clear the telegram, i.e. reset all fields except for the data
+     * symbols to their initial values.
      */
-    ~Telegram();
+    void clear();
 
     /**
-     * Start a reply by allocating a buffer of the given number of symbols for
-     * the reply.
+     * Start a reply with the given number of symbols.
      */
     void startReply(size_t numDataSymbols);
 };
@@ -160,22 +218,25 @@ inline Telegram::acknowledgement_t Telegram::symbol2ack(symbol_t symbol)
 
 //------------------------------------------------------------------------------
 
+inline Telegram::Telegram()
+{
+    clear();
+}
+
+//------------------------------------------------------------------------------
+
 inline Telegram::Telegram(symbol_t source, symbol_t destination,
                           symbol_t primaryCommand, symbol_t secondaryCommand,
-                          size_t numDataSymbols) :
-    source(source),
-    destination(destination),
-    primaryCommand(primaryCommand),
-    secondaryCommand(secondaryCommand),
-    numDataSymbols(numDataSymbols),
-    dataSymbols(new symbol_t[numDataSymbols]),
-    crcOK(false),
-    acknowledgement(NONE),
-    numReplyDataSymbols(0),
-    replyDataSymbols(0),
-    replyCRCOK(false),
-    masterAcknowledgement(NONE)
+                          size_t numDataSymbols)
 {
+    assert(numDataSymbols<=maxNumDataSymbols);
+
+    clear();
+    this->source = source;
+    this->destination = destination;
+    this->primaryCommand = primaryCommand;
+    this->secondaryCommand = secondaryCommand;
+    this->numDataSymbols = numDataSymbols;
 }
 
 //------------------------------------------------------------------------------
@@ -186,33 +247,74 @@ inline Telegram::Telegram(Telegram&& other) :
     primaryCommand(other.primaryCommand),
     secondaryCommand(other.secondaryCommand),
     numDataSymbols(other.numDataSymbols),
-    dataSymbols(other.dataSymbols),
     crcOK(other.crcOK),
     acknowledgement(other.acknowledgement),
+    repeated(other.repeated),
     numReplyDataSymbols(other.numReplyDataSymbols),
-    replyDataSymbols(other.replyDataSymbols),
     replyCRCOK(other.replyCRCOK),
-    masterAcknowledgement(other.masterAcknowledgement)
+    masterAcknowledgement(other.masterAcknowledgement),
+    replyRepeated(other.replyRepeated),
+    synTime(other.synTime),
+    startTime(other.startTime),
+    ackTime(other.ackTime),
+    replyTime(other.replyTime),
+    endTime(other.endTime)
+{
+    memcpy(dataSymbols, other.dataSymbols, numDataSymbols);
+    memcpy(replyDataSymbols, other.replyDataSymbols, numReplyDataSymbols);
+}
+
+//------------------------------------------------------------------------------
+
+inline Telegram& Telegram::operator=(Telegram&& other)
 {
-    other.dataSymbols = 0;
-    other.replyDataSymbols = 0;
+    source = other.source;
+    destination = other.destination;
+    primaryCommand = other.primaryCommand;
+    secondaryCommand = other.secondaryCommand;
+    numDataSymbols = other.numDataSymbols;
+    crcOK = other.crcOK;
+    acknowledgement = other.acknowledgement;
+    repeated = other.repeated;
+    numReplyDataSymbols = other.numReplyDataSymbols;
+    replyCRCOK = other.replyCRCOK;
+    masterAcknowledgement = other.masterAcknowledgement;
+    replyRepeated = other.replyRepeated;
+    synTime = other.synTime;
+    startTime = other.startTime;
+    ackTime = other.ackTime;
+    replyTime = other.replyTime;
+    endTime = other.endTime;
+
+    memcpy(dataSymbols, other.dataSymbols, numDataSymbols);
+    memcpy(replyDataSymbols, other.replyDataSymbols, numReplyDataSymbols);
+
+    return *this;
 }
 
 //------------------------------------------------------------------------------
 
-inline Telegram::~Telegram()
+inline void Telegram::clear()
 {
-    delete[] replyDataSymbols;
-    delete[] dataSymbols;
+    source = destination = 0;
+    primaryCommand = secondaryCommand = 0;
+    numDataSymbols = 0;
+    crcOK = false;
+    acknowledgement = NONE;
+    repeated = false;
+    numReplyDataSymbols = 0;
+    replyCRCOK = false;
+    masterAcknowledgement = NONE;
+    replyRepeated = false;
+    synTime = startTime = ackTime = replyTime = endTime = 0;
 }
 
 //------------------------------------------------------------------------------
 
 inline void Telegram::startReply(size_t numDataSymbols)
 {
-    delete [] replyDataSymbols;
+    assert(numDataSymbols<=maxNumDataSymbols);
     numReplyDataSymbols = numDataSymbols;
-    replyDataSymbols = new symbol_t[numDataSymbols];
 }
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,346 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "TelegramParser.h"
+
+#include "Address.h"
+#include "BusHandler.h"
+#include "CRC.h"
+#include "SymbolScanner.h"
+
+#include <algorithm>
+
+#include <cstring>
+
+//------------------------------------------------------------------------------
+
+const char* TelegramParser::status2String(status_t status)
+{
+    switch(status) {
+      case STATUS_INCOMPLETE: return "incomplete";
+      case STATUS_COMPLETE: return "complete";
+      case STATUS_NO_ACK: return "no ACK";
+      case STATUS_SYN: return "unexpected SYN";
+      case STATUS_INVALID_SOURCE: return "invalid source";
+      case STATUS_INVALID_ESCAPE: return "invalid escape sequence";
+      case STATUS_TIMEOUT: return "timeout";
+    }
+    return "unknown";
+}
+
+//------------------------------------------------------------------------------
+
+TelegramParser::status_t
+TelegramParser::push(symbol_t symbol, unsigned long long time)
+{
+    if (symbol==BusHandler::SYMBOL_SYN) {
+        auto previousState = state;
+
+        state = STATE_SOURCE;
+        escapePending = false;
+        synTime = time;
+
+        if (previousState==STATE_WAIT_SYN || previousState==STATE_SOURCE) {
+            return STATUS_INCOMPLETE;
+        } else if (previousState==STATE_ACK) {
+            return STATUS_NO_ACK;
+        } else if (previousState==STATE_REPEATED_SOURCE ||
+                   previousState==STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS)
+        {
+            // There is no repetition after the NACK
+            return STATUS_COMPLETE;
+        } else {
+            return STATUS_SYN;
+        }
+    }
+
+    if (state==STATE_WAIT_SYN) {
+        return STATUS_INCOMPLETE;
+    } else if (state==STATE_SOURCE) {
+        telegram.clear();
+        telegram.synTime = synTime;
+        telegram.startTime = telegram.endTime = time;
+        telegram.source = symbol;
+
+        symbols[0] = symbol;
+        numSymbols = 1;
+
+        if (!Address::isMaster(symbol)) {
+            state = STATE_WAIT_SYN;
+            return STATUS_INVALID_SOURCE;
+        }
+
+        crc = 0;
+        BusHandler::updateCRC(crc, symbol);
+        state = STATE_DESTINATION;
+        return STATUS_INCOMPLETE;
+    } else if (state==STATE_REPEATED_SOURCE) {
+        // Anything else than the source address means that the master part
+        // is not repeated, but the rest is ignored up to the next SYN
+        if (symbol!=telegram.source) {
+            state = STATE_WAIT_SYN;
+            return STATUS_COMPLETE;
+        }
+
+        if (numSymbols<maxNumSymbols) symbols[numSymbols++] = symbol;
+        telegram.repeated = true;
+        telegram.endTime = time;
+
+        crc = 0;
+        BusHandler::updateCRC(crc, symbol);
+        state = STATE_DESTINATION;
+        return STATUS_INCOMPLETE;
+    }
+
+    // The CRC is computed over the raw symbols, except for the CRC itself
+    // and the acknowledgements
+    if ((state>=STATE_DESTINATION && state<=STATE_DATA) ||
+        state==STATE_NUM_REPLY_DATA_SYMBOLS || state==STATE_REPLY_DATA ||
+        state==STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS)
+    {
+        BusHandler::updateCRC(crc, symbol);
+    }
+
+    if (escapePending) {
+        escapePending = false;
+        if (symbol>1) {
+            state = STATE_WAIT_SYN;
+            return STATUS_INVALID_ESCAPE;
+        }
+        symbol += BusHandler::SYMBOL_ESC;
+    } else if (symbol==BusHandler::SYMBOL_ESC) {
+        escapePending = true;
+        return STATUS_INCOMPLETE;
+    }
+
+    return pushSymbol(symbol, time);
+}
+
+//------------------------------------------------------------------------------
+
+size_t TelegramParser::push(const symbol_t* symbols, size_t length,
+                            unsigned long long time, status_t& status)
+{
+    status = STATUS_INCOMPLETE;
+    for(size_t i = 0; i<length; ++i) {
+        status = push(symbols[i], time);
+        if (status!=STATUS_INCOMPLETE) return i + 1;
+    }
+    return length;
+}
+
+//------------------------------------------------------------------------------
+
+size_t TelegramParser::push(const symbol_t* symbols,
+                            const unsigned long long* times, size_t length,
+                            status_t& status)
+{
+    status = STATUS_INCOMPLETE;
+
+    size_t offset = 0;
+    while(offset<length) {
+        auto count = pushRun(symbols + offset, times + offset,
+                             length - offset);
+        if (count>0) {
+            offset += count;
+        } else {
+            status = push(symbols[offset], times[offset]);
+            ++offset;
+            if (status!=STATUS_INCOMPLETE) break;
+        }
+    }
+
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+TelegramParser::status_t TelegramParser::timeout()
+{
+    bool wasIdle = isIdle();
+    bool wasComplete = state==STATE_REPEATED_SOURCE ||
+        (state==STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS && !escapePending);
+
+    state = STATE_WAIT_SYN;
+    escapePending = false;
+
+    return wasIdle ? STATUS_INCOMPLETE :
+        (wasComplete ? STATUS_COMPLETE : STATUS_TIMEOUT);
+}
+
+//------------------------------------------------------------------------------
+
+TelegramParser::status_t
+TelegramParser::pushSymbol(symbol_t symbol, unsigned long long time)
+{
+    if (numSymbols<maxNumSymbols) symbols[numSymbols++] = symbol;
+    telegram.endTime = time;
+
+    switch(state) {
+      case STATE_DESTINATION:
+        telegram.destination = symbol;
+        state = STATE_PRIMARY_COMMAND;
+        break;
+      case STATE_PRIMARY_COMMAND:
+        telegram.primaryCommand = symbol;
+        state = STATE_SECONDARY_COMMAND;
+        break;
+      case STATE_SECONDARY_COMMAND:
+        telegram.secondaryCommand = symbol;
+        state = STATE_NUM_DATA_SYMBOLS;
+        break;
+      case STATE_NUM_DATA_SYMBOLS:
+        telegram.numDataSymbols = symbol;
+        dataOffset = 0;
+        state = (symbol>0) ? STATE_DATA : STATE_CRC;
+        break;
+      case STATE_DATA:
+        telegram.dataSymbols[dataOffset++] = symbol;
+        if (dataOffset>=telegram.numDataSymbols) state = STATE_CRC;
+        break;
+      case STATE_CRC:
+        telegram.crcOK = symbol==crc;
+        if (Address::isBroadcast(telegram.destination)) {
+            state = STATE_SOURCE;
+            return STATUS_COMPLETE;
+        }
+        state = STATE_ACK;
+        break;
+      case STATE_ACK:
+        telegram.acknowledgement = Telegram::symbol2ack(symbol);
+        telegram.ackTime = time;
+        if (telegram.acknowledgement==Telegram::ACK &&
+            Address::isSlave(telegram.destination))
+        {
+            crc = 0;
+            state = STATE_NUM_REPLY_DATA_SYMBOLS;
+        } else if (telegram.acknowledgement==Telegram::NACK &&
+                   !telegram.repeated)
+        {
+            state = STATE_REPEATED_SOURCE;
+        } else {
+            state = STATE_SOURCE;
+            return STATUS_COMPLETE;
+        }
+        break;
+      case STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS:
+        telegram.replyRepeated = true;
+        // fall through
+      case STATE_NUM_REPLY_DATA_SYMBOLS:
+        telegram.replyTime = time;
+        telegram.startReply(symbol);
+        dataOffset = 0;
+        state = (symbol>0) ? STATE_REPLY_DATA : STATE_REPLY_CRC;
+        break;
+      case STATE_REPLY_DATA:
+        telegram.replyDataSymbols[dataOffset++] = symbol;
+        if (dataOffset>=telegram.numReplyDataSymbols) {
+            state = STATE_REPLY_CRC;
+        }
+        break;
+      case STATE_REPLY_CRC:
+        telegram.replyCRCOK = symbol==crc;
+        state = STATE_MASTER_ACK;
+        break;
+      case STATE_MASTER_ACK:
+        telegram.masterAcknowledgement = Telegram::symbol2ack(symbol);
+        if (telegram.masterAcknowledgement==Telegram::NACK &&
+            !telegram.replyRepeated)
+        {
+            crc = 0;
+            state = STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS;
+            break;
+        }
+        state = STATE_SOURCE;
+        return STATUS_COMPLETE;
+      case STATE_WAIT_SYN:
+      case STATE_SOURCE:
+      case STATE_REPEATED_SOURCE:
+        break;
+    }
+
+    return STATUS_INCOMPLETE;
+}
+
+//------------------------------------------------------------------------------
+
+size_t TelegramParser::pushRun(const symbol_t* symbols,
+                               const unsigned long long* times,
+                               size_t length)
+{
+    if (escapePending) return 0;
+
+    switch(state) {
+      case STATE_WAIT_SYN:
+        // Everything up to the next SYN symbol is ignored
+        return SymbolScanner::find(symbols, length, BusHandler::SYMBOL_SYN);
+      case STATE_SOURCE: {
+        // Of a run of SYN symbols only the time of the last one matters
+        auto count = SymbolScanner::findOther(symbols, length,
+                                              BusHandler::SYMBOL_SYN);
+        if (count>0) synTime = times[count - 1];
+        return count;
+      }
+      case STATE_DATA:
+      case STATE_REPLY_DATA: {
+        bool isReply = state==STATE_REPLY_DATA;
+        size_t numDataSymbols = isReply ?
+            telegram.numReplyDataSymbols : telegram.numDataSymbols;
+        auto dataSymbols = isReply ?
+            telegram.replyDataSymbols : telegram.dataSymbols;
+
+        // The data symbols are unescaped in bulk up to the first SYN or
+        // incomplete escape sequence, which are left to push()
+        auto unescaped = dataSymbols + dataOffset;
+        size_t count = 0;
+        auto numUnescaped =
+            SymbolScanner::unescape(symbols, length, unescaped,
+                                    numDataSymbols - dataOffset,
+                                    BusHandler::SYMBOL_SYN,
+                                    BusHandler::SYMBOL_ESC, count);
+        if (count==0) return 0;
+
+        dataOffset += numUnescaped;
+
+        crc = CRC::update(crc, symbols, count);
+
+        auto numCopied = std::min(numUnescaped, maxNumSymbols - numSymbols);
+        memcpy(this->symbols + numSymbols, unescaped, numCopied);
+        numSymbols += numCopied;
+
+        telegram.endTime = times[count - 1];
+
+        if (dataOffset>=numDataSymbols) {
+            state = isReply ? STATE_REPLY_CRC : STATE_CRC;
+        }
+        return count;
+      }
+      default:
+        return 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -0,0 +1,380 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef TELEGRAMPARSER_H
+#define TELEGRAMPARSER_H
+//------------------------------------------------------------------------------
+
+#include "Telegram.h"
+
+#include "util.h"
+
+//------------------------------------------------------------------------------
+
+/**
+ * A push-style parser of telegrams. The raw symbols received from the bus
+ * are pushed into it one by one or in buffers, and it reports when a
+ * telegram has been completed or it has been interrupted. It handles the
+ * escape sequences, the CRCs, the acknowledgements and the reply of the
+ * slave as states. It never allocates memory nor throws exceptions.
+ *
+ * If the master part or the slave reply is responded to with NACK, it may
+ * be repeated once right away. The telegram is completed only after the
+ * repetition, or when a SYN symbol indicates that there is none.
+ */
+class TelegramParser
+{
+public:
+    /**
+     * Type for the result of pushing a symbol.
+     */
+    typedef enum {
+        // The telegram is not complete yet, or there is no telegram being
+        // parsed
+        STATUS_INCOMPLETE,
+
+        // The telegram is complete. Its CRC and acknowledgement fields tell
+        // if it has been transferred correctly.
+        STATUS_COMPLETE,
+
+        // A SYN symbol has been received instead of the acknowledgement of
+        // the destination. The master part of the telegram is complete.
+        STATUS_NO_ACK,
+
+        // A SYN symbol has been received in the middle of the telegram
+        STATUS_SYN,
+
+        // The first symbol after SYN is not a master address. The telegram
+        // contains only the source.
+        STATUS_INVALID_SOURCE,
+
+        // An escape symbol has been followed by an invalid symbol
+        STATUS_INVALID_ESCAPE,
+
+        // The bus has timed out in the middle of the telegram
+        STATUS_TIMEOUT
+    } status_t;
+
+    /**
+     * The maximal number of symbols (after unescaping) a telegram may
+     * consist of.
+     */
+    static const size_t maxNumSymbols = 2*Telegram::maxNumDataSymbols + 16;
+
+    /**
+     * Get a string representation of the given status.
+     */
+    static const char* status2String(status_t status);
+
+private:
+    /**
+     * Type for the state of the parser, i.e. what the next symbol is
+     * expected to be.
+     */
+    typedef enum {
+        // Anything before a SYN symbol, which is ignored
+        STATE_WAIT_SYN,
+
+        // The source address or a SYN symbol
+        STATE_SOURCE,
+
+        // The destination address
+        STATE_DESTINATION,
+
+        // The primary command
+        STATE_PRIMARY_COMMAND,
+
+        // The secondary command
+        STATE_SECONDARY_COMMAND,
+
+        // The number of data symbols
+        STATE_NUM_DATA_SYMBOLS,
+
+        // A data symbol
+        STATE_DATA,
+
+        // The CRC of the master part
+        STATE_CRC,
+
+        // The acknowledgement of the destination
+        STATE_ACK,
+
+        // The source address of the master part repeated after a NACK, or
+        // a SYN symbol
+        STATE_REPEATED_SOURCE,
+
+        // The number of the data symbols of the slave reply
+        STATE_NUM_REPLY_DATA_SYMBOLS,
+
+        // A data symbol of the slave reply
+        STATE_REPLY_DATA,
+
+        // The CRC of the slave reply
+        STATE_REPLY_CRC,
+
+        // The acknowledgement of the master for the slave reply
+        STATE_MASTER_ACK,
+
+        // The number of the data symbols of the slave reply repeated after
+        // a NACK, or a SYN symbol
+        STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS
+    } state_t;
+
+    /**
+     * The current state.
+     */
+    state_t state;
+
+    /**
+     * Indicate if an escape symbol has been received, so the next symbol
+     * should be unescaped.
+     */
+    bool escapePending;
+
+    /**
+     * The CRC of the current part of the telegram computed so far.
+     */
+    symbol_t crc;
+
+    /**
+     * The offset of the next data symbol in the current part.
+     */
+    size_t dataOffset;
+
+    /**
+     * The time of the last SYN symbol.
+     */
+    unsigned long long synTime;
+
+    /**
+     * The telegram being parsed, or the one parsed last.
+     */
+    Telegram telegram;
+
+    /**
+     * The (unescaped) symbols of the telegram received so far.
+     */
+    symbol_t symbols[maxNumSymbols];
+
+    /**
+     * The number of symbols in the buffer.
+     */
+    size_t numSymbols;
+
+public:
+    /**
+     * Construct the parser. It expects a SYN symbol first.
+     */
+    TelegramParser();
+
+    /**
+     * Reset the parser, so that it expects a SYN symbol.
+     */
+    void reset();
+
+    /**
+     * Push the given raw symbol received at the given time.
+     *
+     * @return the status of the telegram. If it is not STATUS_INCOMPLETE,
+     * the telegram can be retrieved by getTelegram() until the next symbol
+     * is pushed.
+     */
+    status_t push(symbol_t symbol, unsigned long long time);
+
+    /**
+     * Push the given raw symbols received by the given time until a status
+     * other than STATUS_INCOMPLETE results.
+     *
+     * @param status will contain the status after the last symbol consumed.
+     *
+     * @return the number of symbols consumed.
+     */
+    size_t push(const symbol_t* symbols, size_t length,
+                unsigned long long time, status_t& status);
+
+    /**
+     * Push the given raw symbols received at the given times until a
+     * status other than STATUS_INCOMPLETE results. Runs of data symbols
+     * without any SYN or escape symbols, as well as the symbols to be
+     * ignored between the telegrams, are processed in bulk.
+     *
+     * @param status will contain the status after the last symbol consumed.
+     *
+     * @return the number of symbols consumed.
+     */
+    size_t push(const symbol_t* symbols, const unsigned long long* times,
+                size_t length, status_t& status);
+
+    /**
+     * Indicate that the bus has timed out. If a telegram is being parsed,
+     * it is finished with STATUS_TIMEOUT, and the parser will expect a SYN
+     * symbol.
+     *
+     * @return STATUS_TIMEOUT, or STATUS_INCOMPLETE, if there was no telegram
+     * being parsed. If only a repetition after a NACK could have followed,
+     * STATUS_COMPLETE is returned.
+     */
+    status_t timeout();
+
+    /**
+     * Determine if the parser is between telegrams, i.e. it expects a SYN
+     * symbol or a source address.
+     */
+    bool isIdle() const;
+
+    /**
+     * Determine if the parser expects the acknowledgement of the
+     * destination for the master part.
+     */
+    bool isAwaitingACK() const;
+
+    /**
+     * Determine if the parser expects the slave reply repeated, because
+     * the master has responded with NACK to it.
+     */
+    bool isAwaitingReplyRepetition() const;
+
+    /**
+     * Determine if the parser expects the acknowledgement of the master for
+     * the slave reply.
+     */
+    bool isAwaitingMasterACK() const;
+
+    /**
+     * Determine if the parser expects the master part to be repeated,
+     * because the destination has responded with NACK to it.
+     */
+    bool isAwaitingRepetition() const;
+
+    /**
+     * Get the telegram being parsed, or the one parsed last.
+     */
+    Telegram& getTelegram();
+
+    /**
+     * Get the (unescaped) symbols of the telegram received so far.
+     */
+    const symbol_t* getSymbols() const;
+
+    /**
+     * Get the number of the symbols of the telegram received so far.
+     */
+    size_t getNumSymbols() const;
+
+private:
+    /**
+     * Process the given unescaped symbol of the telegram.
+     */
+    status_t pushSymbol(symbol_t symbol, unsigned long long time);
+
+    /**
+     * Process the longest run at the beginning of the given raw symbols
+     * that can be processed in bulk in the current state.
+     *
+     * @return the number of symbols processed, which is 0 if the first
+     * symbol should be pushed on its own.
+     */
+    size_t pushRun(const symbol_t* symbols, const unsigned long long* times,
+                   size_t length);
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline TelegramParser::TelegramParser()
+{
+    reset();
+}
+
+//------------------------------------------------------------------------------
+
+inline void TelegramParser::reset()
+{
+    state = STATE_WAIT_SYN;
+    escapePending = false;
+    crc = 0;
+    dataOffset = 0;
+    synTime = 0;
+    numSymbols = 0;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool TelegramParser::isIdle() const
+{
+    return state==STATE_WAIT_SYN || state==STATE_SOURCE;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool TelegramParser::isAwaitingACK() const
+{
+    return state==STATE_ACK;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool TelegramParser::isAwaitingReplyRepetition() const
+{
+    return state==STATE_REPEATED_NUM_REPLY_DATA_SYMBOLS && !escapePending;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool TelegramParser::isAwaitingMasterACK() const
+{
+    return state==STATE_MASTER_ACK;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool TelegramParser::isAwaitingRepetition() const
+{
+    return state==STATE_REPEATED_SOURCE;
+}
+
+//------------------------------------------------------------------------------
+
+inline Telegram& TelegramParser::getTelegram()
+{
+    return telegram;
+}
+
+//------------------------------------------------------------------------------
+
+inline const symbol_t* TelegramParser::getSymbols() const
+{
+    return symbols;
+}
+
+//------------------------------------------------------------------------------
+
+inline size_t TelegramParser::getNumSymbols() const
+{
+    return numSymbols;
+}
+
+//------------------------------------------------------------------------------
+#endif // TELEGRAMPARSER_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
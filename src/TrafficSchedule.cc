@@ -0,0 +1,223 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+#include "TrafficSchedule.h"
+
+#include "Telegram.h"
+#include "Log.h"
+#include "util.h"
+
+//------------------------------------------------------------------------------
+
+TrafficSchedule::Statistics::Statistics() :
+    numPeriodicStreams(0),
+    numDeferrals(0),
+    numForcedAttempts(0),
+    numUnscheduledAttempts(0),
+    numUnscheduledCollisions(0),
+    numScheduledAttempts(0),
+    numScheduledCollisions(0)
+{
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+uint32_t TrafficSchedule::key(const Telegram& telegram)
+{
+    return (static_cast<uint32_t>(telegram.source)<<16) |
+        (static_cast<uint32_t>(telegram.primaryCommand)<<8) |
+        telegram.secondaryCommand;
+}
+
+//------------------------------------------------------------------------------
+
+bool TrafficSchedule::isExpected(const Stream& stream,
+                                 unsigned long long time)
+{
+    if (stream.numMatches<minNumMatches || time<stream.lastTime) {
+        return false;
+    }
+
+    // The number of periods elapsed since the last telegram, rounded to
+    // the nearest, as some telegrams may have been missed
+    auto elapsed = time - stream.lastTime;
+    auto numPeriods = (elapsed + stream.period/2) / stream.period;
+    if (numPeriods==0) numPeriods = 1;
+    if (numPeriods>maxNumMisses+1) return false;
+
+    auto expected = numPeriods * stream.period;
+    auto difference = (elapsed>expected) ?
+        (elapsed - expected) : (expected - elapsed);
+    return difference<=(minMargin + 2*stream.deviation);
+}
+
+//------------------------------------------------------------------------------
+
+void TrafficSchedule::observe(const Telegram& telegram)
+{
+    auto k = key(telegram);
+    auto i = streams.find(k);
+    if (i==streams.end()) {
+        if (streams.size()>=maxNumStreams) return;
+        i = streams.emplace(k, Stream()).first;
+    }
+
+    auto& stream = i->second;
+    auto time = telegram.startTime;
+    if (stream.lastTime!=0 && time>stream.lastTime) {
+        auto interval = time - stream.lastTime;
+        auto period = stream.period;
+
+        // The interval matches the period, if it is within 1/8 of it, or
+        // of a small multiple of it, if some telegrams have been missed
+        unsigned long long numPeriods =
+            (period==0) ? 0 : ((interval + period/2) / period);
+        auto expected = numPeriods * period;
+        auto difference = (interval>expected) ?
+            (interval - expected) : (expected - interval);
+
+        if (numPeriods>0 && numPeriods<=maxNumMisses+1 &&
+            difference<=expected/8)
+        {
+            if (numPeriods==1) {
+                stream.period = (7*period + interval) / 8;
+                stream.deviation = (7*stream.deviation + difference) / 8;
+                if (stream.numMatches<minNumMatches &&
+                    ++stream.numMatches==minNumMatches)
+                {
+                    setPeriodic(k, stream, true);
+                }
+            }
+        } else {
+            if (stream.numMatches>=minNumMatches) {
+                setPeriodic(k, stream, false);
+                Log::info("Periodic traffic %02x %02x%02x has changed",
+                          telegram.source, telegram.primaryCommand,
+                          telegram.secondaryCommand);
+            }
+            stream.period = interval;
+            stream.deviation = 0;
+            stream.numMatches = 0;
+        }
+    }
+    stream.lastTime = time;
+
+    expireStreams(time);
+}
+
+//------------------------------------------------------------------------------
+
+bool TrafficSchedule::canStart(unsigned long long time)
+{
+    expireStreams(time);
+
+    bool expected = false;
+    if (numPeriodicStreams>0) {
+        for(const auto& i: streams) {
+            if (isExpected(i.second, time)) {
+                expected = true;
+                break;
+            }
+        }
+    }
+
+    if (!expected) {
+        deferralTime = 0;
+        return true;
+    } else if (deferralTime==0) {
+        deferralTime = time;
+        addToCounter(statistics.numDeferrals);
+        return false;
+    } else if ((time - deferralTime)<maxDeferral) {
+        return false;
+    } else {
+        deferralTime = 0;
+        addToCounter(statistics.numForcedAttempts);
+        return true;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void TrafficSchedule::arbitrated(bool won)
+{
+    if (numPeriodicStreams>0) {
+        addToCounter(statistics.numScheduledAttempts);
+        if (!won) addToCounter(statistics.numScheduledCollisions);
+    } else {
+        addToCounter(statistics.numUnscheduledAttempts);
+        if (!won) addToCounter(statistics.numUnscheduledCollisions);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void TrafficSchedule::expireStreams(unsigned long long time)
+{
+    if (numPeriodicStreams==0) return;
+
+    for(auto& i: streams) {
+        auto& stream = i.second;
+        if (stream.numMatches<minNumMatches || time<stream.lastTime) {
+            continue;
+        }
+
+        // The stream is lost, if more telegrams have been missed in a row
+        // than allowed, even with the margin
+        auto lastExpected = (maxNumMisses + 1) * stream.period +
+            minMargin + 2*stream.deviation;
+        if ((time - stream.lastTime)>lastExpected) {
+            setPeriodic(i.first, stream, false);
+            stream.numMatches = 0;
+            Log::info("Periodic traffic %02x %02x%02x has stopped",
+                      i.first>>16, (i.first>>8)&0xff, i.first&0xff);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void TrafficSchedule::setPeriodic(uint32_t key, Stream& stream, bool periodic)
+{
+    symbol_t source = key>>16;
+    symbol_t primaryCommand = key>>8;
+    symbol_t secondaryCommand = key;
+
+    if (periodic) {
+        ++numPeriodicStreams;
+        Log::info("Periodic traffic learnt: %02x %02x%02x every %.2f s",
+                  source, primaryCommand, secondaryCommand,
+                  stream.period / 1e9);
+    } else {
+        --numPeriodicStreams;
+    }
+
+    statistics.numPeriodicStreams.store(numPeriodicStreams,
+                                        std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
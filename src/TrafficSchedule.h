@@ -0,0 +1,305 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+#ifndef TRAFFICSCHEDULE_H
+#define TRAFFICSCHEDULE_H
+//------------------------------------------------------------------------------
+
+#include <atomic>
+#include <unordered_map>
+
+#include <cstddef>
+#include <inttypes.h>
+
+//------------------------------------------------------------------------------
+
+class Telegram;
+
+//------------------------------------------------------------------------------
+
+/**
+ * The schedule of the periodic traffic of the other masters learnt from
+ * the telegrams received. It is used to defer our arbitrations while a
+ * periodic telegram is expected to be started, so that our telegrams do
+ * not collide with it.
+ *
+ * The telegrams are grouped into streams by their source address and
+ * command. A stream is considered periodic, if the intervals between its
+ * telegrams have matched its period a number of times in a row. The
+ * period is followed with a moving average, and a telegram missed now and
+ * then does not break it. A periodic telegram is expected within a margin
+ * around the start of its previous telegram plus the period, the margin
+ * depending on the deviation of the intervals from the period.
+ *
+ * The statistics are updated by the thread running the message handler,
+ * but they may be read by other threads.
+ */
+class TrafficSchedule
+{
+public:
+    /**
+     * Type for symbols.
+     */
+    typedef uint8_t symbol_t;
+
+    /**
+     * The number of intervals that should match the period in a row
+     * before a stream is considered periodic.
+     */
+    static const unsigned minNumMatches = 3;
+
+    /**
+     * The maximal number of telegrams of a periodic stream that may be
+     * missed in a row. If more are missed, the stream is not expected
+     * any more, until it reappears.
+     */
+    static const unsigned maxNumMisses = 3;
+
+    /**
+     * The maximal number of streams followed.
+     */
+    static const size_t maxNumStreams = 256;
+
+    /**
+     * The minimal margin in nanoseconds around the expected start of a
+     * periodic telegram. It covers the time the master may have to wait
+     * for the bus to be free.
+     */
+    static const unsigned long long minMargin = 50000000ULL;
+
+    /**
+     * The default maximal time in nanoseconds an arbitration may be
+     * deferred.
+     */
+    static const unsigned long long defaultMaxDeferral = 500000000ULL;
+
+    /**
+     * Statistics about the schedule and about our arbitrations, both
+     * before and after learning the schedule.
+     */
+    struct Statistics
+    {
+        /**
+         * The number of streams currently considered periodic.
+         */
+        std::atomic<unsigned> numPeriodicStreams;
+
+        /**
+         * The number of times an arbitration has been deferred.
+         */
+        std::atomic<unsigned long> numDeferrals;
+
+        /**
+         * The number of arbitrations started after being deferred for
+         * the maximal time.
+         */
+        std::atomic<unsigned long> numForcedAttempts;
+
+        /**
+         * The number of arbitrations started while no periodic stream was
+         * known.
+         */
+        std::atomic<unsigned long> numUnscheduledAttempts;
+
+        /**
+         * The number of arbitrations lost while no periodic stream was
+         * known.
+         */
+        std::atomic<unsigned long> numUnscheduledCollisions;
+
+        /**
+         * The number of arbitrations started while some periodic streams
+         * were known.
+         */
+        std::atomic<unsigned long> numScheduledAttempts;
+
+        /**
+         * The number of arbitrations lost while some periodic streams were
+         * known.
+         */
+        std::atomic<unsigned long> numScheduledCollisions;
+
+        /**
+         * Construct the statistics with all counters being 0.
+         */
+        Statistics();
+    };
+
+private:
+    /**
+     * A stream of telegrams with the same source address and command. A
+     * new stream is value-initialized, i.e. all its members are 0.
+     */
+    struct Stream
+    {
+        /**
+         * The start time of the last telegram of the stream.
+         */
+        unsigned long long lastTime;
+
+        /**
+         * The period of the stream in nanoseconds, or 0 if it is not known
+         * yet.
+         */
+        unsigned long long period;
+
+        /**
+         * The average deviation of the intervals from the period in
+         * nanoseconds.
+         */
+        unsigned long long deviation;
+
+        /**
+         * The number of intervals that have matched the period in a row,
+         * at most minNumMatches.
+         */
+        unsigned numMatches;
+    };
+
+    /**
+     * Get the key of the stream of the given telegram.
+     */
+    static uint32_t key(const Telegram& telegram);
+
+    /**
+     * The streams by their keys.
+     */
+    std::unordered_map<uint32_t, Stream> streams;
+
+    /**
+     * The number of streams considered periodic.
+     */
+    unsigned numPeriodicStreams;
+
+    /**
+     * The maximal time in nanoseconds an arbitration may be deferred.
+     */
+    unsigned long long maxDeferral;
+
+    /**
+     * The time the current deferral has started at, or 0 if the
+     * arbitration is not being deferred.
+     */
+    unsigned long long deferralTime;
+
+    /**
+     * The statistics.
+     */
+    Statistics statistics;
+
+public:
+    /**
+     * Construct the schedule.
+     */
+    TrafficSchedule();
+
+    /**
+     * Set the maximal time in nanoseconds an arbitration may be deferred.
+     */
+    void setMaxDeferral(unsigned long long maxDeferral);
+
+    /**
+     * Learn from the given telegram received from another master.
+     */
+    void observe(const Telegram& telegram);
+
+    /**
+     * Determine if any stream is considered periodic.
+     */
+    bool hasPeriodicStreams() const;
+
+    /**
+     * Determine if the arbitration may be started at the given time, i.e.
+     * no periodic telegram is expected to be started around it, or the
+     * arbitration has been deferred for the maximal time already.
+     */
+    bool canStart(unsigned long long time);
+
+    /**
+     * Indicate that an arbitration has been started with the given
+     * result.
+     */
+    void arbitrated(bool won);
+
+    /**
+     * Get the statistics.
+     */
+    const Statistics& getStatistics() const;
+
+private:
+    /**
+     * Determine if a telegram of the given stream is expected to be
+     * started around the given time.
+     */
+    static bool isExpected(const Stream& stream, unsigned long long time);
+
+    /**
+     * Stop considering the streams periodic whose telegrams have been
+     * missed more times in a row than allowed by the given time. The
+     * streams lost are logged.
+     */
+    void expireStreams(unsigned long long time);
+
+    /**
+     * Set whether the given stream with the given key is considered
+     * periodic. A stream learnt is logged.
+     */
+    void setPeriodic(uint32_t key, Stream& stream, bool periodic);
+};
+
+//------------------------------------------------------------------------------
+// Inline definitions
+//------------------------------------------------------------------------------
+
+inline TrafficSchedule::TrafficSchedule() :
+    numPeriodicStreams(0),
+    maxDeferral(defaultMaxDeferral),
+    deferralTime(0)
+{
+}
+
+//------------------------------------------------------------------------------
+
+inline void TrafficSchedule::setMaxDeferral(unsigned long long maxDeferral)
+{
+    this->maxDeferral = maxDeferral;
+}
+
+//------------------------------------------------------------------------------
+
+inline bool TrafficSchedule::hasPeriodicStreams() const
+{
+    return numPeriodicStreams>0;
+}
+
+//------------------------------------------------------------------------------
+
+inline const TrafficSchedule::Statistics&
+TrafficSchedule::getStatistics() const
+{
+    return statistics;
+}
+
+//------------------------------------------------------------------------------
+#endif // TRAFFICSCHEDULE_H
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
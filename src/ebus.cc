@@ -19,25 +19,38 @@
 //------------------------------------------------------------------------------
 
 #include "EBUS.h"
+#include "Reactor.h"
 #include "BusHandler.h"
+#include "Address.h"
 #include "MessageHandler.h"
 #include "Telegram.h"
 #include "DataSymbolReader.h"
 #include "Data.h"
+#include "SymbolScanner.h"
 #include "Log.h"
 
 #include <fstream>
+#include <thread>
+#include <vector>
+#include <memory>
 
+#include <cstdlib>
 #include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <csignal>
+#include <cerrno>
 
 #include <termios.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
 
 #include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
 
 //------------------------------------------------------------------------------
 
@@ -65,6 +78,15 @@ unsigned long long currentMillis()
 
 //------------------------------------------------------------------------------
 
+/**
+ * The number of times the statistics have been requested. It is incremented
+ * when SIGUSR1 is received, and each message handler logs its statistics
+ * when it sees a value it has not logged yet.
+ */
+volatile sig_atomic_t statisticsRequested = 0;
+
+//------------------------------------------------------------------------------
+
 /**
  * A data item with a time stamp.
  */
@@ -200,7 +222,7 @@ private:
      * Convert the given address into a string. For known addresses it will be
      * some abbreviation, for unknown ones it will be the hex digits.
      */
-    static std::string address2String(symbol_t symbol);
+    static const char* address2String(symbol_t symbol);
 
     /**
      * Convert the given bitfield into a string.
@@ -217,21 +239,55 @@ private:
 
 private:
     /**
-     * The data to send to the website.
+     * The data to send to the website. It may be shared by the handlers of
+     * several buses.
      */
-    WebData webData;
+    WebData& webData;
 
     /**
      * The path of the script sending the e-mail about an error.
      */
     std::string sendErrorMailScriptPath;
 
+    /**
+     * The eBUS interface whose statistics we log.
+     */
+    const EBUS& ebus;
+
+    /**
+     * The number of telegrams received.
+     */
+    unsigned long long numTelegrams;
+
+    /**
+     * The value of statisticsRequested when the statistics have been logged
+     * last.
+     */
+    sig_atomic_t statisticsLogged;
+
+    /**
+     * The monotonic time in nanoseconds when the statistics have been logged
+     * last, or when the handler has been created.
+     */
+    unsigned long long lastStatisticsTime;
+
+    /**
+     * The number of voluntary context switches of the process when the
+     * statistics have been logged last.
+     */
+    long lastNumWakeups;
+
 public:
     /**
      * Construct the message handler.
      */
-    MainMessageHandler(BusHandler& busHandler, const std::string& jsonFilePath,
-                       const char* argv0);
+    MainMessageHandler(const EBUS& ebus, BusHandler& busHandler,
+                       WebData& webData, const char* argv0);
+
+    /**
+     * Get the number of telegrams received.
+     */
+    unsigned long long getNumTelegrams() const;
 
 private:
     /**
@@ -244,6 +300,11 @@ private:
      */
     virtual void signalChanged(bool hasSignal);
 
+    /**
+     * Log the statistics about the bus.
+     */
+    void logStatistics();
+
     /**
      * Dump a telegram we don't decode.
      */
@@ -252,27 +313,27 @@ private:
     /**
      * Process the command 0503
      */
-    void process0503(const Telegram& telegram) throw(OverrunException);
+    void process0503(const Telegram& telegram);
 
     /**
      * Process the command 0507
      */
-    void process0507(const Telegram& telegram) throw(OverrunException);
+    void process0507(const Telegram& telegram);
 
     /**
      * Process the command 0700
      */
-    void process0700(const Telegram& telegram) throw(OverrunException);
+    void process0700(const Telegram& telegram);
 
     /**
      * Process the command 0800
      */
-    void process0800(const Telegram& telegram) throw(OverrunException);
+    void process0800(const Telegram& telegram);
 
     /**
      * Process the command 5014
      */
-    void process5014(const Telegram& telegram) throw(OverrunException);
+    void process5014(const Telegram& telegram);
 
     /**
      * Send the error mail with the given error code.
@@ -282,11 +343,17 @@ private:
 
 //------------------------------------------------------------------------------
 
-inline MainMessageHandler::MainMessageHandler(BusHandler& busHandler,
-                                              const std::string& jsonFilePath,
+inline MainMessageHandler::MainMessageHandler(const EBUS& ebus,
+                                              BusHandler& busHandler,
+                                              WebData& webData,
                                               const char* argv0) :
     MessageHandler(busHandler),
-    webData(jsonFilePath)
+    webData(webData),
+    ebus(ebus),
+    numTelegrams(0),
+    statisticsLogged(0),
+    lastStatisticsTime(currentTimeNanos()),
+    lastNumWakeups(0)
 {
     const char* lastSlash = strrchr(argv0, '/');
     if (lastSlash==0) {
@@ -297,6 +364,13 @@ inline MainMessageHandler::MainMessageHandler(BusHandler& busHandler,
     sendErrorMailScriptPath += "senderrormail.py";
 }
 
+//------------------------------------------------------------------------------
+
+inline unsigned long long MainMessageHandler::getNumTelegrams() const
+{
+    return numTelegrams;
+}
+
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 
@@ -340,17 +414,22 @@ inline void updateValue(TimedData<T>& data, const U& newValue,
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 
-string MainMessageHandler::address2String(symbol_t symbol)
+const char* MainMessageHandler::address2String(symbol_t symbol)
 {
-    char buffer[4];
-    snprintf(buffer, sizeof(buffer), "%02x", symbol);
-    return buffer;
+    return Address::toString(symbol);
 }
 
 //------------------------------------------------------------------------------
 
 void MainMessageHandler::received(const Telegram& telegram)
 {
+    ++numTelegrams;
+
+    if (statisticsRequested!=statisticsLogged) {
+        statisticsLogged = statisticsRequested;
+        logStatistics();
+    }
+
     updateValue(webData.signal, true, currentMillis());
     webData.write();
     try {
@@ -393,6 +472,118 @@ void MainMessageHandler::signalChanged(bool hasSignal)
 
 //------------------------------------------------------------------------------
 
+void MainMessageHandler::logStatistics()
+{
+    // The counters are updated by the thread handling the bus, so they are
+    // read only once, and the derived values are computed from the copies
+    auto& statistics = ebus.getStatistics();
+    unsigned long long numBytesRead = statistics.numBytesRead.load();
+    unsigned long long numReadCalls = statistics.numReadCalls.load();
+    unsigned long long numWaitCalls = statistics.numWaitCalls.load();
+    unsigned long long numBytesWritten = statistics.numBytesWritten.load();
+    unsigned long long numWriteCalls = statistics.numWriteCalls.load();
+    unsigned long long numRingEnterCalls =
+        statistics.numRingEnterCalls.load();
+    unsigned long long numTimerCalls = statistics.numTimerCalls.load();
+    Log::info("Statistics: %llu bytes read with %llu read() calls in %llu wakeups, %llu bytes written with %llu write() calls, %llu io_uring_enter() and %llu timerfd calls",
+              numBytesRead, numReadCalls, numWaitCalls, numBytesWritten,
+              numWriteCalls, numRingEnterCalls, numTimerCalls);
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage)==0) {
+        unsigned long long cpuTime =
+            (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL +
+            usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+        auto numBytes = numBytesRead + numBytesWritten;
+        auto numSystemCalls = numReadCalls + numWaitCalls + numWriteCalls +
+            numRingEnterCalls + numTimerCalls;
+        Log::info("Statistics: %.3f I/O system calls and %.1f us CPU time per byte",
+                  (numBytes>0) ? (numSystemCalls * 1.0 / numBytes) : 0.0,
+                  (numBytes>0) ? (cpuTime * 1.0 / numBytes) : 0.0);
+
+        // Every time a thread of the process blocks, it is a voluntary
+        // context switch, which is followed by a wakeup.
+        auto now = currentTimeNanos();
+        double duration = (now - lastStatisticsTime) / 1e9;
+        Log::info("Statistics: %.1f wakeups/s (process-wide) since the %s",
+                  (usage.ru_nvcsw - lastNumWakeups) / duration,
+                  (lastNumWakeups==0) ? "start" : "last statistics");
+        lastStatisticsTime = now;
+        lastNumWakeups = usage.ru_nvcsw;
+    }
+
+    Log::info("Statistics: %lu sendings aborted, %lu echo timeouts",
+              getNumSendsAborted(), getNumEchoTimeouts());
+    Log::info("Statistics: %lu repetitions after NACK, %lu slave reply repetitions, %lu telegrams sent thanks to a repetition",
+              getNumRepetitions(), getNumReplyRepetitions(),
+              getNumRecoveredByRepetition());
+
+    auto numAutoSYNTakeovers = getNumAutoSYNTakeovers();
+    if (numAutoSYNTakeovers>0) {
+        auto numAutoSYNs = getNumAutoSYNs();
+        auto numSpacings = numAutoSYNs - numAutoSYNTakeovers;
+        Log::info("Statistics: %lu SYN symbols generated, started generating %lu times, stopped %lu times for another SYN generator, %.1f ms average and %.1f ms maximal idle time before a SYN symbol generated",
+                  numAutoSYNs, numAutoSYNTakeovers, getNumAutoSYNStandDowns(),
+                  (numSpacings>0) ?
+                  (getTotalAutoSYNSpacing() / 1e6 / numSpacings) : 0.0,
+                  getMaxAutoSYNSpacing() / 1e6);
+    }
+
+    auto& traffic = getTrafficStatistics();
+    auto numUnscheduledAttempts = traffic.numUnscheduledAttempts.load();
+    auto numScheduledAttempts = traffic.numScheduledAttempts.load();
+    if (numUnscheduledAttempts>0 || numScheduledAttempts>0) {
+        Log::info("Statistics: %u periodic streams learnt, %lu arbitrations deferred (%lu started after the maximal deferral), collision rate: %.1f%% of %lu arbitrations before and %.1f%% of %lu arbitrations after learning the schedule",
+                  traffic.numPeriodicStreams.load(),
+                  traffic.numDeferrals.load(),
+                  traffic.numForcedAttempts.load(),
+                  (numUnscheduledAttempts>0) ?
+                  (traffic.numUnscheduledCollisions.load() * 100.0 /
+                   numUnscheduledAttempts) : 0.0,
+                  numUnscheduledAttempts,
+                  (numScheduledAttempts>0) ?
+                  (traffic.numScheduledCollisions.load() * 100.0 /
+                   numScheduledAttempts) : 0.0,
+                  numScheduledAttempts);
+    }
+
+    for(unsigned priorityClass = 0;
+        priorityClass<Arbitration::numPriorityClasses; ++priorityClass)
+    {
+        auto& arbitration = getArbitrationStatistics(priorityClass);
+        auto numAttempts = arbitration.numAttempts.load();
+        if (numAttempts==0) continue;
+
+        auto numWon = arbitration.numWon.load();
+        Log::info("Statistics: arbitration in priority class %u: %lu attempts, %lu won, %lu telegrams given up, %.1f ms average and %.1f ms maximal time to win, lock counter: %u",
+                  priorityClass, numAttempts, numWon,
+                  arbitration.numGivenUp.load(),
+                  (numWon>0) ?
+                  (arbitration.totalTimeToWin.load() / 1e6 / numWon) : 0.0,
+                  arbitration.maxTimeToWin.load() / 1e6,
+                  getLockCount());
+    }
+
+    if (getSlaveAddress()!=0) {
+        auto& responder = getResponderStatistics();
+        auto numResponses = responder.numResponses.load();
+        Log::info("Statistics: slave %02x: %lu queries answered (%lu responses repeated), %lu unknown queries, %lu queries NACKed, %.1f us average and %.1f us maximal response latency",
+                  getSlaveAddress(), numResponses,
+                  responder.numRepetitions.load(),
+                  responder.numUnknown.load(), responder.numNACKs.load(),
+                  (numResponses>0) ?
+                  (responder.totalLatency.load() / 1e3 / numResponses) : 0.0,
+                  responder.maxLatency.load() / 1e3);
+    }
+
+    if (getEventFD()>=0) {
+        Log::info("Statistics: %lu events dropped by the I/O thread",
+                  getNumDroppedEvents());
+    }
+}
+
+//------------------------------------------------------------------------------
+
 string MainMessageHandler::bit2String(BitData bitData,
                                       const string& bit0Str,
                                       const string& bit1Str,
@@ -440,8 +631,8 @@ void MainMessageHandler::dumpTelegram(const Telegram& telegram)
     bufferLength +=
         snprintf(buffer + bufferLength, sizeof(buffer) - bufferLength,
                  "Telegram: %s->%s %02x%02x [",
-                 address2String(telegram.source).c_str(),
-                 address2String(telegram.destination).c_str(),
+                 address2String(telegram.source),
+                 address2String(telegram.destination),
                  telegram.primaryCommand, telegram.secondaryCommand);
     for(unsigned i = 0; i<telegram.numDataSymbols; ++i) {
         if (i>0) bufferLength += snprintf(buffer + bufferLength,
@@ -459,7 +650,7 @@ void MainMessageHandler::dumpTelegram(const Telegram& telegram)
                                  sizeof(buffer) - bufferLength,
                                  " (CRC mismatch)");
     }
-    if (!BusHandler::isBroadcastAddress(telegram.destination) &&
+    if (!Address::isBroadcast(telegram.destination) &&
         telegram.acknowledgement!=Telegram::ACK)
     {
         if (telegram.acknowledgement==Telegram::NONE) {
@@ -474,7 +665,7 @@ void MainMessageHandler::dumpTelegram(const Telegram& telegram)
     }
     Log::info("%s", buffer);
 
-    if (BusHandler::isSlaveAddress(telegram.destination) &&
+    if (Address::isSlave(telegram.destination) &&
         telegram.acknowledgement==Telegram::ACK)
     {
         bufferLength = 0;
@@ -491,7 +682,8 @@ void MainMessageHandler::dumpTelegram(const Telegram& telegram)
         }
         bufferLength += snprintf(buffer + bufferLength,
                                  sizeof(buffer) - bufferLength,
-                                 "]");
+                                 "] (after %llu us)",
+                                 (telegram.replyTime - telegram.ackTime)/1000);
         if (!telegram.replyCRCOK) {
             bufferLength += snprintf(buffer + bufferLength,
                                      sizeof(buffer) - bufferLength,
@@ -513,7 +705,6 @@ void MainMessageHandler::dumpTelegram(const Telegram& telegram)
 //------------------------------------------------------------------------------
 
 void MainMessageHandler::process0503(const Telegram& telegram)
-    throw(OverrunException)
 {
     DataSymbolReader reader(telegram);
 
@@ -532,8 +723,8 @@ void MainMessageHandler::process0503(const Telegram& telegram)
                        "Flame", "Valve1", "Valve2", "UWP", "Alarm");
 
         Log::info("%s->%s BC Op. Data block 01: status: %u, BC state: %s, min-max boiler perf: %u%%, boiler temp: %.2f°C, return water temp: %u°C, boiler temp2: %u°C, outside temp: %d°C",
-                  address2String(telegram.source).c_str(),
-                  address2String(telegram.destination).c_str(),
+                  address2String(telegram.source),
+                  address2String(telegram.destination),
                   status.get(), burnerControlStateStr.c_str(),
                   minMaxBoilerPerf.get(),
                   boilerTemp.get(),
@@ -541,7 +732,7 @@ void MainMessageHandler::process0503(const Telegram& telegram)
                   boilerTemp2.get(), outsideTemp.get());
 
         if (telegram.source==0x03 &&
-            BusHandler::isBroadcastAddress(telegram.destination))
+            Address::isBroadcast(telegram.destination))
         {
             unsigned errorCode = 0;
             if ((burnerControlState&0x80)==0x80) {
@@ -572,8 +763,8 @@ void MainMessageHandler::process0503(const Telegram& telegram)
         ByteData _available(reader);
 
         Log::info("%s->%s BC Op. Data block 02: exhaust temp: %.2f°C, BWW lead water temp: %.1f°C, eff. boiler perf: %.1f%%, joint lead water temp: %.1f°C",
-                  address2String(telegram.source).c_str(),
-                  address2String(telegram.destination).c_str(),
+                  address2String(telegram.source),
+                  address2String(telegram.destination),
                   exhaustTemp.get(),
                   bwwLeadWaterTemp.get(), effBoilerPerf.get(),
                   jointLeadWaterTemp.get());
@@ -585,7 +776,6 @@ void MainMessageHandler::process0503(const Telegram& telegram)
 //------------------------------------------------------------------------------
 
 void MainMessageHandler::process0507(const Telegram& telegram)
-    throw(OverrunException)
 {
     DataSymbolReader reader(telegram);
 
@@ -643,8 +833,8 @@ void MainMessageHandler::process0507(const Telegram& telegram)
     }
 
     Log::info("%s->%s RC to BC Oper. Data: heatRequest: %s, action: %s, boiler target temp: %.2f°C, boiler target pressure: %.2fbar, setting degree: %.1f%%, service water target temp: %.2f°C, fuel type: 0x%02x%s",
-              address2String(telegram.source).c_str(),
-              address2String(telegram.destination).c_str(),
+              address2String(telegram.source),
+              address2String(telegram.destination),
               heatRequestStr.c_str(),
               actionStr.c_str(),
               boilerTargetTemp.get(),
@@ -657,7 +847,6 @@ void MainMessageHandler::process0507(const Telegram& telegram)
 //------------------------------------------------------------------------------
 
 void MainMessageHandler::process0700(const Telegram& telegram)
-    throw(OverrunException)
 {
     static const char* weekDayNames[7] = {
         "Mon",
@@ -691,14 +880,14 @@ void MainMessageHandler::process0700(const Telegram& telegram)
     }
 
     Log::info("%s->%s Date/Time: outside temp: %.2f°C, 20%02u-%02u-%02u (%s) %02u:%02u:%02u",
-              address2String(telegram.source).c_str(),
-              address2String(telegram.destination).c_str(),
+              address2String(telegram.source),
+              address2String(telegram.destination),
               outsideTemp.get(),
               year.get(), month.get(), day.get(), weekDayStr.c_str(),
               hours.get(), minutes.get(), seconds.get());
 
     if (telegram.source==0x30 &&
-        BusHandler::isBroadcastAddress(telegram.destination))
+        Address::isBroadcast(telegram.destination))
     {
         char buf[64];
         snprintf(buf, sizeof(buf), "%04u-%02u-%02u %02u:%02u:%02u",
@@ -718,7 +907,6 @@ void MainMessageHandler::process0700(const Telegram& telegram)
 //------------------------------------------------------------------------------
 
 void MainMessageHandler::process0800(const Telegram& telegram)
-     throw(OverrunException)
 {
     DataSymbolReader reader(telegram);
 
@@ -732,14 +920,14 @@ void MainMessageHandler::process0800(const Telegram& telegram)
                                   "heater_circuit_active");
 
     Log::info("%s->%s RC Target Values: boiler temp: %.2f°C, outside temp: %.2f°C, service water temp: %.2f°C, force performance: %d%%, status:%s",
-              address2String(telegram.source).c_str(),
-              address2String(telegram.destination).c_str(),
+              address2String(telegram.source),
+              address2String(telegram.destination),
               boilerTargetTemp.get(), outsideTemp.get(),
               serviceWaterTargetTemp.get(), forcePerformance.get(),
               statusStr.c_str());
 
     if (telegram.source==0xf1 &&
-        BusHandler::isBroadcastAddress(telegram.destination))
+        Address::isBroadcast(telegram.destination))
     {
         auto now = currentMillis();
 
@@ -755,7 +943,6 @@ void MainMessageHandler::process0800(const Telegram& telegram)
 //------------------------------------------------------------------------------
 
 void MainMessageHandler::process5014(const Telegram& telegram)
-    throw(OverrunException)
 {
     DataSymbolReader reader(telegram);
 
@@ -767,8 +954,8 @@ void MainMessageHandler::process5014(const Telegram& telegram)
     string statusStr = bit2String(status);
 
     Log::info("%s->%s Control data (5014): boiler temp: %.2f°C, room temp: %.2f°C, mixer temp: %.2f°C, status:%s",
-              address2String(telegram.source).c_str(),
-              address2String(telegram.destination).c_str(),
+              address2String(telegram.source),
+              address2String(telegram.destination),
               boilerTargetTemp.get(), roomTemp.get(), mixerTemp.get(),
               statusStr.c_str());
 
@@ -783,6 +970,12 @@ void MainMessageHandler::process5014(const Telegram& telegram)
 
 void MainMessageHandler::sendErrorMail(unsigned errorCode)
 {
+    if (ebus.isReplaying()) {
+        Log::info("Not sending error mail for error code %u while replaying",
+                  errorCode);
+        return;
+    }
+
     if (fork()!=0) return;
 
     if (::daemon(0, 0)!=0) {
@@ -801,18 +994,75 @@ void MainMessageHandler::sendErrorMail(unsigned errorCode)
 //------------------------------------------------------------------------------
 //------------------------------------------------------------------------------
 
+/**
+ * A bus handled by the daemon with all the objects needed for it.
+ */
+struct Bus
+{
+    /**
+     * The name of the bus used in the log, if there are several buses.
+     */
+    std::string name;
+
+    /**
+     * The eBUS interface.
+     */
+    EBUS ebus;
+
+    /**
+     * The bus handler.
+     */
+    BusHandler busHandler;
+
+    /**
+     * The message handler.
+     */
+    MainMessageHandler messageHandler;
+
+    /**
+     * Construct the bus for the given device file driven by the given
+     * reactor.
+     */
+    Bus(Reactor& reactor, const std::string& deviceFile, WebData& webData,
+        const char* argv0);
+};
+
+//------------------------------------------------------------------------------
+
+inline Bus::Bus(Reactor& reactor, const std::string& deviceFile,
+                WebData& webData, const char* argv0) :
+    name(deviceFile),
+    ebus(reactor, deviceFile),
+    busHandler(ebus),
+    messageHandler(ebus, busHandler, webData, argv0)
+{
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
 int usage(bool error, char* argv[])
 {
     FILE* f = error ? stderr : stdout;
 
-    fprintf(f, "Usage: %s [-d <device file>] [-w <web file path>] [-f] [-l <log file path>] [-p <PID file path>]\n",
+    fprintf(f, "Usage: %s [-d <device file>] [-r <replay speed>] [-L] [-U] [-P <batch window>] [-k <lock count>] [-S] [-a] [-s <slave address>] [-t <priority>[:<CPU>]] [-w <web file path>] [-f] [-l <log file path>] [-p <PID file path>]\n",
             argv[0]);
     fprintf(f, "  where\n");
-    fprintf(f, "    -d <device file>: the device file to use (default: /dev/ttyUSB0)\n");
+    fprintf(f, "    -d <device file>: the device file to use (default: /dev/ttyUSB0). If it is a regular file, it is replayed as a raw capture of the bus. A network adapter can be given as tcp://<host>:<port>. It can be given several times to handle several buses, which are all driven by the same event loop\n");
+    fprintf(f, "    -r <replay speed>: the speed of replaying a capture as a multiple of the original speed, 0 meaning as fast as possible (default: 1)\n");
+    fprintf(f, "    -L: configure the serial port for low latency and measure the write-to-echo round trip to adapt the echo timeout. At startup a SYN symbol is written for it only if the bus has been silent for the auto-SYN timeout, i.e. there is no SYN generator: right after a SYN symbol it would fall into the arbitration slot and could collide with a master starting a telegram. Otherwise the echo of our source address is measured when the arbitration is first won, and the default echo timeout is used until then\n");
+    fprintf(f, "    -U: use io_uring instead of epoll and read()/write() for the port\n");
+    fprintf(f, "    -P <batch window>: low-power mode: while the bus is idle or there is nothing to send, wait the given number of milliseconds after a byte is available, so that more bytes are read at once, and wait for the signal or the device without periodic wakeups. The reads are not batched while there is signal, if -s is given\n");
+    fprintf(f, "    -k <lock count>: the number of SYN symbols to wait for after winning the arbitration before arbitrating again, so that the other masters can send as well. If it is 0, the number of masters seen on the bus is used (default: 0)\n");
+    fprintf(f, "    -S: traffic-aware scheduling: learn the schedule of the periodic telegrams of the other masters, and defer our arbitrations while such a telegram is expected to be started\n");
+    fprintf(f, "    -a: auto-SYN mode: if no SYN symbol has been received for a second, generate the SYN symbols, until another SYN generator appears\n");
+    fprintf(f, "    -s <slave address>: answer the identification query (07 04) addressed to the given slave address (in hexadecimal) with ACK and the response (default: no queries are answered). It disables the read batching of -P while there is signal, as the reply should be started within the reply window\n");
+    fprintf(f, "    -t <priority>[:<CPU>]: handle the buses in a separate I/O thread, and process the telegrams in the main thread. If the priority is positive, the thread runs with the SCHED_FIFO policy at that priority and the memory is locked. If a CPU is given, the thread is pinned to it\n");
     fprintf(f, "    -w <web file path>: the JSON file to put the data into (default: ebus.json)\n");
     fprintf(f, "    -f: run in the foreground\n");
     fprintf(f, "    -l <log file path>: the path of the log file. If not given, no logging is done to a file\n");
     fprintf(f, "    -p <PID file path>: the path of the PID file (default: ebus.pid)\n");
+    fprintf(f, "  Send SIGUSR1 to the process to log the I/O statistics with the next telegram.\n");
 
     return error ? 1 : 0;
 }
@@ -826,22 +1076,223 @@ void handleHUP(int /*signo*/)
 
 //------------------------------------------------------------------------------
 
+void handleUSR1(int /*signo*/)
+{
+    statisticsRequested = statisticsRequested + 1;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Run the given buses: start handling their messages, and run the given
+ * reactor driving all of them until the end of the replayed captures is
+ * reached. The ports are opened again on errors.
+ */
+void runBuses(Reactor& reactor, std::vector<std::unique_ptr<Bus>>& buses,
+              bool measureRoundTrip)
+{
+    for(auto& bus: buses) {
+        bus->messageHandler.start(measureRoundTrip);
+    }
+
+    auto error = reactor.run();
+    Log::setThreadPrefix("");
+    error.raise();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Set up the calling thread for real-time operation. If the priority is
+ * positive, the memory of the process is locked and the thread is made to
+ * use the SCHED_FIFO policy with the priority. If the CPU is not negative,
+ * the thread is pinned to it. Failures are logged, but otherwise ignored.
+ */
+void setupRealTime(int priority, int cpu)
+{
+    if (priority>0) {
+        if (mlockall(MCL_CURRENT|MCL_FUTURE)<0) {
+            Log::error("Could not lock the memory: %s",
+                       OSError::toString(errno).c_str());
+        }
+
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = priority;
+        int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error!=0) {
+            Log::error("Could not set the SCHED_FIFO priority %d: %s",
+                       priority, OSError::toString(error).c_str());
+        }
+    }
+
+    if (cpu>=0) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        CPU_SET(cpu, &cpuSet);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(cpuSet),
+                                           &cpuSet);
+        if (error!=0) {
+            Log::error("Could not pin the I/O thread to CPU %d: %s",
+                       cpu, OSError::toString(error).c_str());
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Start a separate I/O thread running the given buses with the given
+ * reactor set up with the given real-time parameters. The events of the
+ * buses are to be dispatched by dispatchEvents().
+ */
+std::thread startIOThread(Reactor& reactor,
+                          std::vector<std::unique_ptr<Bus>>& buses,
+                          bool measureRoundTrip, int priority, int cpu)
+{
+    for(auto& bus: buses) {
+        bus->messageHandler.enableDispatching();
+    }
+
+    return std::thread([&reactor, &buses, measureRoundTrip, priority, cpu]() {
+            // The signals should be handled by the main thread
+            sigset_t signals;
+            sigfillset(&signals);
+            pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+            setupRealTime(priority, cpu);
+
+            try {
+                runBuses(reactor, buses, measureRoundTrip);
+            } catch(const exception& e) {
+                Log::error("Exception caught in the I/O thread: %s",
+                           e.what());
+            }
+
+            for(auto& bus: buses) {
+                bus->messageHandler.stopDispatching();
+            }
+        });
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Dispatch the events of the given buses run by the I/O thread until it
+ * finishes. The event file descriptors of the buses are watched by a
+ * single epoll instance.
+ */
+void dispatchEvents(std::vector<std::unique_ptr<Bus>>& buses, bool logName)
+{
+    int epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFD<0) throw OSError("epoll_create1");
+
+    for(auto& bus: buses) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = bus.get();
+        if (epoll_ctl(epollFD, EPOLL_CTL_ADD,
+                      bus->messageHandler.getEventFD(), &event)<0)
+        {
+            OSError error("epoll_ctl");
+            ::close(epollFD);
+            throw error;
+        }
+    }
+
+    size_t numActive = buses.size();
+    struct epoll_event events[16];
+    while(numActive>0) {
+        int numEvents = epoll_wait(epollFD, events,
+                                   sizeof(events)/sizeof(events[0]), -1);
+        if (numEvents<0) {
+            if (errno!=EINTR) {
+                Log::error("epoll_wait failed: %s",
+                           OSError::toString(errno).c_str());
+            }
+            continue;
+        }
+
+        for(int i = 0; i<numEvents; ++i) {
+            auto bus = static_cast<Bus*>(events[i].data.ptr);
+            if (logName) Log::setThreadPrefix(bus->name);
+            if (!bus->messageHandler.dispatch()) {
+                epoll_ctl(epollFD, EPOLL_CTL_DEL,
+                          bus->messageHandler.getEventFD(), 0);
+                --numActive;
+            }
+        }
+    }
+    Log::setThreadPrefix("");
+
+    ::close(epollFD);
+}
+
+//------------------------------------------------------------------------------
+
 int main(int argc, char* argv[])
 {
     int opt;
 
-    string deviceFile("/dev/ttyUSB0");
+    std::vector<string> deviceFiles;
     string webFilePath("ebus.json");
     string pidFilePath("ebus.pid");
     bool foreground = false;
     string logFilePath;
-
-
-    while((opt = getopt(argc, argv, "d:w:fl:hp:")) != -1) {
+    double replaySpeed = 1.0;
+    bool lowLatency = false;
+    bool useIOURing = false;
+    unsigned lowPowerBatchWindow = 0;
+    unsigned lockCount = 0;
+    bool trafficScheduling = false;
+    bool autoSYN = false;
+    unsigned slaveAddress = 0;
+    bool useIOThread = false;
+    int ioThreadPriority = 0;
+    int ioThreadCPU = -1;
+
+
+    while((opt = getopt(argc, argv, "d:r:LUP:k:Sas:t:w:fl:hp:")) != -1) {
         switch (opt) {
           case 'd':
-            deviceFile = optarg;
+            deviceFiles.push_back(optarg);
+            break;
+          case 'r':
+            replaySpeed = atof(optarg);
+            break;
+          case 'L':
+            lowLatency = true;
+            break;
+          case 'U':
+            useIOURing = true;
+            break;
+          case 'P':
+            lowPowerBatchWindow = atoi(optarg);
+            break;
+          case 'k':
+            lockCount = atoi(optarg);
             break;
+          case 'S':
+            trafficScheduling = true;
+            break;
+          case 'a':
+            autoSYN = true;
+            break;
+          case 's':
+            slaveAddress = strtoul(optarg, 0, 16);
+            if (slaveAddress>0xff || !Address::isSlave(slaveAddress)) {
+                fprintf(stderr, "%s: invalid slave address: %s\n",
+                        argv[0], optarg);
+                return usage(true, argv);
+            }
+            break;
+          case 't': {
+            useIOThread = true;
+            ioThreadPriority = atoi(optarg);
+            const char* cpu = strchr(optarg, ':');
+            if (cpu!=0) ioThreadCPU = atoi(cpu + 1);
+            break;
+          }
           case 'w':
             webFilePath = optarg;
             break;
@@ -862,6 +1313,10 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (deviceFiles.empty()) {
+        deviceFiles.push_back("/dev/ttyUSB0");
+    }
+
     if (!logFilePath.empty()) {
         Log::enableFile(logFilePath);
 
@@ -879,6 +1334,16 @@ int main(int argc, char* argv[])
         }
     }
 
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &handleUSR1;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &sa, 0)<0) {
+        perror("sigaction");
+        return 3;
+    }
+
     if (foreground) {
         Log::enableStdout();
     } else {
@@ -894,11 +1359,40 @@ int main(int argc, char* argv[])
         fclose(pidFile);
     }
 
-    EBUS ebus(deviceFile);
-    try {
+    if (!SymbolScanner::check()) {
+        Log::error("The %s symbol scanning gives wrong results",
+                   SymbolScanner::isVectorized() ? "vectorized" : "scalar");
+        return 1;
+    }
 
-        BusHandler busHandler(ebus);
-        MainMessageHandler messageHandler(busHandler, webFilePath, argv[0]);
+    WebData webData(webFilePath);
+    try {
+        // All buses are driven by the same reactor, which should outlive
+        // them
+        Reactor reactor;
+        std::vector<std::unique_ptr<Bus>> buses;
+        bool logName = deviceFiles.size()>1;
+        for(const auto& deviceFile: deviceFiles) {
+            auto bus = new Bus(reactor, deviceFile, webData, argv[0]);
+            buses.emplace_back(bus);
+
+            if (logName) bus->ebus.setLogPrefix(bus->name);
+            bus->ebus.setReplaySpeed(replaySpeed);
+            bus->ebus.setLowLatency(lowLatency);
+            bus->ebus.setUseIOURing(useIOURing);
+            bus->messageHandler.setLockCount(lockCount);
+            bus->messageHandler.setTrafficScheduling(trafficScheduling);
+            bus->messageHandler.setAutoSYN(autoSYN);
+            if (slaveAddress!=0) {
+                bus->messageHandler.setSlaveAddress(slaveAddress);
+                bus->messageHandler.setIdentification(0xff, "EBUS",
+                                                      0x0001, 0x0000);
+            }
+            if (lowPowerBatchWindow>0) {
+                bus->ebus.setLowPower(lowPowerBatchWindow*1000000ULL);
+                bus->messageHandler.setLowPower(true);
+            }
+        }
 
         // auto telegram = new Telegram(0x31, 0x10, 0x07, 0x01, 9);
         // telegram->dataSymbols[0] = 0x10;
@@ -913,18 +1407,30 @@ int main(int argc, char* argv[])
 
         // auto telegram = new Telegram(0x31, 0x15, 0x07, 0x04, 0);
 
-        // messageHandler.send(telegram);
+        // buses.front()->messageHandler.send(telegram);
 
-        while(true) {
-            try {
-                ebus.open();
+        auto startTime = currentTimeNanos();
+        if (useIOThread) {
+            auto ioThread = startIOThread(reactor, buses, lowLatency,
+                                          ioThreadPriority, ioThreadCPU);
+            dispatchEvents(buses, logName);
+            ioThread.join();
+        } else {
+            runBuses(reactor, buses, lowLatency);
+        }
 
-                messageHandler.run();
-            } catch(const OSError& e) {
-                Log::error("OSError: %s, trying to open the port again",
-                           e.what());
-            }
+        double duration = (currentTimeNanos() - startTime) / 1e9;
+        unsigned long long numTelegrams = 0;
+        unsigned long long numSymbols = 0;
+        for(auto& bus: buses) {
+            numTelegrams += bus->messageHandler.getNumTelegrams();
+            numSymbols += bus->ebus.getStatistics().numBytesRead.load();
         }
+        Log::info("Replay finished: %llu telegrams and %llu symbols in %.3f s (%.1f telegrams/s, %.0f ns/symbol, %s scanning)",
+                  numTelegrams, numSymbols, duration,
+                  numTelegrams / duration,
+                  (numSymbols>0) ? (duration * 1e9 / numSymbols) : 0.0,
+                  SymbolScanner::isVectorized() ? "vectorized" : "scalar");
         return 0;
     } catch(const exception& e) {
         Log::error("Exception caught: %s", e.what());
@@ -0,0 +1,1017 @@
+// Copyright (c) 2016 by István Váradi
+
+// This file is part of eBUS, an eBUS handler utility
+
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+//------------------------------------------------------------------------------
+
+// Benchmarks of the kernels of the eBUS handler. Each benchmark compares an
+// optimized kernel with the straightforward implementation it replaced on
+// the same, reproducible input.
+
+//------------------------------------------------------------------------------
+
+#include "EBUS.h"
+#include "Reactor.h"
+#include "IOURing.h"
+#include "CRC.h"
+#include "SymbolScanner.h"
+#include "TelegramParser.h"
+#include "BusHandler.h"
+#include "OSError.h"
+#include "util.h"
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+//------------------------------------------------------------------------------
+
+using std::string;
+
+//------------------------------------------------------------------------------
+
+/**
+ * The number of symbols to process in each measurement.
+ */
+static const size_t numSymbolsPerRun = 64*1024*1024;
+
+/**
+ * The SYN symbol.
+ */
+static const symbol_t symbolSYN = BusHandler::SYMBOL_SYN;
+
+/**
+ * The escape symbol.
+ */
+static const symbol_t symbolESC = BusHandler::SYMBOL_ESC;
+
+/**
+ * A sink for the results, so that the benchmarked code is not optimized
+ * away.
+ */
+static volatile unsigned sink = 0;
+
+//------------------------------------------------------------------------------
+
+/**
+ * Generate a buffer of the given length of pseudo-random symbols. The seed
+ * is fixed, so the runs are reproducible.
+ */
+static std::vector<symbol_t> generateRandom(size_t length)
+{
+    std::vector<symbol_t> symbols(length);
+    uint32_t x = 1;
+    for(auto& symbol: symbols) {
+        x = x*1103515245 + 12345;
+        symbol = static_cast<symbol_t>(x>>16);
+    }
+    return symbols;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Benchmark the CRC computation: updating symbol by symbol, as the CRC was
+ * computed originally, and the slice-by-8 bulk update. The lengths are
+ * those of a typical telegram, of a read buffer and of a large capture.
+ */
+static void benchmarkCRC()
+{
+    static const size_t bufferLength = 1024*1024;
+    auto buffer = generateRandom(bufferLength + 1024);
+
+    printf("CRC:\n");
+    for(size_t length: {size_t(12), size_t(64), bufferLength}) {
+        size_t numRuns = numSymbolsPerRun / length;
+
+        auto start = currentTimeNanos();
+        for(size_t i = 0; i<numRuns; ++i) {
+            const symbol_t* symbols = buffer.data() + (i&1023);
+            symbol_t crc = 0;
+            for(size_t j = 0; j<length; ++j) {
+                crc = CRC::update(crc, symbols[j]);
+            }
+            sink = sink ^ crc;
+        }
+        auto bytewiseEnd = currentTimeNanos();
+        for(size_t i = 0; i<numRuns; ++i) {
+            sink = sink ^ CRC::compute(buffer.data() + (i&1023), length);
+        }
+        auto slicedEnd = currentTimeNanos();
+
+        double numSymbols = static_cast<double>(numRuns) * length;
+        printf("  %7zu symbols: symbol by symbol %.2f ns/symbol, "
+               "sliced %.2f ns/symbol\n", length,
+               (bytewiseEnd - start) / numSymbols,
+               (slicedEnd - bytewiseEnd) / numSymbols);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Append the given symbol to the given buffer, escaping it if needed.
+ */
+static void appendEscaped(std::vector<symbol_t>& symbols, symbol_t symbol)
+{
+    if (symbol==symbolESC || symbol==symbolSYN) {
+        symbols.push_back(symbolESC);
+        symbols.push_back(symbol - symbolESC);
+    } else {
+        symbols.push_back(symbol);
+    }
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Generate a capture of the given number of symbols. If the bus is idle,
+ * it consists of SYN symbols only. Otherwise it consists of broadcast
+ * telegrams, each with 16 pseudo-random data symbols, separated by single
+ * SYN symbols.
+ */
+static std::vector<symbol_t> generateCapture(size_t length, bool idle)
+{
+    if (idle) return std::vector<symbol_t>(length, symbolSYN);
+
+    std::vector<symbol_t> symbols;
+    auto random = generateRandom(length);
+    for(size_t i = 0; symbols.size()<length; ++i) {
+        symbols.push_back(symbolSYN);
+
+        size_t start = symbols.size();
+        symbols.push_back(0x10);
+        symbols.push_back(0xfe);
+        symbols.push_back(0xb5);
+        symbols.push_back(0x16);
+        symbols.push_back(16);
+        for(size_t j = 0; j<16; ++j) {
+            appendEscaped(symbols, random[(i*16 + j) % length]);
+        }
+        appendEscaped(symbols, CRC::compute(symbols.data() + start,
+                                            symbols.size() - start));
+    }
+
+    symbols.resize(length);
+    return symbols;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Find the first symbol differing from the given one one by one, as the
+ * parser used to do.
+ */
+static size_t findOtherSymbolwise(const symbol_t* symbols, size_t length,
+                                  symbol_t symbol)
+{
+    size_t offset = 0;
+    while(offset<length && symbols[offset]==symbol) ++offset;
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Find the first occurence of either of the given symbols one by one, as
+ * the parser used to do.
+ */
+static size_t findSymbolwise(const symbol_t* symbols, size_t length,
+                             symbol_t symbol1, symbol_t symbol2)
+{
+    size_t offset = 0;
+    while(offset<length && symbols[offset]!=symbol1 &&
+          symbols[offset]!=symbol2)
+    {
+        ++offset;
+    }
+    return offset;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Unescape the given buffer one symbol at a time, as the parser used to do.
+ * It stops where SymbolScanner::unescape() would.
+ */
+static size_t unescapeSymbolwise(const symbol_t* symbols, size_t length,
+                                 symbol_t* unescaped, size_t maxLength,
+                                 symbol_t delimiter, symbol_t escape,
+                                 size_t& numConsumed)
+{
+    size_t offset = 0;
+    size_t numUnescaped = 0;
+    while(offset<length && numUnescaped<maxLength) {
+        auto symbol = symbols[offset];
+        if (symbol==delimiter) {
+            break;
+        } else if (symbol==escape) {
+            if (offset + 1>=length || symbols[offset + 1]>1) break;
+            unescaped[numUnescaped++] = symbol + symbols[offset + 1];
+            offset += 2;
+        } else {
+            unescaped[numUnescaped++] = symbol;
+            ++offset;
+        }
+    }
+
+    numConsumed = offset;
+    return numUnescaped;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Skip the runs of SYN symbols in the given capture with the given
+ * function, as the parser does between the telegrams.
+ *
+ * @return the number of runs.
+ */
+template <class FindOther>
+static size_t skipSYNs(const std::vector<symbol_t>& capture,
+                       FindOther findOther)
+{
+    size_t count = 0;
+    for(size_t offset = 0; offset<capture.size(); ++count) {
+        offset += findOther(capture.data() + offset, capture.size() - offset,
+                            symbolSYN) + 1;
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Find the SYN and escape symbols in the given capture with the given
+ * function, as the parser does within the telegrams.
+ *
+ * @return the number of symbols found.
+ */
+template <class Find>
+static size_t findSpecials(const std::vector<symbol_t>& capture, Find find)
+{
+    size_t count = 0;
+    for(size_t offset = 0; offset<capture.size(); ++count) {
+        offset += find(capture.data() + offset, capture.size() - offset,
+                       symbolSYN, symbolESC) + 1;
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Unescape the given capture with the given function, skipping the
+ * symbols it stops at.
+ *
+ * @return the number of symbols produced.
+ */
+template <class Unescape>
+static size_t unescapeAll(const std::vector<symbol_t>& capture,
+                          Unescape unescape)
+{
+    symbol_t unescaped[256];
+    size_t count = 0;
+    for(size_t offset = 0; offset<capture.size();) {
+        size_t numConsumed = 0;
+        count += unescape(capture.data() + offset, capture.size() - offset,
+                          unescaped, sizeof(unescaped), symbolSYN, symbolESC,
+                          numConsumed);
+        offset += (numConsumed==0) ? 1 : numConsumed;
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Parse the given capture symbol by symbol.
+ *
+ * @return the number of complete telegrams.
+ */
+static size_t parseSymbolwise(const std::vector<symbol_t>& capture,
+                              const std::vector<unsigned long long>& times)
+{
+    TelegramParser parser;
+    size_t count = 0;
+    for(size_t i = 0; i<capture.size(); ++i) {
+        if (parser.push(capture[i], times[i])==
+            TelegramParser::STATUS_COMPLETE)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Parse the given capture in bulk.
+ *
+ * @return the number of complete telegrams.
+ */
+static size_t parseScanned(const std::vector<symbol_t>& capture,
+                           const std::vector<unsigned long long>& times)
+{
+    TelegramParser parser;
+    size_t count = 0;
+    for(size_t offset = 0; offset<capture.size();) {
+        TelegramParser::status_t status;
+        offset += parser.push(capture.data() + offset, times.data() + offset,
+                              capture.size() - offset, status);
+        if (status==TelegramParser::STATUS_COMPLETE) ++count;
+    }
+    return count;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Run the given symbol by symbol and scanning variants of an operation on
+ * the given number of symbols the given number of times, and print the
+ * time they take per symbol.
+ *
+ * @return whether the variants give the same result.
+ */
+template <class Symbolwise, class Scanned>
+static bool compare(const char* name, size_t numSymbols, size_t numRuns,
+                    Symbolwise symbolwise, Scanned scanned)
+{
+    size_t symbolwiseResult = 0;
+    auto start = currentTimeNanos();
+    for(size_t i = 0; i<numRuns; ++i) symbolwiseResult = symbolwise();
+    auto symbolwiseEnd = currentTimeNanos();
+    size_t scannedResult = 0;
+    for(size_t i = 0; i<numRuns; ++i) scannedResult = scanned();
+    auto scannedEnd = currentTimeNanos();
+
+    double numTotal = static_cast<double>(numRuns) * numSymbols;
+    printf("    %-8s symbol by symbol %5.2f ns/symbol, "
+           "scanned %5.2f ns/symbol\n", name,
+           (symbolwiseEnd - start) / numTotal,
+           (scannedEnd - symbolwiseEnd) / numTotal);
+    if (symbolwiseResult!=scannedResult) {
+        printf("    the results differ: %zu vs. %zu\n",
+               symbolwiseResult, scannedResult);
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Benchmark the scanning of the received symbols on a capture of an idle
+ * bus and on one with traffic. The kernels are checked first. They gain
+ * on long runs, like the SYN symbols of an idle bus, while on short runs
+ * the overhead of a call may exceed the gain.
+ */
+static bool benchmarkScanning()
+{
+    static const size_t captureLength = 1024*1024;
+    static const size_t numRuns = 16;
+
+    printf("Symbol scanning (%s):\n",
+           SymbolScanner::isVectorized() ? "vectorized" : "scalar");
+    if (!SymbolScanner::check()) {
+        printf("  the kernels give wrong results\n");
+        return false;
+    }
+
+    size_t (*find2)(const symbol_t*, size_t, symbol_t, symbol_t) =
+        &SymbolScanner::find;
+
+    std::vector<unsigned long long> times(captureLength);
+    for(size_t i = 0; i<captureLength; ++i) times[i] = i;
+
+    for(bool idle: {true, false}) {
+        auto capture = generateCapture(captureLength, idle);
+        printf("  %s:\n", idle ? "idle bus" : "traffic");
+
+        if (!compare("skip SYN", captureLength, numRuns,
+                     [&]() { return skipSYNs(capture, findOtherSymbolwise); },
+                     [&]() { return skipSYNs(capture,
+                                             SymbolScanner::findOther); }) ||
+            !compare("find", captureLength, numRuns,
+                     [&]() { return findSpecials(capture, findSymbolwise); },
+                     [&]() { return findSpecials(capture, find2); }) ||
+            !compare("unescape", captureLength, numRuns,
+                     [&]() {
+                         return unescapeAll(capture, unescapeSymbolwise);
+                     },
+                     [&]() {
+                         return unescapeAll(capture,
+                                            SymbolScanner::unescape);
+                     }) ||
+            !compare("parse", captureLength, numRuns,
+                     [&]() { return parseSymbolwise(capture, times); },
+                     [&]() { return parseScanned(capture, times); }))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * The other end of a bus simulated on the master side of a pseudo-terminal
+ * by a thread. It either echoes the bytes written to the bus, like a real
+ * bus does, or it sends a sequence of bytes at a given pace, like the
+ * other devices on the bus do.
+ */
+class PseudoBus
+{
+private:
+    /**
+     * The file descriptor of the master side.
+     */
+    int masterFD;
+
+    /**
+     * The path of the slave side.
+     */
+    string slavePath;
+
+    /**
+     * The thread simulating the bus.
+     */
+    std::thread thread;
+
+    /**
+     * Indicate if the thread should run.
+     */
+    std::atomic<bool> running;
+
+public:
+    /**
+     * Open the pseudo-terminal. It throws an OSError if it fails.
+     */
+    PseudoBus();
+
+    /**
+     * Stop the thread, if running, and close the pseudo-terminal.
+     */
+    ~PseudoBus();
+
+    /**
+     * Get the path of the slave side, which is to be opened as the device.
+     */
+    const string& getSlavePath() const;
+
+    /**
+     * Start echoing the bytes written to the slave side.
+     */
+    void startEcho();
+
+    /**
+     * Start sending the given number of bytes, each being the lower 8 bits
+     * of its index, with the given interval in nanoseconds between them.
+     */
+    void startSending(size_t length, unsigned long long interval);
+
+    /**
+     * Stop the thread.
+     */
+    void stop();
+
+private:
+    /**
+     * Echo the bytes until stopped.
+     */
+    void echo();
+
+    /**
+     * Send the bytes.
+     */
+    void send(size_t length, unsigned long long interval);
+};
+
+//------------------------------------------------------------------------------
+
+PseudoBus::PseudoBus() :
+    masterFD(posix_openpt(O_RDWR | O_NOCTTY)),
+    running(false)
+{
+    if (masterFD<0) throw OSError("PseudoBus::PseudoBus: posix_openpt");
+    if (grantpt(masterFD)<0 || unlockpt(masterFD)<0) {
+        OSError error("PseudoBus::PseudoBus: grantpt/unlockpt");
+        close(masterFD);
+        throw error;
+    }
+    slavePath = ptsname(masterFD);
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+PseudoBus::~PseudoBus()
+{
+    stop();
+    close(masterFD);
+}
+
+//------------------------------------------------------------------------------
+
+inline const string& PseudoBus::getSlavePath() const
+{
+    return slavePath;
+}
+
+//------------------------------------------------------------------------------
+
+void PseudoBus::startEcho()
+{
+    running = true;
+    thread = std::thread(&PseudoBus::echo, this);
+}
+
+//------------------------------------------------------------------------------
+
+void PseudoBus::startSending(size_t length, unsigned long long interval)
+{
+    running = true;
+    thread = std::thread(&PseudoBus::send, this, length, interval);
+}
+
+//------------------------------------------------------------------------------
+
+void PseudoBus::stop()
+{
+    running = false;
+    if (thread.joinable()) thread.join();
+}
+
+//------------------------------------------------------------------------------
+
+void PseudoBus::echo()
+{
+    while(running) {
+        struct pollfd pfd;
+        pfd.fd = masterFD;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 10)<=0) continue;
+
+        uint8_t buffer[256];
+        auto length = read(masterFD, buffer, sizeof(buffer));
+        if (length>0 && write(masterFD, buffer, length)!=length) break;
+    }
+}
+
+//------------------------------------------------------------------------------
+
+void PseudoBus::send(size_t length, unsigned long long interval)
+{
+    auto next = currentTimeNanos();
+    for(size_t i = 0; i<length && running; ++i) {
+        sleepUntilNanos(next);
+        uint8_t b = static_cast<uint8_t>(i);
+        if (write(masterFD, &b, 1)!=1) break;
+        next += interval;
+    }
+}
+
+//------------------------------------------------------------------------------
+//------------------------------------------------------------------------------
+
+/**
+ * Get the number of I/O system calls made by the given handler.
+ */
+static unsigned long long getNumSystemCalls(const EBUS& ebus)
+{
+    const auto& statistics = ebus.getStatistics();
+    return statistics.numWaitCalls + statistics.numReadCalls +
+        statistics.numWriteCalls + statistics.numRingEnterCalls +
+        statistics.numTimerCalls;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Get the CPU time used by the calling thread in nanoseconds.
+ */
+static unsigned long long getThreadCPUTime()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_THREAD, &usage)<0) return 0;
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * The listener of the handler whose I/O is benchmarked over a
+ * pseudo-terminal:
+ * - round trip: write a symbol and wait for its echo, as when sending,
+ * - receive: receive single symbols arriving at 5 times the speed of the
+ *   bus, as when listening to the bus.
+ *
+ * The reactor driving the handler is stopped when the benchmark is done or
+ * the expected symbols have not been received.
+ */
+class IOBenchmark : public EBUS::Listener
+{
+public:
+    /**
+     * The number of round trips measured.
+     */
+    static const size_t numRoundTrips = 2000;
+
+    /**
+     * The number of symbols received.
+     */
+    static const size_t numReceived = 2000;
+
+    /**
+     * The interval in nanoseconds between the symbols received.
+     */
+    static const unsigned long long receiveInterval =
+        EBUS::SYMBOL_DURATION / 5;
+
+    /**
+     * The timeout in nanoseconds for a symbol to arrive.
+     */
+    static const unsigned long long timeout = 1000000000ULL;
+
+private:
+    /**
+     * The reactor driving the handler.
+     */
+    Reactor& reactor;
+
+    /**
+     * The handler benchmarked.
+     */
+    EBUS& ebus;
+
+    /**
+     * The bus simulated.
+     */
+    PseudoBus& pseudoBus;
+
+    /**
+     * Indicate if the symbols are being received, i.e. the round trips
+     * have been measured.
+     */
+    bool receiving;
+
+    /**
+     * The number of symbols received so far in the current phase.
+     */
+    size_t numSymbols;
+
+    /**
+     * The monotonic time in nanoseconds when the last symbol has been
+     * written.
+     */
+    unsigned long long writeTime;
+
+    /**
+     * The round trip times measured.
+     */
+    std::vector<unsigned long long> roundTrips;
+
+    /**
+     * The number of system calls made by the handler at the start of the
+     * current phase.
+     */
+    unsigned long long numSystemCalls;
+
+    /**
+     * The CPU time used by the thread at the start of the current phase.
+     */
+    unsigned long long cpuTime;
+
+    /**
+     * Indicate if the expected symbols have been received.
+     */
+    bool succeeded;
+
+public:
+    /**
+     * Construct the benchmark for the given handler driven by the given
+     * reactor over the given bus.
+     */
+    IOBenchmark(Reactor& reactor, EBUS& ebus, PseudoBus& pseudoBus);
+
+    /**
+     * Determine if the expected symbols have been received.
+     */
+    bool isSucceeded() const;
+
+    /**
+     * Start the round trips.
+     */
+    virtual void opened() noexcept;
+
+    /**
+     * Check the symbols received.
+     */
+    virtual void received() noexcept;
+
+    /**
+     * Report the symbol that has not been received.
+     */
+    virtual void deadlinePassed() noexcept;
+
+    /**
+     * Report the failure of the handler.
+     */
+    virtual void failed(const Error& error) noexcept;
+
+private:
+    /**
+     * Write the next symbol of the round trips.
+     */
+    void writeNext();
+
+    /**
+     * Report the round trips, and start receiving the symbols.
+     */
+    void startReceiving();
+
+    /**
+     * Finish the benchmark with the given result.
+     */
+    void finish(bool succeeded);
+};
+
+//------------------------------------------------------------------------------
+
+inline IOBenchmark::IOBenchmark(Reactor& reactor, EBUS& ebus,
+                                PseudoBus& pseudoBus) :
+    reactor(reactor),
+    ebus(ebus),
+    pseudoBus(pseudoBus),
+    receiving(false),
+    numSymbols(0),
+    writeTime(0),
+    numSystemCalls(0),
+    cpuTime(0),
+    succeeded(false)
+{
+    ebus.setListener(this);
+}
+
+//------------------------------------------------------------------------------
+
+inline bool IOBenchmark::isSucceeded() const
+{
+    return succeeded;
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::opened() noexcept
+{
+    pseudoBus.startEcho();
+    numSystemCalls = getNumSystemCalls(ebus);
+    cpuTime = getThreadCPUTime();
+    writeNext();
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::received() noexcept
+{
+    uint8_t symbol;
+    while(ebus.nextReceived(symbol)) {
+        if (symbol!=static_cast<uint8_t>(numSymbols)) {
+            deadlinePassed();
+            return;
+        }
+        ++numSymbols;
+
+        if (!receiving) {
+            roundTrips.push_back(currentTimeNanos() - writeTime);
+            if (numSymbols<numRoundTrips) {
+                writeNext();
+            } else {
+                startReceiving();
+            }
+            return;
+        }
+
+        if (numSymbols==numReceived) {
+            numSystemCalls = getNumSystemCalls(ebus) - numSystemCalls;
+            cpuTime = getThreadCPUTime() - cpuTime;
+            pseudoBus.stop();
+
+            printf("    receive: %.2f system calls and %.1f us CPU time per symbol\n",
+                   static_cast<double>(numSystemCalls) / numReceived,
+                   cpuTime / 1000.0 / numReceived);
+            finish(true);
+            return;
+        }
+    }
+
+    ebus.setDeadline(currentTimeNanos() + timeout);
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::deadlinePassed() noexcept
+{
+    if (receiving) {
+        printf("    symbol %zu has not been received\n", numSymbols);
+    } else {
+        printf("    the echo of %02x has not been received\n",
+               static_cast<uint8_t>(numSymbols));
+    }
+    finish(false);
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::failed(const Error& error) noexcept
+{
+    printf("    %s\n", error.toString().c_str());
+    finish(false);
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::writeNext()
+{
+    writeTime = currentTimeNanos();
+    auto error = ebus.write(static_cast<uint8_t>(numSymbols));
+    if (!error.isOK()) {
+        failed(error);
+        return;
+    }
+    ebus.setDeadline(writeTime + timeout);
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::startReceiving()
+{
+    numSystemCalls = getNumSystemCalls(ebus) - numSystemCalls;
+    cpuTime = getThreadCPUTime() - cpuTime;
+    pseudoBus.stop();
+
+    std::sort(roundTrips.begin(), roundTrips.end());
+    unsigned long long total = 0;
+    for(auto roundTrip: roundTrips) total += roundTrip;
+    printf("    round trip: %.1f us on average, %.1f us at the 99th "
+           "percentile, %.2f system calls and %.1f us CPU time each\n",
+           total / 1000.0 / numRoundTrips,
+           roundTrips[numRoundTrips * 99 / 100] / 1000.0,
+           static_cast<double>(numSystemCalls) / numRoundTrips,
+           cpuTime / 1000.0 / numRoundTrips);
+
+    receiving = true;
+    numSymbols = 0;
+    pseudoBus.startSending(numReceived, receiveInterval);
+    numSystemCalls = getNumSystemCalls(ebus);
+    cpuTime = getThreadCPUTime();
+    ebus.setDeadline(currentTimeNanos() + timeout);
+}
+
+//------------------------------------------------------------------------------
+
+void IOBenchmark::finish(bool succeeded)
+{
+    this->succeeded = succeeded;
+    ebus.close();
+    reactor.stop();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Benchmark the I/O of the handler with the given method over a
+ * pseudo-terminal. See IOBenchmark.
+ *
+ * @return whether the expected symbols have been received.
+ */
+static bool benchmarkIO(bool useIOURing)
+{
+    PseudoBus pseudoBus;
+    Reactor reactor;
+    EBUS ebus(reactor, pseudoBus.getSlavePath());
+    ebus.setUseIOURing(useIOURing);
+
+    IOBenchmark benchmark(reactor, ebus, pseudoBus);
+
+    printf("  %s:\n", useIOURing ? "io_uring" : "epoll");
+
+    ebus.open().raise();
+    reactor.run().raise();
+
+    return benchmark.isSucceeded();
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Benchmark the I/O with epoll and with io_uring, if it is supported.
+ */
+static bool benchmarkIO()
+{
+    printf("I/O over a pseudo-terminal:\n");
+    try {
+        if (!benchmarkIO(false)) return false;
+        if (IOURing::isSupported()) {
+            if (!benchmarkIO(true)) return false;
+        } else {
+            printf("  io_uring is not supported by the build\n");
+        }
+    } catch(const std::exception& e) {
+        printf("  failed: %s\n", e.what());
+        return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+
+/**
+ * Print the usage.
+ */
+static int usage(bool error, char* argv[])
+{
+    FILE* f = error ? stderr : stdout;
+
+    fprintf(f, "Usage: %s [crc|scan|io]...\n", argv[0]);
+    fprintf(f, "  where\n");
+    fprintf(f, "    crc: benchmark the CRC computation symbol by symbol and sliced\n");
+    fprintf(f, "    scan: check the symbol scanning kernels, and benchmark finding the SYN symbols, unescaping and parsing the telegrams symbol by symbol and with the kernels\n");
+    fprintf(f, "    io: benchmark the round trip of a symbol and the receiving of symbols over a pseudo-terminal with epoll and with io_uring\n");
+    fprintf(f, "  If no benchmark is given, all of them are run.\n");
+
+    return error ? 1 : 0;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    std::vector<string> benchmarks;
+    for(int i = 1; i<argc; ++i) {
+        string benchmark(argv[i]);
+        if (benchmark=="-h") {
+            return usage(false, argv);
+        } else if (benchmark=="crc" || benchmark=="scan" ||
+                   benchmark=="io") {
+            benchmarks.push_back(benchmark);
+        } else {
+            fprintf(stderr, "%s: unknown benchmark: %s\n", argv[0], argv[i]);
+            return usage(true, argv);
+        }
+    }
+    if (benchmarks.empty()) {
+        benchmarks.push_back("crc");
+        benchmarks.push_back("scan");
+        benchmarks.push_back("io");
+    }
+
+    for(const auto& benchmark: benchmarks) {
+        if (benchmark=="crc") {
+            benchmarkCRC();
+        } else if (benchmark=="scan") {
+            if (!benchmarkScanning()) return 1;
+        } else if (benchmark=="io") {
+            if (!benchmarkIO()) return 1;
+        }
+    }
+
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+
+// Local Variables:
+// mode: C++
+// c-basic-offset: 4
+// indent-tabs-mode: nil
+// End:
@@ -21,6 +21,7 @@
 #include "util.h"
 
 #include <ctime>
+#include <cerrno>
 
 //------------------------------------------------------------------------------
 
@@ -38,6 +39,32 @@ unsigned long long currentTimeMillis()
 
 //------------------------------------------------------------------------------
 
+unsigned long long currentTimeNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    unsigned long long x = ts.tv_sec;
+    x *= 1000000000;
+    x += ts.tv_nsec;
+
+    return x;
+}
+
+//------------------------------------------------------------------------------
+
+void sleepUntilNanos(unsigned long long t)
+{
+    struct timespec ts;
+    ts.tv_sec = t / 1000000000;
+    ts.tv_nsec = t % 1000000000;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0)==EINTR) {
+    }
+}
+
+//------------------------------------------------------------------------------
+
 // Local Variables:
 // mode: C++
 // c-basic-offset: 4
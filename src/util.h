@@ -20,6 +20,8 @@
 #define UTIL_H
 //------------------------------------------------------------------------------
 
+#include <atomic>
+
 #include <inttypes.h>
 
 //------------------------------------------------------------------------------
@@ -33,6 +35,59 @@ typedef uint8_t symbol_t;
 
 unsigned long long currentTimeMillis();
 
+/**
+ * Get the current value of the monotonic clock in nanoseconds.
+ */
+unsigned long long currentTimeNanos();
+
+/**
+ * Sleep until the monotonic clock reaches the given time in nanoseconds.
+ * The sleep is resumed if interrupted by a signal, but it returns on any
+ * other error.
+ */
+void sleepUntilNanos(unsigned long long t);
+
+/**
+ * Add the given value to the given statistics counter. The counters are
+ * updated only by the thread handling the bus, so no atomic
+ * read-modify-write operation is needed, but they may be read by other
+ * threads.
+ */
+template <typename T>
+void addToCounter(std::atomic<T>& counter,
+                  typename std::atomic<T>::value_type value = 1);
+
+/**
+ * Raise the given statistics counter to the given value, if it is less.
+ * Like addToCounter(), it is for counters updated by a single thread.
+ */
+template <typename T>
+void raiseCounter(std::atomic<T>& counter,
+                  typename std::atomic<T>::value_type value);
+
+//------------------------------------------------------------------------------
+// Template definitions
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline void addToCounter(std::atomic<T>& counter,
+                         typename std::atomic<T>::value_type value)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+
+template <typename T>
+inline void raiseCounter(std::atomic<T>& counter,
+                         typename std::atomic<T>::value_type value)
+{
+    if (value>counter.load(std::memory_order_relaxed)) {
+        counter.store(value, std::memory_order_relaxed);
+    }
+}
+
 //------------------------------------------------------------------------------
 #endif // UTIL_H
 